@@ -0,0 +1,2375 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <new>
+#include <regex>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+
+#include "termsimulator.h"
+#include "thalesremoteconnection.h"
+#include "thalesremotescriptwrapper.h"
+#include "impedancesweep.h"
+#include "resultfile.h"
+#include "telegramreactor.h"
+#include "instrumentpool.h"
+#include "telegramcapture.h"
+#include "capturereplay.h"
+#include "fixedrateacquisition.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#endif
+
+/** Benchmarks the client stack against the Term simulator on the loopback interface.
+ *
+ * Usage: RemoteScriptBenchmark [--csv] [--iterations N]
+ *
+ * The results are written to stdout as JSON (default) or CSV so runs of
+ * different builds can be compared.
+ */
+
+class BenchmarkResults
+{
+public:
+
+    /** Adds a result row for the latency distribution of the given samples in microseconds. */
+    void addLatency(std::string name, std::vector<double> samples) {
+
+        std::sort(samples.begin(), samples.end());
+
+        double sum = 0;
+
+        for (double sample : samples) {
+            sum += sample;
+        }
+
+        this->add(name, "samples", static_cast<double>(samples.size()));
+        this->add(name, "mean_us", samples.empty() ? 0 : sum / static_cast<double>(samples.size()));
+        this->add(name, "p50_us", percentile(samples, 0.5));
+        this->add(name, "p99_us", percentile(samples, 0.99));
+        this->add(name, "p999_us", percentile(samples, 0.999));
+        this->add(name, "max_us", samples.empty() ? 0 : samples.back());
+    }
+
+    void add(std::string name, std::string metric, double value) {
+
+        this->rows.push_back({name, metric, value});
+    }
+
+    void writeJson(std::ostream &stream) const {
+
+        stream << "{\n  \"benchmarks\": {";
+
+        std::string currentName;
+
+        for (const Row &row : this->rows) {
+
+            if (row.name != currentName) {
+
+                stream << (currentName.empty() ? "" : "\n    },") << "\n    \"" << row.name << "\": {";
+                currentName = row.name;
+
+            } else {
+
+                stream << ",";
+            }
+
+            stream << "\n      \"" << row.metric << "\": " << row.value;
+        }
+
+        stream << (currentName.empty() ? "" : "\n    }") << "\n  }\n}" << std::endl;
+    }
+
+    /** Adds the rows written by writeCsv(), e.g. by a child process. */
+    void addCsv(std::istream &stream) {
+
+        std::string line;
+
+        // skip the column names
+        std::getline(stream, line);
+
+        while (std::getline(stream, line)) {
+
+            size_t metric_begin = line.find(',') + 1;
+            size_t value_begin = line.find(',', metric_begin) + 1;
+
+            if (metric_begin == 0 || value_begin == 0) {
+                continue;
+            }
+
+            this->add(line.substr(0, metric_begin - 1), line.substr(metric_begin, value_begin - metric_begin - 1), std::atof(line.c_str() + value_begin));
+        }
+    }
+
+    void writeCsv(std::ostream &stream) const {
+
+        stream << "benchmark,metric,value" << std::endl;
+
+        for (const Row &row : this->rows) {
+
+            stream << row.name << "," << row.metric << "," << row.value << std::endl;
+        }
+    }
+
+protected:
+
+    struct Row {
+        std::string name;
+        std::string metric;
+        double value;
+    };
+
+    std::vector<Row> rows;
+
+    static double percentile(const std::vector<double> &sortedSamples, double fraction) {
+
+        if (sortedSamples.empty()) {
+            return 0;
+        }
+
+        size_t index = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sortedSamples.size())));
+
+        return sortedSamples[index > 0 ? index - 1 : 0];
+    }
+};
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+/** Counting allocator: counts the heap allocations of the threads which enabled counting. */
+static thread_local bool count_allocations = false;
+static std::atomic<unsigned long> counted_allocations(0);
+
+void *operator new(size_t size) {
+
+    if (count_allocations) {
+        counted_allocations++;
+    }
+
+    void *memory = std::malloc(size > 0 ? size : 1);
+
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+
+    std::free(memory);
+}
+
+static double elapsedMicroseconds(BenchmarkClock::time_point start, BenchmarkClock::time_point end) {
+
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/** Calls the function iterations times (after a short warmup) and records each call's duration. */
+static std::vector<double> measureLatency(int iterations, const std::function<void()> &function) {
+
+    std::vector<double> samples;
+    samples.reserve(static_cast<size_t>(iterations));
+
+    for (int i = 0; i < iterations / 10; ++i) {
+        function();
+    }
+
+    for (int i = 0; i < iterations; ++i) {
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        function();
+        samples.push_back(elapsedMicroseconds(start, BenchmarkClock::now()));
+    }
+
+    return samples;
+}
+
+/** Pushes raw telegrams through the loopback peer which mirrors them back. */
+static void measureTelegramThroughput(ThalesRemoteConnection &connection, BenchmarkResults &results, std::string name, int telegrams, size_t payload_size) {
+
+    const std::string payload(payload_size, 'x');
+
+    // message types other than the Remote Script ones are mirrored by the simulator
+    const uint8_t loopback_message_type = 0x10;
+
+    connection.clearIncomingTelegramQueue();
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    std::thread sender([&]() {
+
+        for (int i = 0; i < telegrams; ++i) {
+            connection.sendTelegram(payload, loopback_message_type);
+        }
+    });
+
+    int received = 0;
+
+    while (received < telegrams) {
+
+        if (connection.waitForTelegramBuffer(std::chrono::milliseconds(5000), loopback_message_type).size() != payload_size) {
+            break;
+        }
+
+        received++;
+    }
+
+    sender.join();
+
+    double seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add(name, "payload_bytes", static_cast<double>(payload_size));
+    results.add(name, "telegrams", received);
+    results.add(name, "telegrams_per_second", received / seconds);
+    results.add(name, "megabytes_per_second", received * static_cast<double>(payload_size + 3) / seconds / 1e6);
+}
+
+/** Compares waiting for every setpoint reply against keeping a window of requests in flight.
+ *
+ * The simulator delays every telegram like a network link would, so the
+ * sequential commands pay the full round trip each.
+ */
+static void measurePipelining(ThalesRemoteConnection &connection, ThalesRemoteScriptWrapper &remoteScript, TermSimulator &simulator, BenchmarkResults &results, int commands) {
+
+    const std::chrono::microseconds link_latency(200);
+
+    simulator.setLatency(link_latency);
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (int i = 0; i < commands; ++i) {
+        remoteScript.executeRemoteCommand("Pset=0");
+    }
+
+    double seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add("pipeline_sequential", "link_latency_us", static_cast<double>(link_latency.count()));
+    results.add("pipeline_sequential", "commands_per_second", commands / seconds);
+
+    const size_t previous_depth = connection.getPipelineDepth();
+
+    for (size_t depth : {1, 4, 16}) {
+
+        connection.setPipelineDepth(depth);
+
+        std::vector< std::future<std::string> > replies;
+        replies.reserve(commands);
+
+        start = BenchmarkClock::now();
+
+        for (int i = 0; i < commands; ++i) {
+            replies.push_back(remoteScript.submitRemoteCommand("Pset=0"));
+        }
+
+        int answered = 0;
+
+        for (std::future<std::string> &reply : replies) {
+
+            if (reply.get() == "1:ok:") {
+                answered++;
+            }
+        }
+
+        seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+        std::string name = "pipeline_depth_" + std::to_string(depth);
+
+        results.add(name, "link_latency_us", static_cast<double>(link_latency.count()));
+        results.add(name, "answered", answered);
+        results.add(name, "commands_per_second", answered / seconds);
+    }
+
+    connection.setPipelineDepth(previous_depth);
+    simulator.setLatency(std::chrono::microseconds(0));
+}
+
+/** One thread keeps many impedance measurements in flight and collects the results afterwards. */
+static void measureAsyncImpedance(ThalesRemoteScriptWrapper &remoteScript, TermSimulator &simulator, BenchmarkResults &results, int points) {
+
+    const std::chrono::microseconds link_latency(200);
+
+    simulator.setLatency(link_latency);
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (int i = 0; i < points; ++i) {
+        remoteScript.getImpedance(1000 + i, 10e-3, 1);
+    }
+
+    double seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add("getImpedance_sync", "link_latency_us", static_cast<double>(link_latency.count()));
+    results.add("getImpedance_sync", "points_per_second", points / seconds);
+
+    std::vector< std::future< std::complex<double> > > impedances;
+    impedances.reserve(points);
+
+    start = BenchmarkClock::now();
+
+    for (int i = 0; i < points; ++i) {
+        impedances.push_back(remoteScript.getImpedanceAsync(1000 + i, 10e-3, 1));
+    }
+
+    // The control thread is free until here.
+    double submit_seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    int valid = 0;
+
+    for (std::future< std::complex<double> > &impedance : impedances) {
+
+        if (std::isnan(impedance.get().real()) == false) {
+            valid++;
+        }
+    }
+
+    seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add("getImpedanceAsync", "link_latency_us", static_cast<double>(link_latency.count()));
+    results.add("getImpedanceAsync", "valid_points", valid);
+    results.add("getImpedanceAsync", "points_per_second", valid / seconds);
+    results.add("getImpedanceAsync", "submit_us_per_point", submit_seconds * 1e6 / points);
+
+    simulator.setLatency(std::chrono::microseconds(0));
+}
+
+/** Measures the cost of the metrics and checks what the connection has recorded so far.
+ *
+ * \returns the number of failed checks.
+ */
+static int measureMetrics(ThalesRemoteConnection &connection, BenchmarkResults &results, int records) {
+
+    LatencyHistogram histogram;
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (int i = 0; i < records; ++i) {
+        histogram.record(std::chrono::microseconds(i & 0xfff));
+    }
+
+    results.add("metrics_record", "ns_per_record", elapsedMicroseconds(start, BenchmarkClock::now()) * 1e3 / records);
+
+    start = BenchmarkClock::now();
+
+    MetricsSnapshot snapshot = connection.getMetricsSnapshot();
+
+    results.add("metrics_snapshot", "us", elapsedMicroseconds(start, BenchmarkClock::now()));
+
+    std::ostringstream prometheus;
+
+    start = BenchmarkClock::now();
+    snapshot.writePrometheus(prometheus, "instrument=\"simulator\"");
+
+    results.add("metrics_export_prometheus", "us", elapsedMicroseconds(start, BenchmarkClock::now()));
+    results.add("metrics_export_prometheus", "bytes", static_cast<double>(prometheus.str().size()));
+
+    std::ostringstream json;
+
+    start = BenchmarkClock::now();
+    snapshot.writeJson(json);
+
+    results.add("metrics_export_json", "us", elapsedMicroseconds(start, BenchmarkClock::now()));
+    results.add("metrics_export_json", "bytes", static_cast<double>(json.str().size()));
+
+    int failures = 0;
+
+    for (const char *command : {"IMPEDANCE", "POTENTIAL", "Pset"}) {
+
+        auto latency = snapshot.command_latency.find(command);
+
+        if (latency == snapshot.command_latency.end() || latency->second.count == 0) {
+
+            failures++;
+            continue;
+        }
+
+        const LatencyHistogram::Snapshot &overhead = snapshot.command_client_overhead[command];
+
+        // The client overhead is a part of the latency.
+        failures += (overhead.sum_us <= latency->second.sum_us) ? 0 : 1;
+
+        results.add(std::string("metrics_command_") + command, "count", static_cast<double>(latency->second.count));
+        results.add(std::string("metrics_command_") + command, "p50_us", latency->second.getPercentile(0.5));
+        results.add(std::string("metrics_command_") + command, "client_overhead_p50_us", overhead.getPercentile(0.5));
+    }
+
+    // Every Remote Script request has been answered.
+    for (const MetricsSnapshot::Traffic &traffic : snapshot.traffic) {
+
+        if (traffic.message_type == 2) {
+            failures += (traffic.telegrams_in == traffic.telegrams_out && traffic.telegrams_in > 0) ? 0 : 1;
+        }
+    }
+
+    failures += (snapshot.reply_latency.count(2) == 1 && snapshot.connect.count > 0 && snapshot.telegram_wait.count > 0) ? 0 : 1;
+    failures += (prometheus.str().find("thales_command_latency_seconds_bucket{instrument=\"simulator\",le=\"+Inf\",command=\"IMPEDANCE\"}") != std::string::npos) ? 0 : 1;
+
+    results.add("metrics", "failed_checks", failures);
+
+    return failures;
+}
+
+/** Floods the receive queues of a fresh connection with more telegrams than the limits allow, for every overflow policy.
+ *
+ * \returns the number of failed checks.
+ */
+static int measureReceiveQueueLimits(TermSimulator &simulator, BenchmarkResults &results, int telegrams) {
+
+    const uint8_t loopback_message_type = 0x10;
+    const size_t max_telegrams = 256;
+    const size_t max_bytes = 64 * 1024;
+    const size_t payload_size = 512;
+
+    int failures = 0;
+
+    const std::pair<ThalesRemoteConnection::OverflowPolicy, std::string> policies[] = {
+        {ThalesRemoteConnection::OVERFLOW_BLOCK, "receive_limit_block"},
+        {ThalesRemoteConnection::OVERFLOW_DROP_OLDEST, "receive_limit_drop_oldest"},
+        {ThalesRemoteConnection::OVERFLOW_DROP_NEWEST, "receive_limit_drop_newest"}
+    };
+
+    for (const auto &policy : policies) {
+
+        ThalesRemoteConnection connection;
+
+        connection.setReceiveQueueLimits(max_telegrams, max_bytes, policy.first);
+
+        if (connection.connectToTerm("localhost", "ScriptRemote", std::chrono::milliseconds(2000), simulator.getPort()) == false) {
+
+            failures++;
+            continue;
+        }
+
+        std::string payload(payload_size, 'x');
+
+        for (int i = 0; i < telegrams; ++i) {
+
+            uint32_t index = static_cast<uint32_t>(i);
+            std::memcpy(&payload[0], &index, sizeof(index));
+
+            connection.sendTelegram(payload, loopback_message_type);
+        }
+
+        std::vector<uint32_t> indices;
+
+        if (policy.first == ThalesRemoteConnection::OVERFLOW_BLOCK) {
+
+            // Nothing is lost, the consumer gets everything as soon as it starts.
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            while (indices.size() < static_cast<size_t>(telegrams)) {
+
+                TelegramBuffer telegram = connection.waitForTelegramBuffer(std::chrono::milliseconds(2000), loopback_message_type);
+
+                if (telegram.size() != payload_size) {
+                    break;
+                }
+
+                indices.push_back(0);
+                std::memcpy(&indices.back(), telegram.data(), sizeof(uint32_t));
+            }
+
+        } else {
+
+            // The reply follows the mirrored telegrams, so all of them have arrived afterwards.
+            connection.sendStringAndWaitForReplyString("1:Pset=0:", 2);
+
+            for (TelegramBuffer telegram = connection.receiveTelegramBuffer(loopback_message_type); telegram.empty() == false;
+                 telegram = connection.receiveTelegramBuffer(loopback_message_type)) {
+
+                indices.push_back(0);
+                std::memcpy(&indices.back(), telegram.data(), sizeof(uint32_t));
+            }
+        }
+
+        ThalesRemoteConnection::ReceiveQueueStatistics statistics = connection.getReceiveQueueStatistics();
+
+        connection.disconnectFromTerm();
+
+        // The limits are kept, the right telegrams survive in order.
+        size_t expected_count = (policy.first == ThalesRemoteConnection::OVERFLOW_BLOCK) ? telegrams : std::min<size_t>(telegrams, max_bytes / payload_size);
+        uint32_t first_index = (policy.first == ThalesRemoteConnection::OVERFLOW_DROP_OLDEST) ? static_cast<uint32_t>(telegrams - expected_count) : 0;
+
+        bool correct = statistics.high_water_bytes <= max_bytes && statistics.high_water_telegrams <= max_telegrams && indices.size() == expected_count;
+
+        for (size_t i = 0; correct && i < indices.size(); ++i) {
+            correct = (indices[i] == first_index + i);
+        }
+
+        failures += correct ? 0 : 1;
+
+        results.add(policy.second, "sent_telegrams", telegrams);
+        results.add(policy.second, "received_telegrams", static_cast<double>(indices.size()));
+        results.add(policy.second, "high_water_telegrams", static_cast<double>(statistics.high_water_telegrams));
+        results.add(policy.second, "high_water_bytes", static_cast<double>(statistics.high_water_bytes));
+        results.add(policy.second, "dropped", static_cast<double>(statistics.dropped_oldest + statistics.dropped_newest));
+        results.add(policy.second, "listener_blocks", static_cast<double>(statistics.listener_blocks));
+        results.add(policy.second, "listener_blocked_ms", statistics.listener_blocked_time.count() / 1e3);
+        results.add(policy.second, "correct", correct ? 1 : 0);
+    }
+
+    return failures;
+}
+
+/** Compares FixedRateAcquisition with calling getPotential() and sleeping for the period in a loop.
+ *
+ * \returns the number of failed checks.
+ */
+static int measureFixedRateAcquisition(ThalesRemoteScriptWrapper &remoteScript, BenchmarkResults &results, double rate, std::chrono::milliseconds duration) {
+
+    const std::chrono::duration<double, std::micro> period(1e6 / rate);
+    const size_t expected_samples = static_cast<size_t>(rate * std::chrono::duration<double>(duration).count());
+
+    // How far the distance between two requests is off the period.
+    std::vector<double> deviations;
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+    BenchmarkClock::time_point previous_request = start;
+
+    for (size_t i = 0; i < expected_samples; ++i) {
+
+        BenchmarkClock::time_point request = BenchmarkClock::now();
+
+        remoteScript.getPotential();
+
+        if (i > 0) {
+            deviations.push_back(std::abs(elapsedMicroseconds(previous_request, request) - period.count()));
+        }
+
+        previous_request = request;
+
+        std::this_thread::sleep_for(period);
+    }
+
+    results.add("acquisition_sleep_loop", "achieved_rate", static_cast<double>(expected_samples) / (elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6));
+    results.addLatency("acquisition_sleep_loop_interval_deviation", deviations);
+
+    FixedRateAcquisition acquisition(remoteScript);
+    acquisition.setRate(rate);
+
+    std::vector<FixedRateAcquisition::Sample> batch(64);
+    std::vector<FixedRateAcquisition::Sample> samples;
+    size_t batches = 0;
+
+    samples.reserve(expected_samples * 2);
+
+    acquisition.start();
+
+    start = BenchmarkClock::now();
+
+    while (BenchmarkClock::now() - start < duration) {
+
+        size_t count = acquisition.drain(batch.data(), batch.size(), std::chrono::milliseconds(10));
+
+        samples.insert(samples.end(), batch.begin(), batch.begin() + count);
+        batches += (count > 0) ? 1 : 0;
+    }
+
+    acquisition.stop();
+
+    while (size_t count = acquisition.drain(batch.data(), batch.size())) {
+
+        samples.insert(samples.end(), batch.begin(), batch.begin() + count);
+        batches++;
+    }
+
+    FixedRateAcquisition::Statistics statistics = acquisition.getStatistics();
+
+    int failures = 0;
+
+    deviations.clear();
+
+    for (size_t i = 0; i < samples.size(); ++i) {
+
+        const FixedRateAcquisition::Sample &sample = samples[i];
+
+        if (sample.request_time < sample.scheduled_time || sample.reply_time < sample.request_time || std::isnan(sample.potential)) {
+            failures++;
+        }
+
+        if (i > 0) {
+
+            failures += (sample.sequence > samples[i - 1].sequence) ? 0 : 1;
+
+            double interval = elapsedMicroseconds(samples[i - 1].request_time, sample.request_time);
+            uint64_t periods = sample.sequence - samples[i - 1].sequence;
+
+            // The deadlines lie on the grid, a sample which got the times of another one does not.
+            double scheduled_interval = elapsedMicroseconds(samples[i - 1].scheduled_time, sample.scheduled_time);
+            failures += (std::abs(scheduled_interval - period.count() * static_cast<double>(periods)) < 1) ? 0 : 1;
+
+            deviations.push_back(std::abs(interval - period.count() * static_cast<double>(periods)));
+        }
+    }
+
+    failures += (samples.size() == statistics.acquired_samples + statistics.failed_samples && statistics.failed_samples == 0 && statistics.dropped_samples == 0) ? 0 : 1;
+
+    // The sandbox may be busy, but most deadlines have to be kept.
+    failures += (statistics.achieved_rate > 0.9 * rate) ? 0 : 1;
+
+    results.add("acquisition_FixedRateAcquisition", "achieved_rate", statistics.achieved_rate);
+    results.add("acquisition_FixedRateAcquisition", "missed_deadlines", static_cast<double>(statistics.missed_deadlines));
+    results.add("acquisition_FixedRateAcquisition", "mean_jitter_us", std::chrono::duration<double, std::micro>(statistics.mean_jitter).count());
+    results.add("acquisition_FixedRateAcquisition", "max_jitter_us", std::chrono::duration<double, std::micro>(statistics.max_jitter).count());
+    results.add("acquisition_FixedRateAcquisition", "mean_round_trip_us", std::chrono::duration<double, std::micro>(statistics.mean_round_trip).count());
+    results.add("acquisition_FixedRateAcquisition", "samples_per_batch", batches > 0 ? static_cast<double>(samples.size()) / batches : 0);
+    results.add("acquisition_FixedRateAcquisition", "failed_checks", failures);
+    results.addLatency("acquisition_FixedRateAcquisition_interval_deviation", deviations);
+
+    return failures;
+}
+
+/** Compares a sweep with ImpedanceSweep against calling getImpedance() point by point. */
+static int measureSocketProfiles(TermSimulator &simulator, BenchmarkResults &results, int iterations) {
+
+    const std::pair<ThalesRemoteConnection::SocketProfile, std::string> profiles[] = {
+        {ThalesRemoteConnection::SOCKET_PROFILE_DEFAULT, "default"},
+        {ThalesRemoteConnection::SOCKET_PROFILE_LOW_LATENCY, "low_latency"},
+        {ThalesRemoteConnection::SOCKET_PROFILE_THROUGHPUT, "throughput"}
+    };
+
+    int failures = 0;
+
+    for (const std::pair<ThalesRemoteConnection::SocketProfile, std::string> &profile : profiles) {
+
+        ThalesRemoteConnection connection;
+        connection.setSocketProfile(profile.first);
+
+        if (connection.connectToTerm("localhost", "ScriptRemote", std::chrono::milliseconds(2000), simulator.getPort()) == false) {
+
+            failures++;
+            continue;
+        }
+
+        ThalesRemoteScriptWrapper remoteScript(&connection);
+        remoteScript.forceThalesIntoRemoteScript();
+
+        ThalesRemoteConnection::SocketSettings requested = connection.getSocketSettings();
+        ThalesRemoteConnection::SocketSettings effective = connection.getEffectiveSocketSettings();
+
+        std::string name = "socket_profile_" + profile.second;
+
+        results.add(name, "no_delay", effective.no_delay);
+        results.add(name, "receive_buffer_size", effective.receive_buffer_size);
+        results.add(name, "send_buffer_size", effective.send_buffer_size);
+        results.add(name, "keep_alive", effective.keep_alive);
+        results.add(name, "keep_alive_idle_s", effective.keep_alive_idle);
+        results.add(name, "busy_poll_us", effective.busy_poll);
+        results.add(name, "listener_cpu", effective.listener_cpu);
+        results.add(name, "listener_priority", effective.listener_priority);
+
+        // The options which every system accepts have to take effect, the others are reported as they are.
+        if (effective.no_delay != requested.no_delay || effective.keep_alive != requested.keep_alive) {
+
+            failures++;
+        }
+
+#if defined(TCP_KEEPIDLE)
+        if (requested.keep_alive_idle > 0 && effective.keep_alive_idle != requested.keep_alive_idle) {
+
+            failures++;
+        }
+#endif
+
+        results.addLatency(name + "_round_trip", measureLatency(iterations, [&]() {
+            remoteScript.getPotential();
+        }));
+
+        connection.disconnectFromTerm();
+    }
+
+    results.add("socket_profiles", "failed_checks", failures);
+
+    return failures;
+}
+
+static void measureSweep(ThalesRemoteScriptWrapper &remoteScript, TermSimulator &simulator, BenchmarkResults &results, int points) {
+
+    const std::chrono::microseconds link_latency(200);
+
+    simulator.setLatency(link_latency);
+
+    ImpedanceSweep sweep(remoteScript);
+
+    sweep.setLogarithmicPlan(100e3, 10, static_cast<size_t>(points));
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (double frequency : sweep.getFrequencies()) {
+        remoteScript.getImpedance(frequency);
+    }
+
+    double seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add("sweep_getImpedance_loop", "link_latency_us", static_cast<double>(link_latency.count()));
+    results.add("sweep_getImpedance_loop", "points_per_second", points / seconds);
+
+    // The first run warms up the telegram buffers.
+    sweep.run();
+
+    counted_allocations = 0;
+    count_allocations = true;
+
+    start = BenchmarkClock::now();
+
+    bool measured = sweep.run();
+
+    seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    count_allocations = false;
+
+    results.add("sweep_ImpedanceSweep", "link_latency_us", static_cast<double>(link_latency.count()));
+    results.add("sweep_ImpedanceSweep", "all_points_measured", measured ? 1 : 0);
+    results.add("sweep_ImpedanceSweep", "points_per_second", points / seconds);
+    results.add("sweep_ImpedanceSweep", "allocations_per_point", static_cast<double>(counted_allocations) / points);
+
+    simulator.setLatency(std::chrono::microseconds(0));
+}
+
+/** Compares connecting and measuring many instruments one after the other with an InstrumentPool.
+ *
+ * \returns the number of plans which did not complete.
+ */
+static int measureInstrumentPool(TermSimulator &simulator, BenchmarkResults &results, size_t instruments, int points) {
+
+    const std::chrono::microseconds link_latency(2000);
+
+    simulator.setLatency(link_latency);
+
+    std::function<double(ThalesRemoteScriptWrapper &)> plan = [points](ThalesRemoteScriptWrapper &remoteScript) {
+
+        double magnitude = 0;
+
+        for (int i = 0; i < points; ++i) {
+            magnitude += std::abs(remoteScript.getImpedance(1000 + i, 10e-3, 1));
+        }
+
+        return magnitude;
+    };
+
+    {
+        std::vector< std::unique_ptr<ThalesRemoteConnection> > connections;
+        std::vector< std::unique_ptr<ThalesRemoteScriptWrapper> > remoteScripts;
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+
+        for (size_t i = 0; i < instruments; ++i) {
+
+            connections.emplace_back(new ThalesRemoteConnection());
+
+            if (connections.back()->connectToTerm("localhost", "Serial" + std::to_string(i), std::chrono::milliseconds(2000), simulator.getPort())) {
+
+                remoteScripts.emplace_back(new ThalesRemoteScriptWrapper(connections.back().get()));
+                remoteScripts.back()->forceThalesIntoRemoteScript();
+            }
+        }
+
+        double connect_seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+        start = BenchmarkClock::now();
+
+        for (std::unique_ptr<ThalesRemoteScriptWrapper> &remoteScript : remoteScripts) {
+            plan(*remoteScript);
+        }
+
+        double run_seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+        results.add("instruments_serial", "instruments", static_cast<double>(remoteScripts.size()));
+        results.add("instruments_serial", "connect_ms", connect_seconds * 1e3);
+        results.add("instruments_serial", "run_ms", run_seconds * 1e3);
+
+        for (std::unique_ptr<ThalesRemoteConnection> &connection : connections) {
+            connection->disconnectFromTerm();
+        }
+    }
+
+    InstrumentPool pool;
+
+    for (size_t i = 0; i < instruments; ++i) {
+        pool.addInstrument("localhost", "Pool" + std::to_string(i), simulator.getPort());
+    }
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    size_t connected = pool.connectAll(std::chrono::milliseconds(2000));
+
+    double connect_seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    start = BenchmarkClock::now();
+
+    std::map<std::string, InstrumentResult<double> > magnitudes = pool.runOnAll(plan);
+
+    double run_seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    int failures = static_cast<int>(instruments - connected);
+
+    for (const auto &magnitude : magnitudes) {
+
+        if (magnitude.second.completed == false || std::isnan(magnitude.second.value)) {
+            failures++;
+        }
+    }
+
+    results.add("instruments_InstrumentPool", "instruments", static_cast<double>(connected));
+    results.add("instruments_InstrumentPool", "connect_ms", connect_seconds * 1e3);
+    results.add("instruments_InstrumentPool", "run_ms", run_seconds * 1e3);
+    results.add("instruments_InstrumentPool", "healthy", static_cast<double>(pool.checkHealth()));
+
+    pool.disconnectAll();
+
+    simulator.setLatency(std::chrono::microseconds(0));
+
+    return failures;
+}
+
+/** Checks that a handle keeps health checks away and that instruments closed by Term count as disconnected.
+ *
+ * \returns the number of failed checks.
+ */
+static int checkInstrumentPoolSessions(BenchmarkResults &results) {
+
+    TermSimulator simulator;
+
+    if (simulator.start() == false) {
+
+        return 1;
+    }
+
+    InstrumentPool pool;
+    std::string key = pool.addInstrument("localhost", "Handle", simulator.getPort());
+
+    int failures = (pool.connectAll(std::chrono::milliseconds(2000)) == 1) ? 0 : 1;
+
+    {
+        InstrumentHandle remoteScript = pool.getRemoteScript(key);
+
+        if (!remoteScript || std::isnan(remoteScript->getPotential())) {
+            failures++;
+        }
+
+        // The instrument is busy while the handle exists, so it is neither probed nor reconnected.
+        failures += (pool.checkHealth() == 1) ? 0 : 1;
+    }
+
+    if (pool.getReconnects(key) != 0) {
+
+        std::cerr << "The health check used an instrument which was handed out" << std::endl;
+        failures++;
+    }
+
+    if (pool.getRemoteScript("unknown")) {
+        failures++;
+    }
+
+    simulator.stop();
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    while (pool.isConnected(key) && elapsedMicroseconds(start, BenchmarkClock::now()) < 2e6) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (pool.isConnected(key)) {
+
+        std::cerr << "An instrument closed by Term still counts as connected" << std::endl;
+        failures++;
+    }
+
+    // An instrument which never answered is connected again and again, but never reconnected.
+    std::string unreachableKey = pool.addInstrument("localhost", "Unreachable", simulator.getPort());
+
+    if (pool.checkHealth(std::chrono::milliseconds(500)) != 0 || pool.checkHealth(std::chrono::milliseconds(500)) != 0) {
+        failures++;
+    }
+
+    if (pool.getReconnects(unreachableKey) != 0) {
+
+        std::cerr << "Connecting an instrument which was never connected counted as reconnect" << std::endl;
+        failures++;
+    }
+
+    results.add("instrument_pool_sessions_check", "failures", failures);
+
+    return failures;
+}
+
+/** Captures a Remote Script session, replays its client side against the simulator
+ * and serves it to a client by a simulator replaying the Term side.
+ *
+ * \returns the number of failed checks.
+ */
+static int measureCapture(TermSimulator &simulator, BenchmarkResults &results, int commands, int points) {
+
+    const std::filesystem::path capturePath = std::filesystem::temp_directory_path() / "benchmark_capture.ttc";
+
+    // The client thinks a little between the points, the replay has to keep that.
+    auto session = [commands, points](ThalesRemoteScriptWrapper &remoteScript) {
+
+        std::vector< std::complex<double> > impedances;
+
+        for (int i = 0; i < commands; ++i) {
+            remoteScript.executeRemoteCommand("Pset=0");
+        }
+
+        for (int i = 0; i < points; ++i) {
+
+            impedances.push_back(remoteScript.getImpedance(100 + 10 * i, 10e-3, 1));
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        return impedances;
+    };
+
+    ThalesRemoteConnection connection;
+
+    if (connection.connectToTerm("localhost", "Capture", std::chrono::milliseconds(2000), simulator.getPort()) == false) {
+
+        return 1;
+    }
+
+    ThalesRemoteScriptWrapper remoteScript(&connection);
+    remoteScript.forceThalesIntoRemoteScript();
+
+    results.addLatency("executeRemoteCommand_without_capture", measureLatency(commands, [&]() {
+        remoteScript.executeRemoteCommand("Pset=0");
+    }));
+
+    std::shared_ptr<TelegramCaptureWriter> capture = std::make_shared<TelegramCaptureWriter>();
+
+    int failures = capture->open(capturePath.string()) ? 0 : 1;
+
+    connection.setCapture(capture);
+
+    results.addLatency("executeRemoteCommand_with_capture", measureLatency(commands, [&]() {
+        remoteScript.executeRemoteCommand("Pset=0");
+    }));
+
+    // Start over, so the capture holds the session only.
+    capture->open(capturePath.string());
+
+    std::vector< std::complex<double> > capturedImpedances = session(remoteScript);
+
+    connection.setCapture(nullptr);
+    connection.disconnectFromTerm();
+
+    uint64_t recorded_telegrams = capture->getRecordCount();
+    capture->close();
+
+    std::vector<CaptureRecord> records;
+
+    failures += TelegramCaptureReader::readAll(capturePath.string(), records) ? 0 : 1;
+    failures += (records.size() == recorded_telegrams && records.size() == 2u * (commands + points)) ? 0 : 1;
+
+    // Every request is followed by its reply.
+    for (size_t i = 0; i < records.size(); ++i) {
+
+        failures += (records[i].direction == ((i % 2 == 0) ? CAPTURE_TO_TERM : CAPTURE_FROM_TERM) && records[i].message_type == 2) ? 0 : 1;
+    }
+
+    results.add("capture", "telegrams", static_cast<double>(records.size()));
+    results.add("capture", "bytes_per_telegram", static_cast<double>(std::filesystem::file_size(capturePath) - TelegramCapture::header_size) / std::max<size_t>(records.size(), 1));
+
+    CaptureReplay replay;
+    replay.setRecords(records);
+
+    for (double speed : {1.0, 4.0, 0.0}) {
+
+        ThalesRemoteConnection replayConnection;
+
+        if (replayConnection.connectToTerm("localhost", "Replay", std::chrono::milliseconds(2000), simulator.getPort()) == false) {
+
+            failures++;
+            continue;
+        }
+
+        replay.setSpeed(speed);
+
+        ReplayResult result = replay.replayThroughClient(replayConnection);
+
+        replayConnection.disconnectFromTerm();
+
+        std::string name = (speed > 0) ? "capture_replay_speed_" + std::to_string(static_cast<int>(speed)) : std::string("capture_replay_fastest");
+
+        results.add(name, "recorded_ms", std::chrono::duration<double, std::milli>(result.recorded_duration).count());
+        results.add(name, "replay_ms", std::chrono::duration<double, std::milli>(result.replay_duration).count());
+        results.add(name, "differing_telegrams", static_cast<double>(result.differing_telegrams + result.missing_telegrams));
+
+        failures += result.isIdentical() ? 0 : 1;
+
+        // The pauses of the client are kept, scaled by the speed.
+        if (speed > 0) {
+            failures += (result.replay_duration >= points * std::chrono::milliseconds(2) / speed) ? 0 : 1;
+        }
+    }
+
+    TermSimulator capturedTerm;
+    capturedTerm.setReplay(records, 0);
+
+    if (capturedTerm.start() == false) {
+
+        return failures + 1;
+    }
+
+    ThalesRemoteConnection peerConnection;
+
+    if (peerConnection.connectToTerm("localhost", "Replay", std::chrono::milliseconds(2000), capturedTerm.getPort()) == false) {
+
+        return failures + 1;
+    }
+
+    ThalesRemoteScriptWrapper peerRemoteScript(&peerConnection);
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    std::vector< std::complex<double> > replayedImpedances = session(peerRemoteScript);
+
+    results.add("capture_replay_peer", "session_ms", elapsedMicroseconds(start, BenchmarkClock::now()) / 1e3);
+
+    peerConnection.disconnectFromTerm();
+    capturedTerm.stop();
+
+    failures += (replayedImpedances == capturedImpedances && capturedTerm.getReplayMismatches() == 0) ? 0 : 1;
+
+    std::filesystem::remove(capturePath);
+
+    results.add("capture", "failed_checks", failures);
+
+    return failures;
+}
+
+/** Compares writing impedance points to a result file with the text output of printImpedance() in main.cpp.
+ *
+ * \returns the number of failed checks of the written file.
+ */
+static int measureResultFileWriting(BenchmarkResults &results, int rows) {
+
+    const std::filesystem::path directory = std::filesystem::temp_directory_path();
+    const std::string textPath = (directory / "RemoteScriptBenchmark.txt").string();
+    const std::string resultPath = (directory / "RemoteScriptBenchmark.trf").string();
+
+    auto impedanceAt = [](int row) {
+        return std::complex<double>(10.0 + row * 1e-3, -1.0 - row * 1e-4);
+    };
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    {
+        std::ofstream text(textPath);
+
+        for (int row = 0; row < rows; ++row) {
+
+            std::complex<double> impedance = impedanceAt(row);
+
+            text << "Frequency " << 1000.0 + row << std::endl;
+            text << std::abs(impedance) << " ohm, " << std::arg(impedance) << " rad" << std::endl;
+        }
+    }
+
+    double seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add("result_output_text", "rows_per_second", rows / seconds);
+    results.add("result_output_text", "bytes_per_row", static_cast<double>(std::filesystem::file_size(textPath)) / rows);
+
+    std::filesystem::remove(resultPath);
+
+    start = BenchmarkClock::now();
+
+    {
+        ResultFileWriter writer;
+
+        writer.open(resultPath, {"frequency", "impedance_real", "impedance_imaginary"});
+
+        for (int row = 0; row < rows; ++row) {
+
+            std::complex<double> impedance = impedanceAt(row);
+
+            writer.append({1000.0 + row, impedance.real(), impedance.imag()});
+        }
+    }
+
+    seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    results.add("result_output_file", "rows_per_second", rows / seconds);
+    results.add("result_output_file", "bytes_per_row", static_cast<double>(std::filesystem::file_size(resultPath)) / rows);
+
+    int failures = 0;
+
+    // Cut the last block in half like a crash while writing would and append to the file again.
+    std::filesystem::resize_file(resultPath, std::filesystem::file_size(resultPath) - 8);
+
+    {
+        ResultFileWriter writer(64);
+
+        writer.open(resultPath, {"frequency", "impedance_real", "impedance_imaginary"});
+        writer.append({-1, -1, -1});
+    }
+
+    ResultFileReader reader;
+
+    if (reader.open(resultPath) == false) {
+
+        std::cerr << "could not read the result file" << std::endl;
+        failures++;
+
+    } else {
+
+        // The cut block is gone, the row appended afterwards is there.
+        int rows_in_last_block = (rows % 4096 != 0) ? rows % 4096 : 4096;
+        uint64_t expected_rows = static_cast<uint64_t>(rows - rows_in_last_block + 1);
+
+        if (reader.getRowCount() != expected_rows || reader.hasTruncatedTail()) {
+
+            std::cerr << "the result file has " << reader.getRowCount() << " rows instead of " << expected_rows << std::endl;
+            failures++;
+        }
+
+        uint64_t row = 0;
+
+        for (size_t block = 0; block < reader.getBlockCount(); ++block) {
+
+            const double *frequencies = reader.getColumn(block, 0);
+            const double *imaginaryParts = reader.getColumn(block, 2);
+
+            for (size_t i = 0; i < reader.getRowCount(block); ++i, ++row) {
+
+                bool appended_row = (row + 1 == expected_rows);
+
+                if (frequencies[i] != (appended_row ? -1 : 1000.0 + row) || imaginaryParts[i] != (appended_row ? -1 : impedanceAt(static_cast<int>(row)).imag())) {
+
+                    std::cerr << "row " << row << " of the result file is wrong" << std::endl;
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+
+    reader.close();
+
+    // Files which can't be continued are kept as they are, the text file stands in for a foreign one.
+    for (const std::string &path : {resultPath, textPath}) {
+
+        const uintmax_t size = std::filesystem::file_size(path);
+
+        ResultFileWriter writer;
+
+        if (writer.open(path, {"time", "potential"}) || std::filesystem::file_size(path) != size) {
+
+            std::cerr << "opening the result file with other columns changed " << path << std::endl;
+            failures++;
+        }
+    }
+
+    std::filesystem::remove(textPath);
+    std::filesystem::remove(resultPath);
+
+    results.add("result_file_check", "failures", failures);
+
+    return failures;
+}
+
+/** The reply parsing of the wrapper before it was replaced by ThalesRemoteScriptWrapper::parseValue(). */
+namespace RegexReplyParsing {
+
+static double stringToDobule(std::string string) {
+
+    std::stringstream stream(string);
+    double number;
+
+    stream >> number;
+
+    return number;
+}
+
+static double parseCurrent(const std::string &reply) {
+
+    double result = std::nan("1");
+
+    std::smatch match;
+
+    std::regex_search(reply, match, std::regex("current=\\s*(.*?)A?:"));
+
+    if (match.size() > 1) {
+
+        result = stringToDobule(match.str(1));
+    }
+
+    return result;
+}
+
+static std::complex<double> parseImpedance(const std::string &reply) {
+
+    std::complex<double> result(std::nan("1"), std::nan("1"));
+
+    std::regex replyStringPattern("impedance=\\s*(.*?),(.*?):");
+    std::smatch match;
+
+    std::regex_search(reply, match, replyStringPattern);
+
+    if (match.size() > 2) {
+
+        result = std::complex<double>(stringToDobule(match.str(1)), stringToDobule(match.str(2)));
+    }
+
+    return result;
+}
+
+}
+
+/** Checks the reply parser against the number formats Thales sends.
+ *
+ * \returns the number of replies which were parsed wrongly.
+ */
+static int checkReplyParsing(BenchmarkResults &results) {
+
+    struct Case {
+        const char *reply;
+        double current;
+    };
+
+    const Case cases[] = {
+        {"1:current= 1.234560e-05A:", 1.23456e-5},
+        {"1:current=1.234560e-05A:", 1.23456e-5},
+        {"1:current=   +1.5E+03A:", 1.5e3},
+        {"1:current= -7.25e-12:", -7.25e-12},
+        {"1:current= 42A:", 42},
+        {"1:current=\t.5A:", 0.5},
+        {"1:current=\r\n 2.5e-3A:", 2.5e-3},
+        {"1:potential= 1.0V:current= -0.001A:", -0.001},
+        {"1:current= A:", std::nan("1")},
+        {"1:ok:", std::nan("1")},
+        {"", std::nan("1")},
+    };
+
+    int failures = 0;
+
+    for (const Case &testCase : cases) {
+
+        double value = ThalesRemoteScriptWrapper::parseValue(testCase.reply, "current");
+
+        bool correct = std::isnan(testCase.current) ? std::isnan(value) : value == testCase.current;
+
+        if (correct == false) {
+
+            std::cerr << "parseValue(\"" << testCase.reply << "\") returned " << value << std::endl;
+            failures++;
+        }
+    }
+
+    std::complex<double> impedance = ThalesRemoteScriptWrapper::parseImpedance("1:impedance= +1.234567e+01, -3.456789e+00:");
+
+    if (impedance != std::complex<double>(12.34567, -3.456789)) {
+
+        std::cerr << "parseImpedance returned " << impedance << std::endl;
+        failures++;
+    }
+
+    if (std::isnan(ThalesRemoteScriptWrapper::parseImpedance("1:impedance= 1.0:").imag()) == false) {
+
+        std::cerr << "parseImpedance accepted an impedance without imaginary part" << std::endl;
+        failures++;
+    }
+
+    results.add("reply_parsing_check", "failures", failures);
+
+    return failures;
+}
+
+/** Compares the parser of the wrapper with the regular expressions it replaced. */
+static void measureReplyParsing(BenchmarkResults &results, int iterations) {
+
+    const std::string reply = "1:current= 1.234560e-05A:potential= -2.500000e-01V:impedance= 1.234567e+01,-3.456789e+00:";
+
+    const int parses = iterations * 10;
+
+    double sum = 0;
+
+    counted_allocations = 0;
+    count_allocations = true;
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (int i = 0; i < parses; ++i) {
+        sum += RegexReplyParsing::parseCurrent(reply) + RegexReplyParsing::parseImpedance(reply).real();
+    }
+
+    double microseconds = elapsedMicroseconds(start, BenchmarkClock::now());
+
+    count_allocations = false;
+
+    results.add("reply_parsing_regex", "ns_per_reply", microseconds * 1e3 / parses);
+    results.add("reply_parsing_regex", "allocations_per_reply", static_cast<double>(counted_allocations) / parses);
+
+    counted_allocations = 0;
+    count_allocations = true;
+
+    start = BenchmarkClock::now();
+
+    for (int i = 0; i < parses; ++i) {
+        sum += ThalesRemoteScriptWrapper::parseValue(reply, "current") + ThalesRemoteScriptWrapper::parseImpedance(reply).real();
+    }
+
+    microseconds = elapsedMicroseconds(start, BenchmarkClock::now());
+
+    count_allocations = false;
+
+    results.add("reply_parsing", "ns_per_reply", microseconds * 1e3 / parses);
+    results.add("reply_parsing", "allocations_per_reply", static_cast<double>(counted_allocations) / parses);
+
+    // Keeps the compiler from dropping the loops.
+    if (std::isnan(sum)) {
+        std::cerr << "The benchmark reply could not be parsed" << std::endl;
+    }
+}
+
+// The command table is evaluated by the compiler.
+static_assert(ThalesRemoteCommands::assignment<ThalesRemoteCommands::Frequency>() == "Frq=", "wrong assignment of Frq");
+static_assert(ThalesRemoteCommands::toRemoteValue<ThalesRemoteCommands::NumberOfPeriods>(500) == 100, "Nw is not clamped");
+static_assert(ThalesRemoteCommands::toRemoteValue<ThalesRemoteCommands::Potentiostat>(true) == -1, "Pot is not -1 for true");
+static_assert(ThalesRemoteCommands::toRemoteValue<ThalesRemoteCommands::Amplitude>(0.5) == 500, "Ampl is not scaled to mV");
+
+/** Checks that the typed commands produce the telegrams the string commands did. */
+static int checkCommandTable(BenchmarkResults &results) {
+
+    using namespace ThalesRemoteCommands;
+
+    struct Case {
+        ThalesRemoteScriptWrapper::CommandBatch batch;
+        const char *commands;
+    };
+
+    Case cases[] = {
+        {ThalesRemoteScriptWrapper::CommandBatch().set<Frequency>(1e6).set<Amplitude>(10e-3).set<NumberOfPeriods>(500).query<Impedance>(), "Frq=1e+06:Ampl=10:Nw=100:IMPEDANCE"},
+        {ThalesRemoteScriptWrapper::CommandBatch().set<NumberOfPeriods>(0).set<Amplitude>(-1), "Nw=1:Ampl=-1000"},
+        {ThalesRemoteScriptWrapper::CommandBatch().setPotentiostatMode(ThalesRemoteScriptWrapper::POTMODE_POTENTIOSTATIC), "Gal=0:GAL=0"},
+        {ThalesRemoteScriptWrapper::CommandBatch().setPotentiostatMode(ThalesRemoteScriptWrapper::POTMODE_GALVANOSTATIC), "Gal=-1:GAL=1"},
+        {ThalesRemoteScriptWrapper::CommandBatch().setPotentiostatMode(ThalesRemoteScriptWrapper::POTMODE_PSEUDOGALVANOSTATIC), "Gal=0:GAL=-1"},
+        {ThalesRemoteScriptWrapper::CommandBatch().enablePotentiostat(true).enablePotentiostat(false), "Pot=-1:Pot=0"},
+        {ThalesRemoteScriptWrapper::CommandBatch().set<PotentialSetpoint>(-0.25).set<CurrentSetpoint>(1e-9), "Pset=-0.25:Cset=1e-09"},
+        {ThalesRemoteScriptWrapper::CommandBatch().query<Potential>().query<Current>(), "POTENTIAL:CURRENT"},
+    };
+
+    int failures = 0;
+
+    for (const Case &testCase : cases) {
+
+        if (testCase.batch.getCommands() != testCase.commands) {
+
+            std::cerr << "The typed batch was \"" << testCase.batch.getCommands() << "\" instead of \"" << testCase.commands << "\"" << std::endl;
+            failures++;
+        }
+    }
+
+    ThalesRemoteScriptWrapper::BatchReply reply("1:potential= -2.5e-01V:current= 1.5e-09A:impedance= 1.25e+01,-3.5e+00:");
+
+    if (reply.get<Potential>() != -0.25 || reply.get<Current>() != 1.5e-9 || reply.get<Impedance>() != std::complex<double>(12.5, -3.5)) {
+
+        std::cerr << "The typed queries parsed the reply wrongly" << std::endl;
+        failures++;
+    }
+
+    if (std::isnan(ThalesRemoteScriptWrapper::parse<Current>("1:potential= 1.0V:")) == false) {
+
+        std::cerr << "A missing current was parsed" << std::endl;
+        failures++;
+    }
+
+    results.add("command_table_check", "failures", failures);
+
+    return failures;
+}
+
+/** Checks that setpoints go out exactly, down to pA and uHz and up to MHz. */
+static int checkSetpointFormatting(BenchmarkResults &results) {
+
+    struct Case {
+        const char *name;
+        double value;
+    };
+
+    const Case cases[] = {
+        {"Cset", 1e-9},
+        {"Cset", -2.5e-9},
+        {"Cset", 123.456e-9},
+        {"Cset", 1e-12},
+        {"Cset", 3.7e-12},
+        {"Cset", -0.1e-12},
+        {"Frq", 1e-6},
+        {"Frq", 10e-6},
+        {"Frq", 123.4567e-6},
+        {"Frq", 1e6},
+        {"Frq", 4e6},
+        {"Frq", 1.23456789e6},
+        {"Pset", 0.1},
+        {"Pset", -1.0 / 3.0},
+        {"Ampl", 10e-3 * 1e3},
+        {"Pset", 0},
+    };
+
+    int failures = 0;
+    int zeroed_by_to_string = 0;
+
+    for (const Case &testCase : cases) {
+
+        ThalesRemoteScriptWrapper::CommandBatch batch;
+        batch.setValue(testCase.name, testCase.value);
+
+        const std::string &command = batch.getCommands();
+        std::string expectedPrefix = std::string(testCase.name) + "=";
+
+        double sent = std::strtod(command.c_str() + expectedPrefix.size(), nullptr);
+
+        if (command.compare(0, expectedPrefix.size(), expectedPrefix) != 0 || sent != testCase.value) {
+
+            std::cerr << "setValue(" << testCase.name << ", " << testCase.value << ") sent \"" << command << "\"" << std::endl;
+            failures++;
+        }
+
+        if (testCase.value != 0 && std::strtod(std::to_string(testCase.value).c_str(), nullptr) == 0) {
+
+            zeroed_by_to_string++;
+        }
+    }
+
+    ThalesRemoteScriptWrapper::CommandBatch batch;
+    batch.setValue("Nw", -42).setCurrent(1e-9).setFrequency(1e6);
+
+    if (batch.getCommands() != "Nw=-42:Cset=1e-09:Frq=1e+06") {
+
+        std::cerr << "The batch was formatted as \"" << batch.getCommands() << "\"" << std::endl;
+        failures++;
+    }
+
+    results.add("setpoint_formatting_check", "zeroed_by_to_string", zeroed_by_to_string);
+    results.add("setpoint_formatting_check", "failures", failures);
+
+    return failures;
+}
+
+/** Compares the formatting of setpoints with the std::to_string it replaced. */
+static void measureSetpointFormatting(BenchmarkResults &results, int iterations) {
+
+    const double values[] = {1e-9, 2.5e-12, 1000, 123.4567e-6, 1.23456789e6, -0.25, 10, 4e6};
+    const size_t value_count = sizeof(values) / sizeof(values[0]);
+
+    const int formats = iterations * 100;
+
+    size_t length = 0;
+
+    counted_allocations = 0;
+    count_allocations = true;
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (int i = 0; i < formats; ++i) {
+
+        std::string command = std::string("Cset") + "=" + std::to_string(values[static_cast<size_t>(i) % value_count]);
+        length += command.size();
+    }
+
+    double microseconds = elapsedMicroseconds(start, BenchmarkClock::now());
+
+    count_allocations = false;
+
+    results.add("setpoint_formatting_to_string", "ns_per_setpoint", microseconds * 1e3 / formats);
+    results.add("setpoint_formatting_to_string", "allocations_per_setpoint", static_cast<double>(counted_allocations) / formats);
+
+    counted_allocations = 0;
+    count_allocations = true;
+
+    start = BenchmarkClock::now();
+
+    for (int i = 0; i < formats; ++i) {
+
+        char number[ThalesRemoteScriptWrapper::max_formatted_value_length];
+        length += ThalesRemoteScriptWrapper::formatValue(number, sizeof(number), values[static_cast<size_t>(i) % value_count]).size();
+    }
+
+    microseconds = elapsedMicroseconds(start, BenchmarkClock::now());
+
+    count_allocations = false;
+
+    results.add("setpoint_formatting", "ns_per_setpoint", microseconds * 1e3 / formats);
+    results.add("setpoint_formatting", "allocations_per_setpoint", static_cast<double>(counted_allocations) / formats);
+
+    // A batch which is reused keeps its capacity, so building the commands does not allocate either.
+    ThalesRemoteScriptWrapper::CommandBatch batch;
+    batch.setFrequency(1.23456789e6).setAmplitude(10e-3).setCurrent(2.5e-12).queryImpedance();
+
+    counted_allocations = 0;
+    count_allocations = true;
+
+    start = BenchmarkClock::now();
+
+    for (int i = 0; i < formats; ++i) {
+
+        batch.clear();
+        batch.setFrequency(values[static_cast<size_t>(i) % value_count]).setAmplitude(10e-3).setCurrent(2.5e-12);
+        length += batch.getCommands().size();
+    }
+
+    microseconds = elapsedMicroseconds(start, BenchmarkClock::now());
+
+    count_allocations = false;
+
+    results.add("setpoint_formatting_batch", "ns_per_batch", microseconds * 1e3 / formats);
+    results.add("setpoint_formatting_batch", "allocations_per_batch", static_cast<double>(counted_allocations) / formats);
+
+    // Keeps the compiler from dropping the loops.
+    if (length == 0) {
+        std::cerr << "No setpoint was formatted" << std::endl;
+    }
+}
+
+/** Checks that a telegram sent with sendTelegram() behind pipelined requests gets its own reply. */
+static int checkRawSendBehindRequests(ThalesRemoteConnection &connection, TermSimulator &simulator, BenchmarkResults &results) {
+
+    int failures = 0;
+
+    // The requests are still waiting for their replies when the raw telegram is sent.
+    simulator.setLatency(std::chrono::microseconds(2000));
+
+    std::future<std::string> first = connection.sendStringAndGetReplyFuture("1:POTENTIAL:", 2);
+    std::future<std::string> second = connection.sendStringAndGetReplyFuture("2:POTENTIAL:", 2);
+
+    connection.sendTelegram("3:CURRENT:", 2);
+
+    std::future<std::string> fourth = connection.sendStringAndGetReplyFuture("4:POTENTIAL:", 2);
+
+    std::string raw = connection.waitForStringTelegram(std::chrono::milliseconds(2000), 2);
+
+    if (first.get().rfind("1:potential=", 0) != 0 || second.get().rfind("2:potential=", 0) != 0 || fourth.get().rfind("4:potential=", 0) != 0) {
+
+        std::cerr << "A pipelined request got the wrong reply" << std::endl;
+        failures++;
+    }
+
+    if (raw.rfind("3:current=", 0) != 0) {
+
+        std::cerr << "The raw telegram got the reply \"" << raw << "\"" << std::endl;
+        failures++;
+    }
+
+    simulator.setLatency(std::chrono::microseconds(0));
+
+    results.add("raw_send_behind_requests_check", "failures", failures);
+
+    return failures;
+}
+
+/** Checks that setpoints Remote Script rejected are sent again instead of being cached. */
+static int checkRejectedSetpoints(ThalesRemoteScriptWrapper &remoteScript, BenchmarkResults &results) {
+
+    int failures = 0;
+
+    unsigned long suppressed_setpoints = remoteScript.getSuppressedSetpoints();
+
+    // The simulator rejects frequencies which are not positive.
+    remoteScript.setValue("Frq", -1.0);
+    remoteScript.setValue("Frq", -1.0);
+
+    if (remoteScript.getSuppressedSetpoints() != suppressed_setpoints) {
+
+        std::cerr << "A rejected setpoint was cached" << std::endl;
+        failures++;
+    }
+
+    remoteScript.setFrequency(1000);
+    remoteScript.setFrequency(1000);
+
+    if (remoteScript.getSuppressedSetpoints() != suppressed_setpoints + 1) {
+
+        std::cerr << "An accepted setpoint was not cached" << std::endl;
+        failures++;
+    }
+
+    // Setpoints in raw commands share the cache slots of the command table.
+    remoteScript.executeBatch(ThalesRemoteScriptWrapper::CommandBatch().addCommand("Frq=1000:POTENTIAL"));
+
+    if (remoteScript.getSuppressedSetpoints() != suppressed_setpoints + 2) {
+
+        std::cerr << "A setpoint in a raw command missed the cache" << std::endl;
+        failures++;
+    }
+
+    results.add("setpoint_cache_check", "failures", failures);
+
+    return failures;
+}
+
+/** Measures the time from taking a telegram from the socket until the waiting thread is running again. */
+static std::vector<double> measureWakeupLatency(ThalesRemoteConnection &connection, int iterations) {
+
+    const uint8_t loopback_message_type = 0x10;
+
+    std::vector<double> samples;
+    samples.reserve(static_cast<size_t>(iterations));
+
+    connection.clearIncomingTelegramQueue();
+
+    for (int i = 0; i < iterations; ++i) {
+
+        connection.sendTelegram("wakeup", loopback_message_type);
+
+        TelegramBuffer telegram = connection.waitForTelegramBuffer(std::chrono::milliseconds(5000), loopback_message_type);
+        BenchmarkClock::time_point woken_up = BenchmarkClock::now();
+
+        if (telegram.empty()) {
+            break;
+        }
+
+        samples.push_back(elapsedMicroseconds(telegram.getReceiveTime(), woken_up));
+    }
+
+    return samples;
+}
+
+/** Moves the telegrams from one producer thread through a queue to the consumer threads.
+ *
+ * The payload of every telegram is its index, each consumer checks that it
+ * gets them in ascending order.
+ *
+ * \returns the telegrams per second.
+ */
+template<typename Push, typename Pop>
+static double runQueueContention(std::vector<TelegramBuffer> &telegrams, int consumers, Push push, Pop pop, std::atomic<int> &failures) {
+
+    std::atomic<size_t> consumed(0);
+    std::vector<std::thread> consumerThreads;
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    for (int i = 0; i < consumers; ++i) {
+
+        consumerThreads.emplace_back([&]() {
+
+            TelegramBuffer telegram;
+            uint32_t last_index = 0;
+            bool first = true;
+
+            while (consumed < telegrams.size()) {
+
+                // Yielding keeps the measurement meaningful on machines with few cores.
+                if (pop(telegram) == false) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                uint32_t index;
+                std::memcpy(&index, telegram.data(), sizeof(index));
+
+                if (first == false && index <= last_index) {
+                    failures++;
+                }
+
+                first = false;
+                last_index = index;
+                consumed++;
+
+                telegram.reset();
+            }
+        });
+    }
+
+    for (TelegramBuffer &telegram : telegrams) {
+
+        while (push(std::move(telegram)) == false) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (std::thread &consumerThread : consumerThreads) {
+        consumerThread.join();
+    }
+
+    return telegrams.size() / (elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6);
+}
+
+/** Compares the lock-free TelegramRing with a TelegramQueue behind a mutex, as the receive queues were before.
+ *
+ * \returns the number of telegrams which were delivered out of order.
+ */
+static int measureReceiveQueueContention(BenchmarkResults &results, int telegram_count) {
+
+    std::shared_ptr<TelegramBufferPool> pool = std::make_shared<TelegramBufferPool>(telegram_count, 16);
+    std::vector<TelegramBuffer> telegrams;
+
+    auto refill = [&]() {
+
+        telegrams.clear();
+
+        for (int i = 0; i < telegram_count; ++i) {
+
+            uint32_t index = static_cast<uint32_t>(i);
+            telegrams.push_back(pool->acquire(reinterpret_cast<const uint8_t *>(&index), sizeof(index), 2));
+        }
+    };
+
+    std::atomic<int> failures(0);
+
+    for (int consumers : {1, 4}) {
+
+        std::string suffix = (consumers == 1) ? "" : "_" + std::to_string(consumers) + "_consumers";
+
+        std::mutex queueGuard;
+        TelegramQueue queue;
+
+        refill();
+
+        results.add("receive_queue_mutex" + suffix, "telegrams_per_second", runQueueContention(telegrams, consumers, [&](TelegramBuffer &&telegram) {
+
+            std::lock_guard<std::mutex> lock(queueGuard);
+            queue.push(std::move(telegram));
+            return true;
+
+        }, [&](TelegramBuffer &telegram) {
+
+            std::lock_guard<std::mutex> lock(queueGuard);
+
+            if (queue.empty()) {
+                return false;
+            }
+
+            telegram = queue.pop();
+            return true;
+
+        }, failures));
+
+        TelegramRing ring;
+        std::mutex consumerGuard;
+
+        refill();
+
+        results.add("receive_queue_ring" + suffix, "telegrams_per_second", runQueueContention(telegrams, consumers, [&](TelegramBuffer &&telegram) {
+
+            return ring.tryPush(std::move(telegram));
+
+        }, [&](TelegramBuffer &telegram) {
+
+            // Several consumers take turns like in QUEUE_MULTIPLE_CONSUMERS mode.
+            std::unique_lock<std::mutex> lock(consumerGuard, std::defer_lock);
+
+            if (consumers > 1) {
+                lock.lock();
+            }
+
+            return ring.tryPop(telegram);
+
+        }, failures));
+    }
+
+    results.add("receive_queue", "out_of_order", failures.load());
+
+    return failures.load();
+}
+
+#ifndef _WIN32
+
+/** Drives the receive path of a connection synchronously from one end of a socket pair. */
+class ReceivePathProbe : public ThalesRemoteConnection
+{
+public:
+
+    ReceivePathProbe(SOCKET socket_handle) {
+
+        this->socket_handle = socket_handle;
+        this->receiveBuffer.reset(new uint8_t[receive_buffer_size]);
+    }
+
+    bool receiveIntoQueue() {
+
+        TelegramBuffer telegram;
+
+        if (this->readTelegramFromSocket(telegram) == false) {
+            return false;
+        }
+
+        this->queueTelegram(std::move(telegram));
+
+        return true;
+    }
+};
+
+/** Counts the heap allocations of sending telegrams and of reading, queueing
+ * and consuming them once the pool is warmed up.
+ *
+ * \returns the number of allocations per telegram in the steady state, which should be zero.
+ */
+static double measureTelegramPathAllocations(BenchmarkResults &results) {
+
+    const int telegrams_per_round = 1000;
+    const int rounds = 10;
+    const uint16_t payload_length = 32;
+
+    int sockets[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        return 0;
+    }
+
+    std::vector<char> frames;
+
+    for (int i = 0; i < telegrams_per_round; ++i) {
+
+        frames.push_back(reinterpret_cast<const char *>(&payload_length)[0]);
+        frames.push_back(reinterpret_cast<const char *>(&payload_length)[1]);
+        frames.push_back(2);
+        frames.insert(frames.end(), payload_length, 'x');
+    }
+
+    unsigned long allocations = 0;
+    unsigned long send_allocations = 0;
+
+    std::vector<char> drain(frames.size());
+
+    {
+        ReceivePathProbe probe(sockets[0]);
+
+        for (int round = 0; round < rounds; ++round) {
+
+            if (write(sockets[1], frames.data(), frames.size()) != static_cast<ssize_t>(frames.size())) {
+                break;
+            }
+
+            // the first round warms up the pool and the queue
+            unsigned long allocations_before = counted_allocations;
+            count_allocations = (round > 0);
+
+            for (int i = 0; i < telegrams_per_round; ++i) {
+
+                probe.receiveIntoQueue();
+                probe.receiveTelegramBuffer();
+            }
+
+            count_allocations = false;
+            allocations += counted_allocations - allocations_before;
+
+            allocations_before = counted_allocations;
+            count_allocations = (round > 0);
+
+            for (int i = 0; i < telegrams_per_round; ++i) {
+
+                probe.sendTelegram(std::string_view(frames.data() + 3, payload_length), 2);
+
+                // drained right away, small writes fill the socket buffer of a socket pair quickly
+                if (read(sockets[1], drain.data(), payload_length + 3u) <= 0) {
+                    break;
+                }
+            }
+
+            count_allocations = false;
+            send_allocations += counted_allocations - allocations_before;
+        }
+    }
+
+    close(sockets[0]);
+    close(sockets[1]);
+
+    double allocations_per_telegram = static_cast<double>(allocations) / static_cast<double>((rounds - 1) * telegrams_per_round);
+    double send_allocations_per_telegram = static_cast<double>(send_allocations) / static_cast<double>((rounds - 1) * telegrams_per_round);
+
+    results.add("receive_path_allocations", "telegrams", (rounds - 1) * telegrams_per_round);
+    results.add("receive_path_allocations", "allocations_per_telegram", allocations_per_telegram);
+    results.add("send_path_allocations", "telegrams", (rounds - 1) * telegrams_per_round);
+    results.add("send_path_allocations", "allocations_per_telegram", send_allocations_per_telegram);
+
+    return allocations_per_telegram + send_allocations_per_telegram;
+}
+
+#endif
+
+#ifdef __linux__
+
+/** Runs a Term simulator in a child process, so its threads don't count for this process.
+ *
+ * Has to be called before this process starts any threads.
+ *
+ * \returns the process id of the simulator or -1.
+ */
+static pid_t startSimulatorProcess(unsigned short &port) {
+
+    int portPipe[2];
+
+    if (pipe(portPipe) != 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        TermSimulator simulator;
+
+        port = simulator.start() ? simulator.getPort() : 0;
+
+        if (write(portPipe[1], &port, sizeof(port)) != sizeof(port)) {
+            _exit(1);
+        }
+
+        // Runs until the benchmark kills it.
+        while (true) {
+            pause();
+        }
+    }
+
+    close(portPipe[1]);
+
+    if (pid < 0 || read(portPipe[0], &port, sizeof(port)) != sizeof(port) || port == 0) {
+
+        close(portPipe[0]);
+        return -1;
+    }
+
+    close(portPipe[0]);
+
+    return pid;
+}
+
+/** Reads a value like "Threads:" or "VmRSS:" from /proc/self/status. */
+static long readProcessStatus(const std::string &key) {
+
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+
+        if (line.compare(0, key.size(), key) == 0) {
+            return std::atol(line.c_str() + key.size());
+        }
+    }
+
+    return 0;
+}
+
+/** Connects to many simulated instruments at once and compares the CPU time, memory
+ * and context switches of a thread per connection with the reactor.
+ *
+ * Runs in a process of its own, see measureInstrumentsInChild(). The receive
+ * buffers of both modes only count for the resident memory as far as the
+ * replies reach into them. The thread stacks show up in the virtual memory.
+ */
+static void measureInstruments(BenchmarkResults &results, unsigned short port, size_t instruments, bool use_reactor, int rounds) {
+
+    long rss_before = readProcessStatus("VmRSS:");
+    long virtual_memory_before = readProcessStatus("VmSize:");
+    long threads_before = readProcessStatus("Threads:");
+
+    std::shared_ptr<TelegramReactor> reactor;
+
+    if (use_reactor) {
+        reactor = std::make_shared<TelegramReactor>();
+    }
+
+    std::vector< std::unique_ptr<ThalesRemoteConnection> > connections;
+
+    for (size_t i = 0; i < instruments; ++i) {
+
+        connections.emplace_back(new ThalesRemoteConnection());
+        connections.back()->setReactor(reactor);
+
+        if (connections.back()->connectToTerm("localhost", "ScriptRemote", std::chrono::milliseconds(2000), port) == false) {
+
+            std::cerr << "Could not connect instrument " << i << std::endl;
+            connections.pop_back();
+            break;
+        }
+    }
+
+    long rss_connected = readProcessStatus("VmRSS:");
+    long virtual_memory_connected = readProcessStatus("VmSize:");
+    long threads_connected = readProcessStatus("Threads:");
+
+    struct rusage usage_before;
+    getrusage(RUSAGE_SELF, &usage_before);
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+
+    int answered = 0;
+
+    std::vector< std::future<std::string> > replies;
+    replies.reserve(connections.size());
+
+    for (int round = 0; round < rounds; ++round) {
+
+        for (std::unique_ptr<ThalesRemoteConnection> &connection : connections) {
+            replies.push_back(connection->sendStringAndGetReplyFuture("1:Pset=0:", 2));
+        }
+
+        for (std::future<std::string> &reply : replies) {
+
+            if (reply.get().empty() == false) {
+                answered++;
+            }
+        }
+
+        replies.clear();
+    }
+
+    double seconds = elapsedMicroseconds(start, BenchmarkClock::now()) / 1e6;
+
+    struct rusage usage_after;
+    getrusage(RUSAGE_SELF, &usage_after);
+
+    auto cpuMicroseconds = [](const struct rusage &usage) {
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    };
+
+    double context_switches = static_cast<double>((usage_after.ru_nvcsw + usage_after.ru_nivcsw) - (usage_before.ru_nvcsw + usage_before.ru_nivcsw));
+
+    std::string name = "instruments_" + std::to_string(instruments) + (use_reactor ? "_reactor" : "_threads");
+
+    results.add(name, "connections", static_cast<double>(connections.size()));
+    results.add(name, "threads", static_cast<double>(threads_connected - threads_before));
+    results.add(name, "rss_kb", static_cast<double>(rss_connected - rss_before));
+    results.add(name, "virtual_memory_kb", static_cast<double>(virtual_memory_connected - virtual_memory_before));
+    results.add(name, "requests_per_second", answered / seconds);
+    results.add(name, "cpu_us_per_request", (cpuMicroseconds(usage_after) - cpuMicroseconds(usage_before)) / std::max(answered, 1));
+    results.add(name, "context_switches_per_request", context_switches / std::max(answered, 1));
+
+    for (std::unique_ptr<ThalesRemoteConnection> &connection : connections) {
+        connection->disconnectFromTerm();
+    }
+}
+
+/** Runs measureInstruments() in a child process, which sends its results back as CSV.
+ *
+ * Every mode starts with a fresh heap, otherwise a run would reuse the memory
+ * freed by the run before and its memory would not count.
+ */
+static void measureInstrumentsInChild(BenchmarkResults &results, unsigned short port, size_t instruments, bool use_reactor, int rounds) {
+
+    int resultPipe[2];
+
+    if (pipe(resultPipe) != 0) {
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        close(resultPipe[0]);
+
+        BenchmarkResults childResults;
+        measureInstruments(childResults, port, instruments, use_reactor, rounds);
+
+        std::ostringstream csv;
+        childResults.writeCsv(csv);
+
+        const std::string text = csv.str();
+
+        _exit(write(resultPipe[1], text.data(), text.size()) == static_cast<ssize_t>(text.size()) ? 0 : 1);
+    }
+
+    close(resultPipe[1]);
+
+    std::string text;
+    char buffer[4096];
+    ssize_t received_bytes;
+
+    while (pid > 0 && (received_bytes = read(resultPipe[0], buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, static_cast<size_t>(received_bytes));
+    }
+
+    close(resultPipe[0]);
+
+    if (pid < 0) {
+
+        std::cerr << "Could not start a process for " << instruments << " instruments" << std::endl;
+        return;
+    }
+
+    waitpid(pid, nullptr, 0);
+
+    std::istringstream csv(text);
+    results.addCsv(csv);
+}
+
+#endif
+
+int main(int argc, char *argv[]) {
+
+    bool csv = false;
+    int iterations = 2000;
+
+    for (int i = 1; i < argc; ++i) {
+
+        std::string argument(argv[i]);
+
+        if (argument == "--csv") {
+
+            csv = true;
+
+        } else if (argument == "--iterations" && i + 1 < argc) {
+
+            iterations = std::max(1, std::atoi(argv[++i]));
+
+        } else {
+
+            std::cerr << "Usage: " << argv[0] << " [--csv] [--iterations N]" << std::endl;
+            return 1;
+        }
+    }
+
+#ifdef __linux__
+    unsigned short simulator_process_port = 0;
+    pid_t simulator_process = startSimulatorProcess(simulator_process_port);
+#endif
+
+    TermSimulator simulator;
+
+    if (simulator.start() == false) {
+
+        std::cerr << "Could not start the Term simulator" << std::endl;
+        return 1;
+    }
+
+    BenchmarkResults results;
+
+    std::vector<double> connectSamples;
+
+    for (int i = 0; i < std::max(iterations / 20, 10); ++i) {
+
+        ThalesRemoteConnection connection;
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+
+        if (connection.connectToTerm("localhost", "ScriptRemote", std::chrono::milliseconds(2000), simulator.getPort())) {
+
+            connectSamples.push_back(elapsedMicroseconds(start, BenchmarkClock::now()));
+            connection.disconnectFromTerm();
+        }
+    }
+
+    results.addLatency("connectToTerm", connectSamples);
+
+    ThalesRemoteConnection thalesConnection;
+
+    if (thalesConnection.connectToTerm("localhost", "ScriptRemote", std::chrono::milliseconds(2000), simulator.getPort()) == false) {
+
+        std::cerr << "Could not connect to the Term simulator" << std::endl;
+        return 1;
+    }
+
+    ThalesRemoteScriptWrapper remoteScript(&thalesConnection);
+
+    remoteScript.forceThalesIntoRemoteScript();
+    remoteScript.setPotentiostatMode(ThalesRemoteScriptWrapper::POTMODE_POTENTIOSTATIC);
+    remoteScript.enablePotentiostat();
+
+    results.addLatency("sendStringAndWaitForReplyString", measureLatency(iterations, [&]() {
+        thalesConnection.sendStringAndWaitForReplyString("1:Pset=0:", 2);
+    }));
+
+    results.addLatency("executeRemoteCommand", measureLatency(iterations, [&]() {
+        remoteScript.executeRemoteCommand("Pset=0");
+    }));
+
+    results.addLatency("getPotential", measureLatency(iterations, [&]() {
+        remoteScript.getPotential();
+    }));
+
+    results.addLatency("getImpedance", measureLatency(iterations, [&]() {
+        remoteScript.getImpedance();
+    }));
+
+    remoteScript.setSetpointCacheEnabled(false);
+
+    results.addLatency("getImpedance_frequency_amplitude_periods_uncached", measureLatency(iterations, [&]() {
+        remoteScript.getImpedance(1000, 10e-3, 1);
+    }));
+
+    remoteScript.setSetpointCacheEnabled(true);
+
+    // Repeated points only send the IMPEDANCE query, repeated setters nothing at all.
+    unsigned long saved_round_trips = remoteScript.getSavedRoundTrips();
+    unsigned long suppressed_setpoints = remoteScript.getSuppressedSetpoints();
+
+    results.addLatency("getImpedance_frequency_amplitude_periods", measureLatency(iterations, [&]() {
+        remoteScript.getImpedance(1000, 10e-3, 1);
+    }));
+
+    results.addLatency("setFrequency_unchanged", measureLatency(iterations, [&]() {
+        remoteScript.setFrequency(1000);
+    }));
+
+    results.add("setpoint_cache", "saved_round_trips", static_cast<double>(remoteScript.getSavedRoundTrips() - saved_round_trips));
+    results.add("setpoint_cache", "suppressed_setpoints", static_cast<double>(remoteScript.getSuppressedSetpoints() - suppressed_setpoints));
+
+    int setpoint_cache_failures = checkRejectedSetpoints(remoteScript, results);
+    int raw_send_failures = checkRawSendBehindRequests(thalesConnection, simulator, results);
+
+    results.addLatency("waitForTelegram_wakeup", measureWakeupLatency(thalesConnection, iterations));
+
+    measureTelegramThroughput(thalesConnection, results, "telegram_throughput_small", iterations * 50, 16);
+    measureTelegramThroughput(thalesConnection, results, "telegram_throughput_large", iterations * 5, 4096);
+
+    measurePipelining(thalesConnection, remoteScript, simulator, results, std::max(iterations / 10, 20));
+    measureAsyncImpedance(remoteScript, simulator, results, std::max(iterations / 10, 20));
+    measureSweep(remoteScript, simulator, results, std::max(iterations / 10, 20));
+    int socket_profile_failures = measureSocketProfiles(simulator, results, iterations);
+    int acquisition_failures = measureFixedRateAcquisition(remoteScript, results, 1000, std::chrono::milliseconds(500));
+    int metrics_failures = measureMetrics(thalesConnection, results, iterations * 500);
+    int pool_failures = measureInstrumentPool(simulator, results, 16, 5);
+    pool_failures += checkInstrumentPoolSessions(results);
+    int limit_failures = measureReceiveQueueLimits(simulator, results, std::max(iterations * 2, 1000));
+    int capture_failures = measureCapture(simulator, results, iterations, 20);
+
+    thalesConnection.disconnectFromTerm();
+    simulator.stop();
+
+    bool allocation_free = true;
+
+    measureReplyParsing(results, iterations);
+    int parsing_failures = checkReplyParsing(results);
+    measureSetpointFormatting(results, iterations);
+    int formatting_failures = checkSetpointFormatting(results);
+    int command_table_failures = checkCommandTable(results);
+    int result_file_failures = measureResultFileWriting(results, iterations * 100);
+    int queue_failures = measureReceiveQueueContention(results, iterations * 500);
+
+#ifndef _WIN32
+    allocation_free = (measureTelegramPathAllocations(results) == 0);
+#endif
+
+#ifdef __linux__
+    if (simulator_process > 0) {
+
+        for (size_t instruments : {1, 16, 128}) {
+
+            measureInstrumentsInChild(results, simulator_process_port, instruments, true, std::max(iterations / 20, 10));
+            measureInstrumentsInChild(results, simulator_process_port, instruments, false, std::max(iterations / 20, 10));
+        }
+
+        kill(simulator_process, SIGTERM);
+        waitpid(simulator_process, nullptr, 0);
+    }
+#endif
+
+    if (csv) {
+        results.writeCsv(std::cout);
+    } else {
+        results.writeJson(std::cout);
+    }
+
+    if (parsing_failures > 0) {
+
+        std::cerr << "The reply parser failed for some replies" << std::endl;
+        return 1;
+    }
+
+    if (formatting_failures > 0) {
+
+        std::cerr << "Some setpoints were not sent exactly" << std::endl;
+        return 1;
+    }
+
+    if (command_table_failures > 0) {
+
+        std::cerr << "The command table did not produce the expected commands" << std::endl;
+        return 1;
+    }
+
+    if (metrics_failures > 0) {
+
+        std::cerr << "The metrics did not record the commands" << std::endl;
+        return 1;
+    }
+
+    if (acquisition_failures > 0) {
+
+        std::cerr << "The fixed rate acquisition did not keep its rate" << std::endl;
+        return 1;
+    }
+
+    if (raw_send_failures > 0) {
+
+        std::cerr << "A raw telegram was mixed up with pipelined requests" << std::endl;
+        return 1;
+    }
+
+    if (setpoint_cache_failures > 0) {
+
+        std::cerr << "The setpoint cache kept a rejected setpoint" << std::endl;
+        return 1;
+    }
+
+    if (socket_profile_failures > 0) {
+
+        std::cerr << "The socket profiles did not take effect" << std::endl;
+        return 1;
+    }
+
+    if (capture_failures > 0) {
+
+        std::cerr << "The replay of the captured session differed" << std::endl;
+        return 1;
+    }
+
+    if (limit_failures > 0) {
+
+        std::cerr << "The receive queue limits were not kept" << std::endl;
+        return 1;
+    }
+
+    if (queue_failures > 0) {
+
+        std::cerr << "The receive queues delivered telegrams out of order" << std::endl;
+        return 1;
+    }
+
+    if (result_file_failures > 0) {
+
+        std::cerr << "The result file could not be read back correctly" << std::endl;
+        return 1;
+    }
+
+    if (pool_failures > 0) {
+
+        std::cerr << "Some instruments of the pool did not complete their plan" << std::endl;
+        return 1;
+    }
+
+    if (allocation_free == false) {
+
+        std::cerr << "The steady state telegram path allocated memory" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
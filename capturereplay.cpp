@@ -0,0 +1,132 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "capturereplay.h"
+
+#include <algorithm>
+
+bool ReplayResult::isIdentical() const {
+
+    return this->completed && this->matching_telegrams == this->expected_telegrams;
+}
+
+CaptureReplay::CaptureReplay() :
+    speed(1.0),
+    receive_timeout(std::chrono::milliseconds(5000))
+{
+
+}
+
+bool CaptureReplay::load(std::string path) {
+
+    return TelegramCaptureReader::readAll(std::move(path), this->records);
+}
+
+void CaptureReplay::setRecords(std::vector<CaptureRecord> records) {
+
+    this->records = std::move(records);
+}
+
+const std::vector<CaptureRecord> &CaptureReplay::getRecords() const {
+
+    return this->records;
+}
+
+void CaptureReplay::setSpeed(double speed) {
+
+    this->speed = speed;
+}
+
+void CaptureReplay::setReceiveTimeout(std::chrono::milliseconds timeout) {
+
+    this->receive_timeout = timeout;
+}
+
+ReplayResult CaptureReplay::replayThroughClient(ThalesRemoteConnection &connection) {
+
+    ReplayResult result;
+
+    if (this->records.empty()) {
+
+        return result;
+    }
+
+    result.recorded_duration = this->records.back().timestamp - this->records.front().timestamp;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    CapturePacer pacer(this->speed);
+    pacer.markReplayed(this->records.front().timestamp);
+
+    for (const CaptureRecord &record : this->records) {
+
+        if (record.direction == CAPTURE_TO_TERM) {
+
+            // The connection is left open, disconnecting is up to the caller.
+            if (record.message_type == 4 && record.payload.size() == 2 && record.payload[0] == 0xff && record.payload[1] == 0xff) {
+
+                continue;
+            }
+
+            pacer.waitUntilDue(record.timestamp);
+
+            if (connection.sendTelegram(record.payload, record.message_type) == false) {
+
+                std::cerr << "replay stopped, sending failed" << std::endl;
+                result.replay_duration = std::chrono::steady_clock::now() - start;
+                return result;
+            }
+
+            result.sent_telegrams++;
+
+        } else {
+
+            result.expected_telegrams++;
+
+            TelegramBuffer telegram = connection.waitForTelegramBuffer(this->receive_timeout, record.message_type);
+
+            if (telegram.empty() && record.payload.empty() == false) {
+
+                result.missing_telegrams++;
+
+            } else if (telegram.size() == record.payload.size() && std::equal(record.payload.begin(), record.payload.end(), telegram.data())) {
+
+                result.matching_telegrams++;
+
+            } else {
+
+                result.differing_telegrams++;
+            }
+        }
+
+        pacer.markReplayed(record.timestamp);
+    }
+
+    result.completed = true;
+    result.replay_duration = std::chrono::steady_clock::now() - start;
+
+    return result;
+}
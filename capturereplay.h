@@ -0,0 +1,121 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CAPTUREREPLAY_H
+#define CAPTUREREPLAY_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "telegramcapture.h"
+#include "thalesremoteconnection.h"
+
+/** The outcome of replaying a capture. */
+struct ReplayResult
+{
+    /** False if the replay stopped early because sending failed. */
+    bool completed = false;
+
+    /** The telegrams sent to Term. */
+    size_t sent_telegrams = 0;
+
+    /** The telegrams from Term in the capture and how the ones received during the replay compared. */
+    size_t expected_telegrams = 0;
+    size_t matching_telegrams = 0;
+    size_t differing_telegrams = 0;
+    size_t missing_telegrams = 0;
+
+    /** From the first to the last record, in the capture and during the replay. */
+    std::chrono::nanoseconds recorded_duration = std::chrono::nanoseconds(0);
+    std::chrono::nanoseconds replay_duration = std::chrono::nanoseconds(0);
+
+    /** True if the replay completed and Term answered exactly like in the capture. */
+    bool isIdentical() const;
+};
+
+/** Replays the client side of a capture through a connection.
+ *
+ * The telegrams the client sent are sent again in the same order, timed by a
+ * CapturePacer. For every telegram Term sent in the capture the replay waits
+ * for a telegram of the same message type and compares the payloads. That
+ * reproduces a session deterministically, e.g. to compare the behaviour of
+ * an instrument or a Term version with the captured one, or to generate the
+ * same load again at a higher speed.
+ *
+ * The disconnect message of the capture is not sent, the connection stays
+ * open. Captures of clients which used telegram handlers or pipelining can
+ * still be replayed, the replay waits for the telegrams in their captured
+ * order.
+ *
+ * \code
+ * CaptureReplay replay;
+ * replay.load("session.ttc");
+ * replay.setSpeed(10);
+ *
+ * ReplayResult result = replay.replayThroughClient(connection);
+ * \endcode
+ */
+class CaptureReplay
+{
+public:
+
+    CaptureReplay();
+
+    /** Reads the records of a capture file.
+     *
+     * \returns false if the file can't be read.
+     */
+    bool load(std::string path);
+
+    void setRecords(std::vector<CaptureRecord> records);
+    const std::vector<CaptureRecord> &getRecords() const;
+
+    /** Sets the speed of the replay.
+     *
+     * \param [in] speed 1 for the original speed, 2 for twice as fast, 0 for as fast as possible.
+     */
+    void setSpeed(double speed);
+
+    /** Sets how long the replay waits for every telegram from Term. */
+    void setReceiveTimeout(std::chrono::milliseconds timeout);
+
+    /** Replays the capture through a connected connection.
+     *
+     * \param [in] connection connected to Term or a TermSimulator, in the state the capture started in.
+     * \returns the counters of the replay, it stops early if sending fails.
+     */
+    ReplayResult replayThroughClient(ThalesRemoteConnection &connection);
+
+protected:
+
+    std::vector<CaptureRecord> records;
+
+    double speed;
+    std::chrono::milliseconds receive_timeout;
+};
+
+#endif // CAPTUREREPLAY_H
@@ -0,0 +1,139 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include "capturereplay.h"
+
+/** Prints or replays a telegram capture.
+ *
+ * Usage: ReplayCapture capture [--host host] [--port port] [--name connectionName] [--speed factor]
+ *
+ * Without host the records are printed, one line per telegram. With host
+ * the client side of the capture is replayed against Term or a TermSimulator
+ * and the telegrams from Term are compared with the capture. The speed 0
+ * replays as fast as possible. The exit code is 0 if Term answered exactly
+ * like in the capture.
+ *
+ * To replay the Term side, e.g. to run a client against a captured
+ * instrument, use TermSimulator --replay.
+ */
+
+static void printRecord(const CaptureRecord &record) {
+
+    std::cout << std::fixed << std::setprecision(6) << std::chrono::duration<double>(record.timestamp).count()
+              << (record.direction == CAPTURE_TO_TERM ? " > " : " < ")
+              << static_cast<int>(record.message_type) << " ";
+
+    for (uint8_t byte : record.payload) {
+
+        if (byte >= 0x20 && byte < 0x7f && byte != '\\') {
+
+            std::cout << static_cast<char>(byte);
+
+        } else {
+
+            std::cout << "\\x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte) << std::dec << std::setfill(' ');
+        }
+    }
+
+    std::cout << "\n";
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc < 2) {
+
+        std::cerr << "Usage: " << argv[0] << " capture [--host host] [--port port] [--name connectionName] [--speed factor]" << std::endl;
+        return 1;
+    }
+
+    std::string host;
+    unsigned short port = 260;
+    std::string connectionName = "ScriptRemote";
+    double speed = 1.0;
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+
+        std::string option = argv[i];
+
+        if (option == "--host") {
+            host = argv[i + 1];
+        } else if (option == "--port") {
+            port = static_cast<unsigned short>(std::atoi(argv[i + 1]));
+        } else if (option == "--name") {
+            connectionName = argv[i + 1];
+        } else if (option == "--speed") {
+            speed = std::atof(argv[i + 1]);
+        } else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    CaptureReplay replay;
+
+    if (replay.load(argv[1]) == false) {
+
+        return 1;
+    }
+
+    if (host.empty()) {
+
+        for (const CaptureRecord &record : replay.getRecords()) {
+
+            printRecord(record);
+        }
+
+        return 0;
+    }
+
+    ThalesRemoteConnection connection;
+
+    if (connection.connectToTerm(host, connectionName, std::chrono::milliseconds(5000), port) == false) {
+
+        std::cerr << "could not connect to " << host << ":" << port << std::endl;
+        return 1;
+    }
+
+    replay.setSpeed(speed);
+
+    ReplayResult result = replay.replayThroughClient(connection);
+
+    connection.disconnectFromTerm();
+
+    std::cout << "sent telegrams:      " << result.sent_telegrams << "\n"
+              << "expected telegrams:  " << result.expected_telegrams << "\n"
+              << "matching telegrams:  " << result.matching_telegrams << "\n"
+              << "differing telegrams: " << result.differing_telegrams << "\n"
+              << "missing telegrams:   " << result.missing_telegrams << "\n"
+              << "recorded duration:   " << std::chrono::duration<double>(result.recorded_duration).count() << " s\n"
+              << "replay duration:     " << std::chrono::duration<double>(result.replay_duration).count() << " s" << std::endl;
+
+    return result.isIdentical() ? 0 : 1;
+}
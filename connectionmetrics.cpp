@@ -0,0 +1,570 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "connectionmetrics.h"
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+void writeNumber(std::ostream &stream, double value) {
+
+    char number[32];
+    std::to_chars_result result = std::to_chars(number, number + sizeof(number), value);
+
+    stream.write(number, result.ptr - number);
+}
+
+/** Writes the text with the escapes Prometheus label values and JSON strings have in common. */
+void writeEscaped(std::ostream &stream, std::string_view text) {
+
+    for (char character : text) {
+
+        if (character == '\\' || character == '"') {
+
+            stream << '\\' << character;
+
+        } else if (character == '\n') {
+
+            stream << "\\n";
+
+        } else {
+
+            stream << character;
+        }
+    }
+}
+
+/** Writes "{labels,name="value"}" leaving out empty parts. */
+void writeLabels(std::ostream &stream, const std::string &labels, std::string_view name = std::string_view(), std::string_view value = std::string_view()) {
+
+    if (labels.empty() && name.empty()) {
+
+        return;
+    }
+
+    stream << '{' << labels;
+
+    if (name.empty() == false) {
+
+        stream << (labels.empty() ? "" : ",") << name << "=\"";
+        writeEscaped(stream, value);
+        stream << '"';
+    }
+
+    stream << '}';
+}
+
+void writeType(std::ostream &stream, bool with_type_comments, const char *metric, const char *type) {
+
+    if (with_type_comments) {
+
+        stream << "# TYPE " << metric << ' ' << type << '\n';
+    }
+}
+
+void writeHistogram(std::ostream &stream, const char *metric, const std::string &labels, std::string_view name, std::string_view value, const LatencyHistogram::Snapshot &histogram) {
+
+    uint64_t cumulative_count = 0;
+
+    for (size_t bucket = 0; bucket < LatencyHistogram::bucket_count; ++bucket) {
+
+        cumulative_count += histogram.buckets[bucket];
+
+        uint64_t bound = LatencyHistogram::getBucketBound(bucket);
+
+        std::string bucketLabels = labels;
+        bucketLabels += bucketLabels.empty() ? "" : ",";
+        bucketLabels += "le=\"";
+
+        stream << metric << "_bucket";
+
+        if (bound > 0) {
+
+            char number[32];
+            std::to_chars_result result = std::to_chars(number, number + sizeof(number), static_cast<double>(bound) * 1e-6);
+            bucketLabels.append(number, result.ptr - number);
+
+        } else {
+
+            bucketLabels += "+Inf";
+        }
+
+        bucketLabels += '"';
+
+        writeLabels(stream, bucketLabels, name, value);
+        stream << ' ' << cumulative_count << '\n';
+    }
+
+    stream << metric << "_sum";
+    writeLabels(stream, labels, name, value);
+    stream << ' ';
+    writeNumber(stream, static_cast<double>(histogram.sum_us) * 1e-6);
+    stream << '\n';
+
+    stream << metric << "_count";
+    writeLabels(stream, labels, name, value);
+    stream << ' ' << histogram.count << '\n';
+}
+
+void writeJsonHistogram(std::ostream &stream, const LatencyHistogram::Snapshot &histogram) {
+
+    stream << "{\"count\": " << histogram.count
+           << ", \"sum_us\": " << histogram.sum_us
+           << ", \"max_us\": " << histogram.max_us
+           << ", \"p50_us\": ";
+    writeNumber(stream, histogram.getPercentile(0.5));
+    stream << ", \"p99_us\": ";
+    writeNumber(stream, histogram.getPercentile(0.99));
+    stream << ", \"buckets\": [";
+
+    for (size_t bucket = 0; bucket < LatencyHistogram::bucket_count; ++bucket) {
+
+        stream << (bucket > 0 ? ", " : "") << histogram.buckets[bucket];
+    }
+
+    stream << "]}";
+}
+
+}
+
+double LatencyHistogram::Snapshot::getPercentile(double fraction) const {
+
+    if (this->count == 0) {
+
+        return 0;
+    }
+
+    const double rank = fraction * static_cast<double>(this->count);
+    uint64_t cumulative_count = 0;
+
+    for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+
+        cumulative_count += this->buckets[bucket];
+
+        if (static_cast<double>(cumulative_count) >= rank && getBucketBound(bucket) > 0) {
+
+            return static_cast<double>(std::min(getBucketBound(bucket), this->max_us));
+        }
+    }
+
+    return static_cast<double>(this->max_us);
+}
+
+LatencyHistogram::LatencyHistogram() :
+    sum_us(0),
+    max_us(0)
+{
+
+    for (std::atomic<uint64_t> &bucket : this->buckets) {
+
+        bucket = 0;
+    }
+}
+
+uint64_t LatencyHistogram::getBucketBound(size_t bucket) {
+
+    return (bucket + 1 < bucket_count) ? (uint64_t(1) << bucket) : 0;
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration duration) {
+
+    const int64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    const uint64_t value = (microseconds > 0) ? static_cast<uint64_t>(microseconds) : 0;
+
+    size_t bucket = 0;
+
+    while (bucket + 1 < bucket_count && value > getBucketBound(bucket)) {
+
+        bucket++;
+    }
+
+    this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    this->sum_us.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t maximum = this->max_us.load(std::memory_order_relaxed);
+
+    while (value > maximum && this->max_us.compare_exchange_weak(maximum, value, std::memory_order_relaxed) == false) {
+
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::getSnapshot() const {
+
+    Snapshot snapshot;
+
+    for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+
+        snapshot.buckets[bucket] = this->buckets[bucket].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.buckets[bucket];
+    }
+
+    snapshot.sum_us = this->sum_us.load(std::memory_order_relaxed);
+    snapshot.max_us = this->max_us.load(std::memory_order_relaxed);
+
+    return snapshot;
+}
+
+void LatencyHistogram::reset() {
+
+    for (std::atomic<uint64_t> &bucket : this->buckets) {
+
+        bucket = 0;
+    }
+
+    this->sum_us = 0;
+    this->max_us = 0;
+}
+
+void MetricsSnapshot::writePrometheus(std::ostream &stream, const std::string &labels, bool with_type_comments) const {
+
+    writeType(stream, with_type_comments, "thales_telegrams_total", "counter");
+
+    for (const Traffic &counters : this->traffic) {
+
+        std::string typeLabels = labels + (labels.empty() ? "" : ",") + "message_type=\"" + std::to_string(counters.message_type) + "\"";
+
+        stream << "thales_telegrams_total";
+        writeLabels(stream, typeLabels, "direction", "in");
+        stream << ' ' << counters.telegrams_in << '\n';
+
+        stream << "thales_telegrams_total";
+        writeLabels(stream, typeLabels, "direction", "out");
+        stream << ' ' << counters.telegrams_out << '\n';
+    }
+
+    writeType(stream, with_type_comments, "thales_bytes_total", "counter");
+
+    for (const Traffic &counters : this->traffic) {
+
+        std::string typeLabels = labels + (labels.empty() ? "" : ",") + "message_type=\"" + std::to_string(counters.message_type) + "\"";
+
+        stream << "thales_bytes_total";
+        writeLabels(stream, typeLabels, "direction", "in");
+        stream << ' ' << counters.bytes_in << '\n';
+
+        stream << "thales_bytes_total";
+        writeLabels(stream, typeLabels, "direction", "out");
+        stream << ' ' << counters.bytes_out << '\n';
+    }
+
+    writeType(stream, with_type_comments, "thales_reply_latency_seconds", "histogram");
+
+    for (const auto &reply : this->reply_latency) {
+
+        writeHistogram(stream, "thales_reply_latency_seconds", labels, "message_type", std::to_string(reply.first), reply.second);
+    }
+
+    writeType(stream, with_type_comments, "thales_command_latency_seconds", "histogram");
+
+    for (const auto &command : this->command_latency) {
+
+        writeHistogram(stream, "thales_command_latency_seconds", labels, "command", command.first, command.second);
+    }
+
+    writeType(stream, with_type_comments, "thales_command_client_overhead_seconds", "histogram");
+
+    for (const auto &command : this->command_client_overhead) {
+
+        writeHistogram(stream, "thales_command_client_overhead_seconds", labels, "command", command.first, command.second);
+    }
+
+    writeType(stream, with_type_comments, "thales_telegram_wait_seconds", "histogram");
+    writeHistogram(stream, "thales_telegram_wait_seconds", labels, std::string_view(), std::string_view(), this->telegram_wait);
+
+    writeType(stream, with_type_comments, "thales_connect_seconds", "histogram");
+    writeHistogram(stream, "thales_connect_seconds", labels, std::string_view(), std::string_view(), this->connect);
+
+    const std::pair<const char *, uint64_t> counters[] = {
+        {"thales_failed_connects_total", this->failed_connects},
+        {"thales_dropped_telegrams_total", this->dropped_telegrams}
+    };
+
+    for (const auto &counter : counters) {
+
+        writeType(stream, with_type_comments, counter.first, "counter");
+        stream << counter.first;
+        writeLabels(stream, labels);
+        stream << ' ' << counter.second << '\n';
+    }
+
+    const std::pair<const char *, size_t> gauges[] = {
+        {"thales_queued_telegrams", this->queued_telegrams},
+        {"thales_queued_bytes", this->queued_bytes},
+        {"thales_queued_telegrams_high_water", this->high_water_telegrams},
+        {"thales_queued_bytes_high_water", this->high_water_bytes},
+        {"thales_outstanding_requests", this->outstanding_requests}
+    };
+
+    for (const auto &gauge : gauges) {
+
+        writeType(stream, with_type_comments, gauge.first, "gauge");
+        stream << gauge.first;
+        writeLabels(stream, labels);
+        stream << ' ' << gauge.second << '\n';
+    }
+}
+
+void MetricsSnapshot::writeJson(std::ostream &stream) const {
+
+    stream << "{\n  \"bucket_bounds_us\": [";
+
+    for (size_t bucket = 0; bucket + 1 < LatencyHistogram::bucket_count; ++bucket) {
+
+        stream << (bucket > 0 ? ", " : "") << LatencyHistogram::getBucketBound(bucket);
+    }
+
+    stream << "],\n  \"traffic\": [";
+
+    for (size_t i = 0; i < this->traffic.size(); ++i) {
+
+        const Traffic &counters = this->traffic[i];
+
+        stream << (i > 0 ? "," : "") << "\n    {\"message_type\": " << static_cast<int>(counters.message_type)
+               << ", \"telegrams_in\": " << counters.telegrams_in
+               << ", \"bytes_in\": " << counters.bytes_in
+               << ", \"telegrams_out\": " << counters.telegrams_out
+               << ", \"bytes_out\": " << counters.bytes_out << "}";
+    }
+
+    stream << "\n  ],\n  \"reply_latency\": {";
+
+    bool first = true;
+
+    for (const auto &reply : this->reply_latency) {
+
+        stream << (first ? "" : ",") << "\n    \"" << static_cast<int>(reply.first) << "\": ";
+        writeJsonHistogram(stream, reply.second);
+        first = false;
+    }
+
+    stream << "\n  },\n  \"commands\": {";
+
+    first = true;
+
+    for (const auto &command : this->command_latency) {
+
+        stream << (first ? "" : ",") << "\n    \"";
+        writeEscaped(stream, command.first);
+        stream << "\": {\"latency\": ";
+        writeJsonHistogram(stream, command.second);
+
+        auto overhead = this->command_client_overhead.find(command.first);
+
+        if (overhead != this->command_client_overhead.end()) {
+
+            stream << ", \"client_overhead\": ";
+            writeJsonHistogram(stream, overhead->second);
+        }
+
+        stream << "}";
+        first = false;
+    }
+
+    stream << "\n  },\n  \"telegram_wait\": ";
+    writeJsonHistogram(stream, this->telegram_wait);
+    stream << ",\n  \"connect\": ";
+    writeJsonHistogram(stream, this->connect);
+
+    stream << ",\n  \"failed_connects\": " << this->failed_connects
+           << ",\n  \"queued_telegrams\": " << this->queued_telegrams
+           << ",\n  \"queued_bytes\": " << this->queued_bytes
+           << ",\n  \"high_water_telegrams\": " << this->high_water_telegrams
+           << ",\n  \"high_water_bytes\": " << this->high_water_bytes
+           << ",\n  \"dropped_telegrams\": " << this->dropped_telegrams
+           << ",\n  \"outstanding_requests\": " << this->outstanding_requests
+           << "\n}\n";
+}
+
+ConnectionMetrics::ConnectionMetrics() :
+    failed_connects(0)
+{
+
+    for (size_t i = 0; i < this->replyLatency.size(); ++i) {
+
+        this->telegrams_in[i] = 0;
+        this->bytes_in[i] = 0;
+        this->telegrams_out[i] = 0;
+        this->bytes_out[i] = 0;
+        this->replyLatency[i] = nullptr;
+    }
+}
+
+ConnectionMetrics::~ConnectionMetrics() {
+
+    for (std::atomic<LatencyHistogram *> &histogram : this->replyLatency) {
+
+        delete histogram.load();
+    }
+}
+
+void ConnectionMetrics::recordTelegramIn(uint8_t message_type, size_t bytes) {
+
+    this->telegrams_in[message_type].fetch_add(1, std::memory_order_relaxed);
+    this->bytes_in[message_type].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ConnectionMetrics::recordTelegramOut(uint8_t message_type, size_t bytes) {
+
+    this->telegrams_out[message_type].fetch_add(1, std::memory_order_relaxed);
+    this->bytes_out[message_type].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ConnectionMetrics::recordReply(uint8_t message_type, std::chrono::steady_clock::duration latency) {
+
+    LatencyHistogram *histogram = this->replyLatency[message_type].load(std::memory_order_acquire);
+
+    if (histogram == nullptr) {
+
+        // Whoever comes second throws its histogram away.
+        LatencyHistogram *newHistogram = new LatencyHistogram();
+
+        if (this->replyLatency[message_type].compare_exchange_strong(histogram, newHistogram, std::memory_order_acq_rel)) {
+
+            histogram = newHistogram;
+
+        } else {
+
+            delete newHistogram;
+        }
+    }
+
+    histogram->record(latency);
+}
+
+void ConnectionMetrics::recordCommand(std::string_view name, std::chrono::steady_clock::duration latency, std::chrono::steady_clock::duration client_overhead) {
+
+    CommandHistograms *histograms;
+
+    {
+        std::lock_guard<std::mutex> lock(this->commandsGuard);
+
+        auto command = this->commands.find(name);
+
+        if (command == this->commands.end()) {
+
+            command = this->commands.emplace(std::string(name), std::make_unique<CommandHistograms>()).first;
+        }
+
+        histograms = command->second.get();
+    }
+
+    histograms->latency.record(latency);
+    histograms->client_overhead.record(client_overhead);
+}
+
+void ConnectionMetrics::recordTelegramWait(std::chrono::steady_clock::duration duration) {
+
+    this->telegramWait.record(duration);
+}
+
+void ConnectionMetrics::recordConnect(std::chrono::steady_clock::duration duration, bool connected) {
+
+    if (connected) {
+
+        this->connect.record(duration);
+
+    } else {
+
+        this->failed_connects++;
+    }
+}
+
+MetricsSnapshot ConnectionMetrics::getSnapshot() const {
+
+    MetricsSnapshot snapshot;
+
+    for (size_t i = 0; i < this->replyLatency.size(); ++i) {
+
+        MetricsSnapshot::Traffic counters;
+
+        counters.message_type = static_cast<uint8_t>(i);
+        counters.telegrams_in = this->telegrams_in[i].load(std::memory_order_relaxed);
+        counters.bytes_in = this->bytes_in[i].load(std::memory_order_relaxed);
+        counters.telegrams_out = this->telegrams_out[i].load(std::memory_order_relaxed);
+        counters.bytes_out = this->bytes_out[i].load(std::memory_order_relaxed);
+
+        if (counters.telegrams_in > 0 || counters.telegrams_out > 0) {
+
+            snapshot.traffic.push_back(counters);
+        }
+
+        const LatencyHistogram *histogram = this->replyLatency[i].load(std::memory_order_acquire);
+
+        if (histogram) {
+
+            snapshot.reply_latency[static_cast<uint8_t>(i)] = histogram->getSnapshot();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->commandsGuard);
+
+        for (const auto &command : this->commands) {
+
+            snapshot.command_latency[command.first] = command.second->latency.getSnapshot();
+            snapshot.command_client_overhead[command.first] = command.second->client_overhead.getSnapshot();
+        }
+    }
+
+    snapshot.telegram_wait = this->telegramWait.getSnapshot();
+    snapshot.connect = this->connect.getSnapshot();
+    snapshot.failed_connects = this->failed_connects;
+
+    return snapshot;
+}
+
+void ConnectionMetrics::reset() {
+
+    for (size_t i = 0; i < this->replyLatency.size(); ++i) {
+
+        this->telegrams_in[i] = 0;
+        this->bytes_in[i] = 0;
+        this->telegrams_out[i] = 0;
+        this->bytes_out[i] = 0;
+
+        LatencyHistogram *histogram = this->replyLatency[i].load(std::memory_order_acquire);
+
+        if (histogram) {
+            histogram->reset();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->commandsGuard);
+
+        for (auto &command : this->commands) {
+
+            command.second->latency.reset();
+            command.second->client_overhead.reset();
+        }
+    }
+
+    this->telegramWait.reset();
+    this->connect.reset();
+    this->failed_connects = 0;
+}
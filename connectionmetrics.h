@@ -0,0 +1,207 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CONNECTIONMETRICS_H
+#define CONNECTIONMETRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** Histogram of durations with logarithmic buckets.
+ *
+ * The bucket bounds are powers of two from 1 us to about 16.8 s, longer
+ * durations go into an extra bucket without bound. Recording only increments
+ * atomic counters, so any number of threads can record at the same time
+ * without locking or allocating.
+ */
+class LatencyHistogram
+{
+public:
+
+    static const size_t bucket_count = 26;
+
+    struct Snapshot {
+
+        uint64_t count = 0;
+        uint64_t sum_us = 0;
+        uint64_t max_us = 0;
+
+        /** The number of durations per bucket, not cumulative. */
+        std::array<uint64_t, bucket_count> buckets = {};
+
+        /** Estimates a percentile from the buckets.
+         *
+         * \param [in] fraction e.g. 0.99 for the 99th percentile.
+         * \returns the upper bound of the bucket holding the percentile, at most the maximum.
+         */
+        double getPercentile(double fraction) const;
+    };
+
+    LatencyHistogram();
+
+    /** The upper bound of the bucket in microseconds. The last bucket has none and returns 0. */
+    static uint64_t getBucketBound(size_t bucket);
+
+    void record(std::chrono::steady_clock::duration duration);
+
+    Snapshot getSnapshot() const;
+
+    void reset();
+
+protected:
+
+    std::array<std::atomic<uint64_t>, bucket_count> buckets;
+    std::atomic<uint64_t> sum_us;
+    std::atomic<uint64_t> max_us;
+};
+
+/** A consistent enough copy of all metrics of a connection, which can be exported.
+ *
+ * The values are read one by one while the connection keeps running, so
+ * counters which belong together may differ by the telegrams in flight.
+ */
+struct MetricsSnapshot
+{
+    struct Traffic {
+
+        uint8_t message_type = 0;
+        uint64_t telegrams_in = 0;
+        uint64_t bytes_in = 0;
+        uint64_t telegrams_out = 0;
+        uint64_t bytes_out = 0;
+    };
+
+    /** The message types which have seen any traffic. */
+    std::vector<Traffic> traffic;
+
+    /** From sending a request to the arrival of its reply at the socket, per message type. */
+    std::map<uint8_t, LatencyHistogram::Snapshot> reply_latency;
+
+    /** From calling a command until the result is back at the caller, by command name. */
+    std::map<std::string, LatencyHistogram::Snapshot> command_latency;
+
+    /** From the arrival of the reply at the socket until it is back at the caller, by command name.
+     *
+     * The rest of the command latency is spent on the wire and in the instrument.
+     */
+    std::map<std::string, LatencyHistogram::Snapshot> command_client_overhead;
+
+    /** The time spent in waitForTelegram(). */
+    LatencyHistogram::Snapshot telegram_wait;
+
+    /** The duration of the successful connectToTerm() calls. */
+    LatencyHistogram::Snapshot connect;
+    uint64_t failed_connects = 0;
+
+    size_t queued_telegrams = 0;
+    size_t queued_bytes = 0;
+    size_t high_water_telegrams = 0;
+    size_t high_water_bytes = 0;
+    uint64_t dropped_telegrams = 0;
+    size_t outstanding_requests = 0;
+
+    /** Writes the metrics in the Prometheus text exposition format.
+     *
+     * \param [in] stream the output.
+     * \param [in] labels added to every sample, e.g. instrument="zennium". Needed
+     *             to tell the connections apart if several are exported together.
+     * \param [in] with_type_comments false for all but the first connection written into the same exposition.
+     */
+    void writePrometheus(std::ostream &stream, const std::string &labels = std::string(), bool with_type_comments = true) const;
+
+    void writeJson(std::ostream &stream) const;
+};
+
+/** The counters and histograms of one connection.
+ *
+ * Kept up to date by ThalesRemoteConnection and ThalesRemoteScriptWrapper.
+ * Everything may be recorded from any thread.
+ */
+class ConnectionMetrics
+{
+public:
+
+    ConnectionMetrics();
+    ~ConnectionMetrics();
+
+    ConnectionMetrics(const ConnectionMetrics &) = delete;
+    ConnectionMetrics &operator=(const ConnectionMetrics &) = delete;
+
+    void recordTelegramIn(uint8_t message_type, size_t bytes);
+    void recordTelegramOut(uint8_t message_type, size_t bytes);
+
+    void recordReply(uint8_t message_type, std::chrono::steady_clock::duration latency);
+
+    /** Records a command of the Remote Script wrapper.
+     *
+     * \param [in] name the name of the command, e.g. "IMPEDANCE" or "Pset".
+     * \param [in] latency from calling the command until the result was back.
+     * \param [in] client_overhead the part of the latency after the reply had arrived at the socket.
+     */
+    void recordCommand(std::string_view name, std::chrono::steady_clock::duration latency, std::chrono::steady_clock::duration client_overhead);
+
+    void recordTelegramWait(std::chrono::steady_clock::duration duration);
+    void recordConnect(std::chrono::steady_clock::duration duration, bool connected);
+
+    /** Copies the metrics. The queue values are left to the connection. */
+    MetricsSnapshot getSnapshot() const;
+
+    void reset();
+
+protected:
+
+    struct CommandHistograms {
+        LatencyHistogram latency;
+        LatencyHistogram client_overhead;
+    };
+
+    std::array<std::atomic<uint64_t>, 256> telegrams_in;
+    std::array<std::atomic<uint64_t>, 256> bytes_in;
+    std::array<std::atomic<uint64_t>, 256> telegrams_out;
+    std::array<std::atomic<uint64_t>, 256> bytes_out;
+
+    /** Created on the first reply of a message type, never removed. */
+    std::array<std::atomic<LatencyHistogram *>, 256> replyLatency;
+
+    /** Lookups by string_view don't allocate, only the first command of a name does. */
+    mutable std::mutex commandsGuard;
+    std::map<std::string, std::unique_ptr<CommandHistograms>, std::less<> > commands;
+
+    LatencyHistogram telegramWait;
+    LatencyHistogram connect;
+    std::atomic<uint64_t> failed_connects;
+};
+
+#endif // CONNECTIONMETRICS_H
@@ -0,0 +1,375 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fixedrateacquisition.h"
+
+#include <algorithm>
+
+FixedRateAcquisition::FixedRateAcquisition(ThalesRemoteScriptWrapper &remoteScript, size_t buffer_capacity) :
+    remoteScript(remoteScript),
+    rate(0),
+    quantity(ACQUIRE_POTENTIAL),
+    max_samples_in_flight(4),
+    pendingSamples(4),
+    samples_in_flight(0),
+    samples(std::max<size_t>(buffer_capacity, 1)),
+    samples_head(0),
+    samples_tail(0),
+    drain_waiting_for(0),
+    running(false),
+    requested_samples(0),
+    acquired_samples(0),
+    failed_samples(0),
+    missed_deadlines(0),
+    dropped_samples(0),
+    jitter_sum_ns(0),
+    max_jitter_ns(0),
+    round_trip_sum_ns(0)
+{
+
+}
+
+FixedRateAcquisition::~FixedRateAcquisition() {
+
+    this->stop();
+}
+
+void FixedRateAcquisition::setRate(double samples_per_second) {
+
+    this->rate = samples_per_second;
+}
+
+void FixedRateAcquisition::setQuantity(Quantity quantity) {
+
+    this->quantity = quantity;
+}
+
+void FixedRateAcquisition::setMaxSamplesInFlight(size_t samples_in_flight) {
+
+    this->max_samples_in_flight = std::max<size_t>(samples_in_flight, 1);
+    this->pendingSamples.resize(this->max_samples_in_flight);
+}
+
+bool FixedRateAcquisition::start() {
+
+    if (this->running || this->rate <= 0) {
+
+        return false;
+    }
+
+    ThalesRemoteScriptWrapper::CommandBatch batch;
+
+    if (this->quantity != ACQUIRE_CURRENT) {
+        batch.query<ThalesRemoteCommands::Potential>();
+    }
+
+    if (this->quantity != ACQUIRE_POTENTIAL) {
+        batch.query<ThalesRemoteCommands::Current>();
+    }
+
+    this->request = "1:" + batch.getCommands() + ":";
+
+    // Samples which were not drained from the last run are kept.
+    this->requested_samples = 0;
+    this->acquired_samples = 0;
+    this->failed_samples = 0;
+    this->missed_deadlines = 0;
+    this->dropped_samples = 0;
+    this->jitter_sum_ns = 0;
+    this->max_jitter_ns = 0;
+    this->round_trip_sum_ns = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(this->schedulerGuard);
+
+        this->start_time = std::chrono::steady_clock::now();
+        this->running = true;
+    }
+
+    this->schedulerThread = std::thread(&FixedRateAcquisition::schedulerJob, this);
+
+    return true;
+}
+
+void FixedRateAcquisition::stop() {
+
+    if (this->schedulerThread.joinable() == false) {
+
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(this->schedulerGuard);
+
+    this->running = false;
+    this->stop_time = std::chrono::steady_clock::now();
+
+    lock.unlock();
+
+    this->schedulerWakeup.notify_all();
+    this->samplesAvailable.notify_all();
+    this->schedulerThread.join();
+
+    // The callbacks of the samples in flight use this object.
+    lock.lock();
+
+    this->sampleAnswered.wait(lock, [this]() {
+        return this->samples_in_flight == 0;
+    });
+}
+
+bool FixedRateAcquisition::isRunning() const {
+
+    return this->running;
+}
+
+size_t FixedRateAcquisition::drain(Sample *samples, size_t max_samples, std::chrono::milliseconds timeout) {
+
+    std::lock_guard<std::mutex> drainLock(this->drainGuard);
+
+    size_t head = this->samples_head.load(std::memory_order_relaxed);
+
+    if (this->samples_tail - head < max_samples && timeout.count() > 0) {
+
+        std::unique_lock<std::mutex> lock(this->schedulerGuard);
+
+        this->drain_waiting_for = max_samples;
+
+        this->samplesAvailable.wait_for(lock, timeout, [this, head, max_samples]() {
+            return this->samples_tail - head >= max_samples || this->running == false;
+        });
+
+        this->drain_waiting_for = 0;
+    }
+
+    size_t count = std::min(this->samples_tail.load(std::memory_order_acquire) - head, max_samples);
+
+    for (size_t i = 0; i < count; ++i) {
+
+        samples[i] = this->samples[(head + i) % this->samples.size()];
+    }
+
+    this->samples_head.store(head + count, std::memory_order_release);
+
+    return count;
+}
+
+size_t FixedRateAcquisition::getAvailableSamples() const {
+
+    return this->samples_tail.load(std::memory_order_acquire) - this->samples_head.load(std::memory_order_acquire);
+}
+
+FixedRateAcquisition::Statistics FixedRateAcquisition::getStatistics() const {
+
+    Statistics statistics;
+
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(this->schedulerGuard);
+
+        start_time = this->start_time;
+
+        if (this->running == false) {
+            end_time = this->stop_time;
+        }
+    }
+
+    statistics.target_rate = this->rate;
+    statistics.requested_samples = this->requested_samples;
+    statistics.acquired_samples = this->acquired_samples;
+    statistics.failed_samples = this->failed_samples;
+    statistics.missed_deadlines = this->missed_deadlines;
+    statistics.dropped_samples = this->dropped_samples;
+
+    double elapsed_seconds = std::chrono::duration<double>(end_time - start_time).count();
+
+    if (elapsed_seconds > 0) {
+        statistics.achieved_rate = static_cast<double>(statistics.acquired_samples) / elapsed_seconds;
+    }
+
+    if (statistics.requested_samples > 0) {
+        statistics.mean_jitter = std::chrono::nanoseconds(this->jitter_sum_ns / static_cast<int64_t>(statistics.requested_samples));
+    }
+
+    statistics.max_jitter = std::chrono::nanoseconds(this->max_jitter_ns);
+
+    uint64_t answered_samples = statistics.acquired_samples + statistics.failed_samples;
+
+    if (answered_samples > 0) {
+        statistics.mean_round_trip = std::chrono::nanoseconds(this->round_trip_sum_ns / static_cast<int64_t>(answered_samples));
+    }
+
+    return statistics;
+}
+
+void FixedRateAcquisition::schedulerJob() {
+
+    const std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / this->rate));
+
+    // Waking up from a sleep takes up to some 100 us, the rest is waited by yielding.
+    const std::chrono::microseconds wakeup_time(200);
+
+    uint64_t sequence = 0;
+    uint64_t slot = 0;
+
+    std::unique_lock<std::mutex> lock(this->schedulerGuard);
+
+    while (this->running) {
+
+        // The deadlines are computed from the start, so the errors don't add up.
+        const std::chrono::steady_clock::time_point deadline = this->start_time + period * sequence;
+
+        if (deadline - std::chrono::steady_clock::now() > wakeup_time) {
+
+            this->schedulerWakeup.wait_until(lock, deadline - wakeup_time, [this]() { return this->running == false; });
+            continue;
+        }
+
+        lock.unlock();
+
+        while (std::chrono::steady_clock::now() < deadline) {
+
+            std::this_thread::yield();
+        }
+
+        std::chrono::steady_clock::duration lateness = std::chrono::steady_clock::now() - deadline;
+
+        if (lateness >= period) {
+
+            // Woke up too late, the deadlines which have passed are skipped.
+            uint64_t passed_deadlines = static_cast<uint64_t>(lateness / period);
+
+            this->missed_deadlines += passed_deadlines;
+            sequence += passed_deadlines;
+
+        } else if (this->samples_in_flight >= this->max_samples_in_flight) {
+
+            // The instrument is too slow for the rate.
+            this->missed_deadlines++;
+            sequence++;
+
+        } else {
+
+            this->requestSample(sequence++, slot++, deadline);
+        }
+
+        lock.lock();
+    }
+}
+
+void FixedRateAcquisition::requestSample(uint64_t sequence, uint64_t slot, std::chrono::steady_clock::time_point scheduled_time) {
+
+    PendingSample &pending = this->pendingSamples[slot % this->pendingSamples.size()];
+
+    pending.sequence = sequence;
+    pending.scheduled_time = scheduled_time;
+    pending.request_time = std::chrono::steady_clock::now();
+
+    int64_t jitter = std::chrono::duration_cast<std::chrono::nanoseconds>(pending.request_time - scheduled_time).count();
+
+    this->jitter_sum_ns += jitter;
+
+    if (jitter > this->max_jitter_ns) {
+        this->max_jitter_ns = jitter;
+    }
+
+    this->samples_in_flight++;
+    this->requested_samples++;
+
+    // Only two words are captured, so std::function does not allocate.
+    this->remoteScript.remoteConnection->sendTelegramAndExpectReply(this->request, 2, [this, slot](TelegramBuffer &&reply) {
+        this->storeSample(slot, std::move(reply));
+    });
+}
+
+void FixedRateAcquisition::storeSample(uint64_t slot, TelegramBuffer &&reply) {
+
+    const PendingSample &pending = this->pendingSamples[slot % this->pendingSamples.size()];
+
+    Sample sample;
+
+    sample.sequence = pending.sequence;
+    sample.scheduled_time = pending.scheduled_time;
+    sample.request_time = pending.request_time;
+    sample.reply_time = reply.empty() ? std::chrono::steady_clock::now() : reply.getReceiveTime();
+
+    std::string_view replyString(reinterpret_cast<const char *>(reply.data()), reply.size());
+
+    if (this->quantity != ACQUIRE_CURRENT) {
+        sample.potential = ThalesRemoteScriptWrapper::parse<ThalesRemoteCommands::Potential>(replyString);
+    }
+
+    if (this->quantity != ACQUIRE_POTENTIAL) {
+        sample.current = ThalesRemoteScriptWrapper::parse<ThalesRemoteCommands::Current>(replyString);
+    }
+
+    if ((this->quantity != ACQUIRE_CURRENT && std::isnan(sample.potential)) || (this->quantity != ACQUIRE_POTENTIAL && std::isnan(sample.current))) {
+
+        this->failed_samples++;
+
+    } else {
+
+        this->acquired_samples++;
+    }
+
+    this->round_trip_sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(sample.reply_time - sample.request_time).count();
+
+    // A failed send completes the sample on the scheduler thread, so the producers are serialized too.
+    {
+        std::lock_guard<std::mutex> lock(this->storeGuard);
+
+        size_t tail = this->samples_tail.load(std::memory_order_relaxed);
+
+        if (tail - this->samples_head.load(std::memory_order_acquire) < this->samples.size()) {
+
+            this->samples[tail % this->samples.size()] = sample;
+            this->samples_tail.store(tail + 1);
+
+        } else {
+
+            this->dropped_samples++;
+        }
+    }
+
+    size_t waiting_for = this->drain_waiting_for;
+
+    if (waiting_for > 0 && this->samples_tail - this->samples_head >= waiting_for) {
+
+        std::lock_guard<std::mutex> lock(this->schedulerGuard);
+        this->samplesAvailable.notify_all();
+    }
+
+    // stop() may destroy the object once it sees no sample in flight, which
+    // it can only after the lock is released, so nothing follows the unlock.
+    std::lock_guard<std::mutex> lock(this->schedulerGuard);
+
+    this->samples_in_flight--;
+
+    if (this->running == false) {
+        this->sampleAnswered.notify_all();
+    }
+}
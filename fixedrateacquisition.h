@@ -0,0 +1,247 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FIXEDRATEACQUISITION_H
+#define FIXEDRATEACQUISITION_H
+
+#include <vector>
+#include <cmath>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "thalesremotescriptwrapper.h"
+
+/** Samples potential and/or current at a fixed rate.
+ *
+ * A scheduler thread sends one query per sample period. The deadlines lie on
+ * a fixed grid from the start, so a late sample does not shift the following
+ * ones and the rate does not drift. The scheduler sleeps until shortly before
+ * the deadline and yields for the rest, which keeps the requests within a few
+ * microseconds of the grid. A deadline which can't be kept because the
+ * scheduler woke up a whole period late, or because too many samples are
+ * still waiting for their reply, is skipped and counted as missed.
+ *
+ * The replies are parsed on the receiving thread and the samples go into a
+ * ring buffer which is allocated by the constructor, so acquiring does not
+ * allocate. The consumer drains the samples in batches.
+ *
+ * \code
+ * FixedRateAcquisition acquisition(remoteScript);
+ * acquisition.setRate(100);
+ * acquisition.start();
+ *
+ * std::vector<FixedRateAcquisition::Sample> samples(256);
+ *
+ * while (running) {
+ *     size_t count = acquisition.drain(samples.data(), samples.size(), std::chrono::milliseconds(100));
+ *     ...
+ * }
+ *
+ * acquisition.stop();
+ * \endcode
+ */
+class FixedRateAcquisition
+{
+public:
+
+    enum Quantity {
+        ACQUIRE_POTENTIAL,
+        ACQUIRE_CURRENT,
+        ACQUIRE_POTENTIAL_AND_CURRENT
+    };
+
+    struct Sample {
+
+        /** Counts the deadlines from the start, gaps are missed deadlines. */
+        uint64_t sequence = 0;
+
+        /** The deadline of the sample on the grid. */
+        std::chrono::steady_clock::time_point scheduled_time;
+
+        /** When the query was handed to the socket. */
+        std::chrono::steady_clock::time_point request_time;
+
+        /** When the reply was taken from the socket. */
+        std::chrono::steady_clock::time_point reply_time;
+
+        /** NaN if not acquired or if the query failed. */
+        double potential = std::nan("1");
+        double current = std::nan("1");
+    };
+
+    struct Statistics {
+
+        double target_rate = 0;
+
+        /** The acquired samples per second since the start. */
+        double achieved_rate = 0;
+
+        uint64_t requested_samples = 0;
+        uint64_t acquired_samples = 0;
+
+        /** Samples whose reply did not contain the values, e.g. because the connection was lost. */
+        uint64_t failed_samples = 0;
+
+        /** Deadlines which were skipped. */
+        uint64_t missed_deadlines = 0;
+
+        /** Samples which were lost because the ring buffer was full. */
+        uint64_t dropped_samples = 0;
+
+        /** How late the queries were sent compared to their deadline. */
+        std::chrono::nanoseconds mean_jitter = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds max_jitter = std::chrono::nanoseconds(0);
+
+        /** From sending the query to the arrival of the reply. */
+        std::chrono::nanoseconds mean_round_trip = std::chrono::nanoseconds(0);
+    };
+
+    /** Constructor. The wrapper has to outlive the acquisition.
+     *
+     * \param [in] remoteScript the instrument, which has to be in Remote Script.
+     * \param [in] buffer_capacity the number of samples the ring buffer holds until they are drained.
+     */
+    FixedRateAcquisition(ThalesRemoteScriptWrapper &remoteScript, size_t buffer_capacity = 4096);
+
+    /** Stops the acquisition. */
+    ~FixedRateAcquisition();
+
+    FixedRateAcquisition(const FixedRateAcquisition &) = delete;
+    FixedRateAcquisition &operator=(const FixedRateAcquisition &) = delete;
+
+    /** Sets the samples per second, only while stopped. */
+    void setRate(double samples_per_second);
+
+    /** Sets what is queried per sample, only while stopped. Both values take one telegram. */
+    void setQuantity(Quantity quantity);
+
+    /** Sets how many samples may wait for their reply before deadlines are skipped, only while stopped. The default is 4. */
+    void setMaxSamplesInFlight(size_t samples_in_flight);
+
+    /** Starts the scheduler thread, the first sample is due right away.
+     *
+     * \returns false if the acquisition is already running or the rate is not set.
+     */
+    bool start();
+
+    /** Stops the scheduler and waits for the replies of the samples in flight. The samples remain to be drained. */
+    void stop();
+
+    bool isRunning() const;
+
+    /** Moves the acquired samples into the array, oldest first.
+     *
+     * Waits until max_samples samples are available or the timeout has
+     * passed, so the consumer wakes up once per batch and not per sample.
+     *
+     * \param [out] samples room for max_samples samples.
+     * \param [in] max_samples the maximal number of samples to take.
+     * \param [in] timeout the maximal time to wait for a full batch, 0 takes what is there.
+     * \returns the number of samples taken.
+     */
+    size_t drain(Sample *samples, size_t max_samples, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    /** The number of samples waiting to be drained. */
+    size_t getAvailableSamples() const;
+
+    Statistics getStatistics() const;
+
+protected:
+
+    /** The deadline and the time the query of a sample in flight was sent. */
+    struct PendingSample {
+        uint64_t sequence;
+        std::chrono::steady_clock::time_point scheduled_time;
+        std::chrono::steady_clock::time_point request_time;
+    };
+
+    void schedulerJob();
+
+    /** Sends the query of the sample.
+     *
+     * \param [in] slot counts the queries sent, so the samples in flight have different slots.
+     */
+    void requestSample(uint64_t sequence, uint64_t slot, std::chrono::steady_clock::time_point scheduled_time);
+
+    /** Called on the receiving thread with the reply to the sample in the slot. */
+    void storeSample(uint64_t slot, TelegramBuffer &&reply);
+
+    ThalesRemoteScriptWrapper &remoteScript;
+
+    double rate;
+    Quantity quantity;
+    size_t max_samples_in_flight;
+
+    /** The telegram sent per sample, put together by start(). */
+    std::string request;
+
+    /** The samples sent but not answered, at their slot modulo their number.
+     *
+     * The replies come in the order of the queries, so the samples in flight
+     * always have the last slots and don't share an entry, even though
+     * skipped deadlines leave gaps in the sequence.
+     */
+    std::vector<PendingSample> pendingSamples;
+    std::atomic<size_t> samples_in_flight;
+
+    /** The ring buffer of the acquired samples, between samples_head and samples_tail. */
+    std::vector<Sample> samples;
+    alignas(64) std::atomic<size_t> samples_head;
+    alignas(64) std::atomic<size_t> samples_tail;
+
+    /** The producers and the consumers are serialized among themselves, so they never wait for each other. */
+    std::mutex storeGuard;
+    std::mutex drainGuard;
+
+    /** Wakes up the scheduler to stop, drain() when a batch is complete and stop() when the last reply arrived. */
+    mutable std::mutex schedulerGuard;
+    std::condition_variable schedulerWakeup;
+    std::condition_variable samplesAvailable;
+    std::condition_variable sampleAnswered;
+    /** The number of samples drain() waits for, 0 if it is not waiting. */
+    std::atomic<size_t> drain_waiting_for;
+
+    std::atomic<bool> running;
+    std::thread schedulerThread;
+
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point stop_time;
+
+    std::atomic<uint64_t> requested_samples;
+    std::atomic<uint64_t> acquired_samples;
+    std::atomic<uint64_t> failed_samples;
+    std::atomic<uint64_t> missed_deadlines;
+    std::atomic<uint64_t> dropped_samples;
+
+    std::atomic<int64_t> jitter_sum_ns;
+    std::atomic<int64_t> max_jitter_ns;
+    std::atomic<int64_t> round_trip_sum_ns;
+};
+
+#endif // FIXEDRATEACQUISITION_H
@@ -0,0 +1,277 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "impedancesweep.h"
+
+ImpedanceSweep::ImpedanceSweep(ThalesRemoteScriptWrapper &remoteScript) :
+    remoteScript(remoteScript),
+    amplitude(10e-3),
+    number_of_periods(1),
+    points_in_flight(2),
+    finished_points(0),
+    stop_requested(false)
+{
+
+}
+
+void ImpedanceSweep::setLogarithmicPlan(double start_frequency, double stop_frequency, size_t number_of_points) {
+
+    this->frequencies.resize(number_of_points);
+
+    double log_start_frequency = std::log(start_frequency);
+    double log_stop_frequency = std::log(stop_frequency);
+
+    double log_interval_spacing = (number_of_points > 1) ? (log_stop_frequency - log_start_frequency) / static_cast<double>(number_of_points - 1) : 0;
+
+    for (size_t i = 0; i < number_of_points; ++i) {
+
+        this->frequencies[i] = std::exp(log_start_frequency + log_interval_spacing * static_cast<double>(i));
+    }
+
+    this->allocateResults();
+}
+
+void ImpedanceSweep::setLinearPlan(double start_frequency, double stop_frequency, size_t number_of_points) {
+
+    this->frequencies.resize(number_of_points);
+
+    double interval_spacing = (number_of_points > 1) ? (stop_frequency - start_frequency) / static_cast<double>(number_of_points - 1) : 0;
+
+    for (size_t i = 0; i < number_of_points; ++i) {
+
+        this->frequencies[i] = start_frequency + interval_spacing * static_cast<double>(i);
+    }
+
+    this->allocateResults();
+}
+
+void ImpedanceSweep::setFrequencies(const std::vector<double> &frequencies) {
+
+    this->frequencies = frequencies;
+
+    this->allocateResults();
+}
+
+void ImpedanceSweep::setAmplitude(double amplitude) {
+
+    this->amplitude = amplitude;
+}
+
+void ImpedanceSweep::setNumberOfPeriods(int number_of_periods) {
+
+    this->number_of_periods = std::min(std::max(number_of_periods, 1), 100);
+}
+
+void ImpedanceSweep::setPointsInFlight(size_t points_in_flight) {
+
+    this->points_in_flight = std::max<size_t>(points_in_flight, 1);
+}
+
+void ImpedanceSweep::setPointCallback(PointCallback callback) {
+
+    this->pointCallback = std::move(callback);
+}
+
+bool ImpedanceSweep::run() {
+
+    const size_t number_of_points = this->frequencies.size();
+
+    std::fill(this->realParts.begin(), this->realParts.end(), std::nan("1"));
+    std::fill(this->imaginaryParts.begin(), this->imaginaryParts.end(), std::nan("1"));
+    std::fill(this->timestamps.begin(), this->timestamps.end(), std::nan("1"));
+    std::fill(this->statuses.begin(), this->statuses.end(), POINT_PENDING);
+
+    this->finished_points = 0;
+    this->stop_requested = false;
+    this->start_time = std::chrono::steady_clock::now();
+
+    // The sweep writes Frq, Ampl and Nw behind the back of the wrapper.
+    this->remoteScript.invalidateSetpointCache();
+
+    size_t requested_points = 0;
+    size_t reported_points = 0;
+
+    std::unique_lock<std::mutex> lock(this->progressGuard);
+
+    while (reported_points < requested_points || (requested_points < number_of_points && this->stop_requested == false)) {
+
+        // Keep the instrument busy.
+        while (requested_points < number_of_points && requested_points - this->finished_points < this->points_in_flight && this->stop_requested == false) {
+
+            lock.unlock();
+            this->requestPoint(requested_points++);
+            lock.lock();
+        }
+
+        if (reported_points == requested_points) {
+
+            // Stopped before anything else was requested.
+            break;
+        }
+
+        this->pointFinished.wait(lock, [this, reported_points]() {
+            return this->finished_points > reported_points;
+        });
+
+        size_t finished_points = this->finished_points;
+
+        lock.unlock();
+
+        // The replies arrive in order, so all points up to here are done.
+        for (; reported_points < finished_points; ++reported_points) {
+
+            if (this->pointCallback) {
+                this->pointCallback(*this, reported_points);
+            }
+        }
+
+        lock.lock();
+    }
+
+    lock.unlock();
+
+    this->remoteScript.invalidateSetpointCache();
+
+    return std::count(this->statuses.begin(), this->statuses.end(), POINT_MEASURED) == static_cast<std::ptrdiff_t>(number_of_points);
+}
+
+void ImpedanceSweep::stop() {
+
+    this->stop_requested = true;
+}
+
+size_t ImpedanceSweep::size() const {
+
+    return this->frequencies.size();
+}
+
+const std::vector<double> &ImpedanceSweep::getFrequencies() const {
+
+    return this->frequencies;
+}
+
+const std::vector<double> &ImpedanceSweep::getRealParts() const {
+
+    return this->realParts;
+}
+
+const std::vector<double> &ImpedanceSweep::getImaginaryParts() const {
+
+    return this->imaginaryParts;
+}
+
+const std::vector<double> &ImpedanceSweep::getTimestamps() const {
+
+    return this->timestamps;
+}
+
+const std::vector<ImpedanceSweep::PointStatus> &ImpedanceSweep::getStatuses() const {
+
+    return this->statuses;
+}
+
+std::complex<double> ImpedanceSweep::getImpedance(size_t index) const {
+
+    return std::complex<double>(this->realParts[index], this->imaginaryParts[index]);
+}
+
+void ImpedanceSweep::allocateResults() {
+
+    this->realParts.assign(this->frequencies.size(), std::nan("1"));
+    this->imaginaryParts.assign(this->frequencies.size(), std::nan("1"));
+    this->timestamps.assign(this->frequencies.size(), std::nan("1"));
+    this->statuses.assign(this->frequencies.size(), POINT_PENDING);
+}
+
+void ImpedanceSweep::requestPoint(size_t index) {
+
+    // The longest request is well below 200 characters, so it is put together on the stack.
+    char request[256];
+    size_t length = 0;
+    bool complete = true;
+
+    auto append = [&request, &length, &complete](std::string_view text) {
+
+        if (text.empty() || text.size() > sizeof(request) - length) {
+
+            complete = false;
+            return;
+        }
+
+        std::copy(text.begin(), text.end(), request + length);
+        length += text.size();
+    };
+
+    char setpoint[64];
+
+    append("1:");
+
+    if (index == 0) {
+
+        append(ThalesRemoteScriptWrapper::formatSetpoint<ThalesRemoteCommands::Amplitude>(setpoint, sizeof(setpoint), this->amplitude));
+        append(":");
+        append(ThalesRemoteScriptWrapper::formatSetpoint<ThalesRemoteCommands::NumberOfPeriods>(setpoint, sizeof(setpoint), this->number_of_periods));
+        append(":");
+    }
+
+    append(ThalesRemoteScriptWrapper::formatSetpoint<ThalesRemoteCommands::Frequency>(setpoint, sizeof(setpoint), this->frequencies[index]));
+    append(":");
+    append(ThalesRemoteCommands::Impedance::query);
+    append(":");
+
+    if (complete == false) {
+
+        this->storeReply(index, TelegramBuffer());
+        return;
+    }
+
+    // Only two pointers are captured, so std::function does not allocate.
+    this->remoteScript.remoteConnection->sendTelegramAndExpectReply(std::string_view(request, length), 2, [this, index](TelegramBuffer &&reply) {
+        this->storeReply(index, std::move(reply));
+    });
+}
+
+void ImpedanceSweep::storeReply(size_t index, TelegramBuffer &&reply) {
+
+    std::complex<double> impedance = ThalesRemoteScriptWrapper::parse<ThalesRemoteCommands::Impedance>(std::string_view(reinterpret_cast<const char *>(reply.data()), reply.size()));
+
+    this->realParts[index] = impedance.real();
+    this->imaginaryParts[index] = impedance.imag();
+
+    if (reply.empty() == false) {
+
+        this->timestamps[index] = std::chrono::duration<double>(reply.getReceiveTime() - this->start_time).count();
+    }
+
+    this->statuses[index] = std::isnan(impedance.real()) ? POINT_FAILED : POINT_MEASURED;
+
+    // run() may return and the sweep be destroyed as soon as the lock is
+    // released after the last point, so it is notified while locked.
+    std::lock_guard<std::mutex> lock(this->progressGuard);
+
+    this->finished_points++;
+    this->pointFinished.notify_all();
+}
@@ -0,0 +1,171 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef IMPEDANCESWEEP_H
+#define IMPEDANCESWEEP_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <complex>
+
+#include "thalesremotescriptwrapper.h"
+
+/** Measures an impedance spectrum point by point.
+ *
+ * The frequency plan is set up first, which allocates the result buffers for
+ * all points. Running the sweep then sends one telegram per point, the first
+ * one also carries amplitude and number of periods, and writes the results
+ * into the buffers without allocating.
+ *
+ * The results are stored as structure of arrays: the n-th point is found at
+ * index n of getFrequencies(), getRealParts(), getImaginaryParts(),
+ * getTimestamps() and getStatuses().
+ *
+ * \code
+ * ImpedanceSweep sweep(remoteScript);
+ * sweep.setLogarithmicPlan(100e3, 10, 31);
+ * sweep.setAmplitude(10e-3);
+ * sweep.run();
+ * \endcode
+ */
+class ImpedanceSweep
+{
+public:
+
+    enum PointStatus : uint8_t {
+        POINT_PENDING,
+        POINT_MEASURED,
+        POINT_FAILED
+    };
+
+    typedef std::function<void(const ImpedanceSweep &sweep, size_t index)> PointCallback;
+
+    /** Constructor. The wrapper has to outlive the sweep. */
+    ImpedanceSweep(ThalesRemoteScriptWrapper &remoteScript);
+
+    /** Plans logarithmically equidistant frequencies.
+     *
+     * \param [in] start_frequency the frequency of the first point.
+     * \param [in] stop_frequency the frequency of the last point, may be lower than the first one.
+     * \param [in] number_of_points the number of points including start and stop.
+     */
+    void setLogarithmicPlan(double start_frequency, double stop_frequency, size_t number_of_points);
+
+    /** Plans linearly equidistant frequencies.
+     *
+     * \sa setLogarithmicPlan()
+     */
+    void setLinearPlan(double start_frequency, double stop_frequency, size_t number_of_points);
+
+    /** Plans the given frequencies in the given order. */
+    void setFrequencies(const std::vector<double> &frequencies);
+
+    /** The amplitude in Volt or Ampere like ThalesRemoteScriptWrapper::setAmplitude(). */
+    void setAmplitude(double amplitude);
+
+    /** The number of periods to average per point, from 1 to 100. */
+    void setNumberOfPeriods(int number_of_periods);
+
+    /** Sets the number of points which are requested before the previous ones are measured.
+     *
+     * With two points in flight, the next request is already waiting at the
+     * instrument when a point is finished, so the network round trip is not
+     * added to every point. Must be at least 1, the default is 2.
+     */
+    void setPointsInFlight(size_t points_in_flight);
+
+    /** Sets the function which is called for every finished point in order.
+     *
+     * The callback runs on the thread calling run(), the results of the point
+     * can be read from the sweep right away.
+     */
+    void setPointCallback(PointCallback callback);
+
+    /** Runs all planned points.
+     *
+     * \returns true if all points were measured, false if some failed or the sweep was stopped.
+     */
+    bool run();
+
+    /** Stops a running sweep after the points which have already been requested. Thread safe. */
+    void stop();
+
+    /** The number of planned points. */
+    size_t size() const;
+
+    const std::vector<double> &getFrequencies() const;
+    const std::vector<double> &getRealParts() const;
+    const std::vector<double> &getImaginaryParts() const;
+
+    /** The time the reply of each point arrived, in seconds since the start of run(). */
+    const std::vector<double> &getTimestamps() const;
+
+    const std::vector<PointStatus> &getStatuses() const;
+
+    std::complex<double> getImpedance(size_t index) const;
+
+protected:
+
+    /** Resizes the result buffers to the planned frequencies. */
+    void allocateResults();
+
+    /** Sends the request of the point, the reply is stored by storeReply(). */
+    void requestPoint(size_t index);
+
+    /** Called on the receiving thread with the reply to the point. */
+    void storeReply(size_t index, TelegramBuffer &&reply);
+
+    ThalesRemoteScriptWrapper &remoteScript;
+
+    double amplitude;
+    int number_of_periods;
+    size_t points_in_flight;
+
+    PointCallback pointCallback;
+
+    std::vector<double> frequencies;
+    std::vector<double> realParts;
+    std::vector<double> imaginaryParts;
+    std::vector<double> timestamps;
+    std::vector<PointStatus> statuses;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    std::mutex progressGuard;
+    std::condition_variable pointFinished;
+    size_t finished_points;
+
+    std::atomic<bool> stop_requested;
+};
+
+#endif // IMPEDANCESWEEP_H
@@ -0,0 +1,301 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "instrumentpool.h"
+
+#include <cmath>
+#include <iostream>
+
+InstrumentPool::InstrumentPool(std::shared_ptr<TelegramReactor> reactor) :
+    reactor(std::move(reactor)),
+    health_checks_running(false)
+{
+
+}
+
+InstrumentPool::~InstrumentPool() {
+
+    this->stopHealthChecks();
+    this->disconnectAll();
+}
+
+std::string InstrumentPool::addInstrument(std::string host, std::string connectionName, unsigned short port) {
+
+    std::string key = host + ((port != 260) ? ":" + std::to_string(port) : "") + "/" + connectionName;
+
+    std::lock_guard<std::mutex> lock(this->sessionsGuard);
+
+    if (this->sessions.count(key) == 0) {
+
+        std::shared_ptr<Session> session = std::make_shared<Session>();
+
+        session->key = key;
+        session->host = std::move(host);
+        session->connectionName = std::move(connectionName);
+        session->port = port;
+        session->connection.setReactor(this->reactor);
+
+        this->sessions[key] = session;
+    }
+
+    return key;
+}
+
+void InstrumentPool::removeInstrument(const std::string &key) {
+
+    std::shared_ptr<Session> session;
+
+    {
+        std::lock_guard<std::mutex> lock(this->sessionsGuard);
+
+        auto found = this->sessions.find(key);
+
+        if (found == this->sessions.end()) {
+
+            return;
+        }
+
+        session = found->second;
+        this->sessions.erase(found);
+    }
+
+    std::lock_guard<std::mutex> lock(session->busyGuard);
+
+    session->connection.disconnectFromTerm();
+}
+
+std::vector<std::string> InstrumentPool::getInstrumentKeys() {
+
+    std::lock_guard<std::mutex> lock(this->sessionsGuard);
+
+    std::vector<std::string> keys;
+
+    for (const auto &session : this->sessions) {
+
+        keys.push_back(session.first);
+    }
+
+    return keys;
+}
+
+size_t InstrumentPool::connectAll(std::chrono::milliseconds timeout) {
+
+    std::vector< std::future<bool> > connects;
+
+    for (std::shared_ptr<Session> &session : this->getSessions()) {
+
+        connects.push_back(std::async(std::launch::async, [this, session, timeout]() {
+
+            std::lock_guard<std::mutex> lock(session->busyGuard);
+
+            return session->connection.isConnectedToTerm() || this->connectSession(*session, timeout);
+        }));
+    }
+
+    size_t connected = 0;
+
+    for (std::future<bool> &connect : connects) {
+
+        connected += connect.get() ? 1 : 0;
+    }
+
+    return connected;
+}
+
+void InstrumentPool::disconnectAll() {
+
+    for (std::shared_ptr<Session> &session : this->getSessions()) {
+
+        std::lock_guard<std::mutex> lock(session->busyGuard);
+
+        session->connection.disconnectFromTerm();
+    }
+}
+
+size_t InstrumentPool::checkHealth(std::chrono::milliseconds timeout) {
+
+    std::vector< std::future<bool> > checks;
+
+    for (std::shared_ptr<Session> &session : this->getSessions()) {
+
+        checks.push_back(std::async(std::launch::async, [this, session, timeout]() {
+
+            std::unique_lock<std::mutex> lock(session->busyGuard, std::try_to_lock);
+
+            // A running plan shows the instrument is in use, it reports failures itself.
+            if (lock.owns_lock() == false) {
+
+                return true;
+            }
+
+            if (session->connection.isConnectedToTerm()) {
+
+                std::future<double> potential = session->remoteScript.getPotentialAsync();
+
+                if (potential.wait_for(timeout) == std::future_status::ready && std::isnan(potential.get()) == false) {
+
+                    return true;
+                }
+
+                // Disconnecting also completes the unanswered request.
+                session->connection.disconnectFromTerm();
+
+                // Only a session which stopped answering is reconnected, not one which never connected.
+                session->reconnects++;
+            }
+
+            return this->connectSession(*session, timeout);
+        }));
+    }
+
+    size_t healthy = 0;
+
+    for (std::future<bool> &check : checks) {
+
+        healthy += check.get() ? 1 : 0;
+    }
+
+    return healthy;
+}
+
+void InstrumentPool::startHealthChecks(std::chrono::milliseconds interval, std::chrono::milliseconds timeout) {
+
+    this->stopHealthChecks();
+
+    this->health_checks_running = true;
+    this->healthCheckThread = std::thread(&InstrumentPool::healthCheckJob, this, interval, timeout);
+}
+
+void InstrumentPool::stopHealthChecks() {
+
+    if (this->healthCheckThread.joinable() == false) {
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->healthCheckGuard);
+        this->health_checks_running = false;
+    }
+
+    this->healthCheckStop.notify_all();
+    this->healthCheckThread.join();
+}
+
+InstrumentHandle InstrumentPool::getRemoteScript(const std::string &key) {
+
+    std::shared_ptr<Session> session = this->findSession(key);
+
+    if (!session) {
+
+        return InstrumentHandle();
+    }
+
+    std::unique_lock<std::mutex> lock(session->busyGuard);
+
+    return InstrumentHandle(std::shared_ptr<ThalesRemoteScriptWrapper>(session, &session->remoteScript), std::move(lock));
+}
+
+bool InstrumentPool::isConnected(const std::string &key) {
+
+    std::shared_ptr<Session> session = this->findSession(key);
+
+    return session && session->connection.isConnectedToTerm();
+}
+
+unsigned long InstrumentPool::getReconnects(const std::string &key) {
+
+    std::shared_ptr<Session> session = this->findSession(key);
+
+    if (!session) {
+
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(session->busyGuard);
+
+    return session->reconnects;
+}
+
+bool InstrumentPool::connectSession(Session &session, std::chrono::milliseconds timeout) {
+
+    // Term may have closed the last connection, its socket and listener are still around.
+    session.connection.disconnectFromTerm();
+
+    if (session.connection.connectToTerm(session.host, session.connectionName, timeout, session.port) == false) {
+
+        return false;
+    }
+
+    std::future<std::string> reply = session.connection.sendStringAndGetReplyFuture("2,ScriptRemote", 0x80);
+
+    if (reply.wait_for(timeout) != std::future_status::ready || reply.get().empty()) {
+
+        std::cerr << "could not start Remote Script on " << session.key << std::endl;
+        session.connection.disconnectFromTerm();
+        return false;
+    }
+
+    // Thales may have been restarted, the wrapper has to send all setpoints again.
+    session.remoteScript.invalidateSetpointCache();
+
+    return true;
+}
+
+std::vector< std::shared_ptr<InstrumentPool::Session> > InstrumentPool::getSessions() {
+
+    std::lock_guard<std::mutex> lock(this->sessionsGuard);
+
+    std::vector< std::shared_ptr<Session> > sessions;
+
+    for (const auto &session : this->sessions) {
+
+        sessions.push_back(session.second);
+    }
+
+    return sessions;
+}
+
+std::shared_ptr<InstrumentPool::Session> InstrumentPool::findSession(const std::string &key) {
+
+    std::lock_guard<std::mutex> lock(this->sessionsGuard);
+
+    auto found = this->sessions.find(key);
+
+    return (found != this->sessions.end()) ? found->second : nullptr;
+}
+
+void InstrumentPool::healthCheckJob(std::chrono::milliseconds interval, std::chrono::milliseconds timeout) {
+
+    std::unique_lock<std::mutex> lock(this->healthCheckGuard);
+
+    while (this->healthCheckStop.wait_for(lock, interval, [this]() { return this->health_checks_running == false; }) == false) {
+
+        lock.unlock();
+        this->checkHealth(timeout);
+        lock.lock();
+    }
+}
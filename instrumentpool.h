@@ -0,0 +1,289 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef INSTRUMENTPOOL_H
+#define INSTRUMENTPOOL_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <functional>
+#include <exception>
+#include <chrono>
+
+#include "thalesremoteconnection.h"
+#include "thalesremotescriptwrapper.h"
+
+/** The outcome of a measurement plan on one instrument. */
+template<typename T>
+struct InstrumentResult
+{
+    /** True if the plan ran to the end. */
+    bool completed = false;
+
+    T value = T();
+
+    /** Why the plan did not complete, e.g. "not connected" or the message of an exception. */
+    std::string error;
+};
+
+/** The wrapper of one instrument of an InstrumentPool, which has the instrument to itself.
+ *
+ * Plans, connects and health checks leave the instrument alone as long as
+ * the handle exists, so it should not be kept longer than needed.
+ */
+class InstrumentHandle
+{
+public:
+
+    InstrumentHandle() = default;
+
+    InstrumentHandle(std::shared_ptr<ThalesRemoteScriptWrapper> remoteScript, std::unique_lock<std::mutex> lock) :
+        remoteScript(std::move(remoteScript)),
+        lock(std::move(lock))
+    {
+
+    }
+
+    /** False if the instrument is unknown. */
+    explicit operator bool() const {
+
+        return this->remoteScript != nullptr;
+    }
+
+    ThalesRemoteScriptWrapper *operator->() const {
+
+        return this->remoteScript.get();
+    }
+
+    ThalesRemoteScriptWrapper &operator*() const {
+
+        return *this->remoteScript;
+    }
+
+protected:
+
+    /** Shares the ownership of the session, so the guard outlives the lock. */
+    std::shared_ptr<ThalesRemoteScriptWrapper> remoteScript;
+
+    std::unique_lock<std::mutex> lock;
+};
+
+/** Keeps the sessions to many instruments.
+ *
+ * Every instrument gets one ThalesRemoteConnection and one
+ * ThalesRemoteScriptWrapper, which stay the same objects over reconnects.
+ * Outside of plans the wrapper is used through an InstrumentHandle. Connecting,
+ * health checks and measurement plans run on all instruments in parallel.
+ *
+ * \code
+ * InstrumentPool pool;
+ * pool.addInstrument("192.168.2.10");
+ * pool.addInstrument("192.168.2.11");
+ * pool.connectAll();
+ *
+ * auto impedances = pool.runOnAll<std::complex<double>>([](ThalesRemoteScriptWrapper &remoteScript) {
+ *     return remoteScript.getImpedance(1000, 10e-3, 3);
+ * });
+ * \endcode
+ */
+class InstrumentPool
+{
+public:
+
+    /** Constructor.
+     *
+     * \param [in] reactor receives the telegrams of all instruments if set, otherwise every connection uses its own thread.
+     */
+    InstrumentPool(std::shared_ptr<TelegramReactor> reactor = nullptr);
+
+    /** Stops the health checks and disconnects all instruments. */
+    ~InstrumentPool();
+
+    InstrumentPool(const InstrumentPool &) = delete;
+    InstrumentPool &operator=(const InstrumentPool &) = delete;
+
+    /** Adds an instrument, it is connected by connectAll().
+     *
+     * \param [in] host the hostname or ip-address of the host running Term.
+     * \param [in] connectionName the name to register with at Term.
+     * \param [in] port the TCP port Term is listening on.
+     *
+     * \returns the key of the instrument, "host/connectionName" or "host:port/connectionName" for other ports than 260.
+     */
+    std::string addInstrument(std::string host, std::string connectionName = "ScriptRemote", unsigned short port = 260);
+
+    /** Disconnects and forgets the instrument. */
+    void removeInstrument(const std::string &key);
+
+    std::vector<std::string> getInstrumentKeys();
+
+    /** Connects all instruments which are not connected and brings them into Remote Script.
+     *
+     * \param [in] timeout the maximal time for each instrument.
+     * \returns the number of connected instruments.
+     */
+    size_t connectAll(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+
+    void disconnectAll();
+
+    /** Asks every idle instrument for its potential and reconnects the ones which don't answer in time.
+     *
+     * Instruments which are running a plan count as healthy.
+     *
+     * \returns the number of healthy instruments.
+     */
+    size_t checkHealth(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+
+    /** Runs checkHealth() periodically in a background thread, which keeps the sessions warm. */
+    void startHealthChecks(std::chrono::milliseconds interval, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+    void stopHealthChecks();
+
+    /** The wrapper of the instrument, waits until no plan, connect or health check uses the instrument.
+     *
+     * \returns the handle, which is empty if the key is unknown.
+     */
+    InstrumentHandle getRemoteScript(const std::string &key);
+
+    bool isConnected(const std::string &key);
+
+    /** The number of times a health check disconnected the instrument because it stopped answering.
+     *
+     * Attempts to connect an instrument which was not connected don't count.
+     */
+    unsigned long getReconnects(const std::string &key);
+
+    /** Runs the plan on all connected instruments at the same time.
+     *
+     * Every instrument gets its own thread. Health checks leave instruments
+     * alone while a plan runs on them. Exceptions thrown by the plan are
+     * caught and reported in the result of the instrument.
+     *
+     * \param [in] plan the measurement, called with the wrapper of the instrument.
+     * \returns the results by instrument key.
+     */
+    template<typename T>
+    std::map<std::string, InstrumentResult<T> > runOnAll(const std::function<T(ThalesRemoteScriptWrapper &remoteScript)> &plan) {
+
+        std::vector< std::pair<std::string, std::future< InstrumentResult<T> > > > runningPlans;
+
+        for (std::shared_ptr<Session> &session : this->getSessions()) {
+
+            runningPlans.emplace_back(session->key, std::async(std::launch::async, [session, &plan]() {
+                return runOnSession<T>(*session, plan);
+            }));
+        }
+
+        std::map<std::string, InstrumentResult<T> > results;
+
+        for (auto &runningPlan : runningPlans) {
+
+            results[runningPlan.first] = runningPlan.second.get();
+        }
+
+        return results;
+    }
+
+protected:
+
+    struct Session {
+
+        std::string key;
+        std::string host;
+        std::string connectionName;
+        unsigned short port;
+
+        ThalesRemoteConnection connection;
+        ThalesRemoteScriptWrapper remoteScript;
+
+        /** Held while the instrument is in use, by plans, connects and health checks. */
+        std::mutex busyGuard;
+
+        unsigned long reconnects;
+
+        Session() : port(0), remoteScript(&connection), reconnects(0) {}
+    };
+
+    template<typename T>
+    static InstrumentResult<T> runOnSession(Session &session, const std::function<T(ThalesRemoteScriptWrapper &remoteScript)> &plan) {
+
+        InstrumentResult<T> result;
+
+        std::lock_guard<std::mutex> lock(session.busyGuard);
+
+        if (session.connection.isConnectedToTerm() == false) {
+
+            result.error = "not connected";
+            return result;
+        }
+
+        try {
+
+            result.value = plan(session.remoteScript);
+            result.completed = true;
+
+        } catch (const std::exception &exception) {
+
+            result.error = exception.what();
+
+        } catch (...) {
+
+            result.error = "unknown exception";
+        }
+
+        return result;
+    }
+
+    /** Connects the session and brings Thales into Remote Script. busyGuard has to be locked.
+     *
+     * A connection which Term has closed is cleaned up first.
+     */
+    bool connectSession(Session &session, std::chrono::milliseconds timeout);
+
+    /** A copy of the session list, so the pool lock is not held while talking to the instruments. */
+    std::vector< std::shared_ptr<Session> > getSessions();
+
+    std::shared_ptr<Session> findSession(const std::string &key);
+
+    void healthCheckJob(std::chrono::milliseconds interval, std::chrono::milliseconds timeout);
+
+    std::shared_ptr<TelegramReactor> reactor;
+
+    std::mutex sessionsGuard;
+    std::map< std::string, std::shared_ptr<Session> > sessions;
+
+    std::mutex healthCheckGuard;
+    std::condition_variable healthCheckStop;
+    bool health_checks_running;
+    std::thread healthCheckThread;
+};
+
+#endif // INSTRUMENTPOOL_H
@@ -28,6 +28,7 @@
 
 #include "thalesremoteconnection.h"
 #include "thalesremotescriptwrapper.h"
+#include "impedancesweep.h"
 
 
 #define TARGET_HOST "localhost"
@@ -75,19 +76,20 @@ int main(int argc, char *argv[]) {
 
 void spectrum(ThalesRemoteScriptWrapper &scriptHandle, double lower_frequency, double upper_frequency, int number_of_points) {
 
-    double log_lower_frequency = std::log(lower_frequency);
-    double log_upper_frequency = std::log(upper_frequency);
+    ImpedanceSweep sweep(scriptHandle);
 
-    double log_interval_spacing = (log_upper_frequency - log_lower_frequency) / static_cast<double>(number_of_points - 1);
+    // from high to low frequencies
+    sweep.setLogarithmicPlan(upper_frequency, lower_frequency, static_cast<size_t>(number_of_points));
+    sweep.setAmplitude(10e-3);
+    sweep.setNumberOfPeriods(3);
 
-    for (int i = number_of_points - 1; i >= 0; --i) {
+    sweep.setPointCallback([](const ImpedanceSweep &sweep, size_t index) {
 
-        // calculating logarithmic equidistant frequencies
-        double current_frequency = std::exp(log_lower_frequency + log_interval_spacing * static_cast<double>(i));
+        std::cout << "Frequency " << sweep.getFrequencies()[index] << std::endl;
+        printImpedance(sweep.getImpedance(index));
+    });
 
-        std::cout << "Frequency " << current_frequency << std::endl;
-        printImpedance(scriptHandle.getImpedance(current_frequency));
-    }
+    sweep.run();
 }
 
 void printImpedance(std::complex<double> impedance) {
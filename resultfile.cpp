@@ -0,0 +1,603 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "resultfile.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+size_t ResultFile::headerSize(size_t column_count) {
+
+    // magic, version, column count, names, CRC and padding to keep the payloads aligned
+    return sizeof(file_magic) + 4 + 4 + column_count * column_name_length + 4 + 4;
+}
+
+uint32_t ResultFile::crc32(const void *data, size_t length, uint32_t crc) {
+
+    static const struct Table {
+
+        uint32_t entries[256];
+
+        Table() {
+
+            for (uint32_t i = 0; i < 256; ++i) {
+
+                uint32_t entry = i;
+
+                for (int bit = 0; bit < 8; ++bit) {
+                    entry = (entry & 1) ? (entry >> 1) ^ 0xedb88320 : entry >> 1;
+                }
+
+                this->entries[i] = entry;
+            }
+        }
+    } table;
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; ++i) {
+        crc = table.entries[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/** Reads a little endian 32 bit number, the files are always little endian. */
+static uint32_t readUint32(const uint8_t *bytes) {
+
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+static void writeUint32(uint8_t *bytes, uint32_t value) {
+
+    bytes[0] = static_cast<uint8_t>(value);
+    bytes[1] = static_cast<uint8_t>(value >> 8);
+    bytes[2] = static_cast<uint8_t>(value >> 16);
+    bytes[3] = static_cast<uint8_t>(value >> 24);
+}
+
+/** Writes a little endian double, whatever the byte order of the host is. */
+static void writeDouble(uint8_t *bytes, double value) {
+
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    writeUint32(bytes, static_cast<uint32_t>(bits));
+    writeUint32(bytes + 4, static_cast<uint32_t>(bits >> 32));
+}
+
+/** Checks the file header and reads the column names.
+ *
+ * \returns the size of the header or 0 if the header is not valid.
+ */
+static size_t parseHeader(const uint8_t *data, size_t size, std::vector<std::string> &columnNames) {
+
+    if (size < ResultFile::headerSize(0) || std::memcmp(data, ResultFile::file_magic, sizeof(ResultFile::file_magic)) != 0) {
+
+        return 0;
+    }
+
+    uint32_t version = readUint32(data + 8);
+    uint32_t column_count = readUint32(data + 12);
+
+    size_t header_size = ResultFile::headerSize(column_count);
+
+    if (version != ResultFile::version || column_count == 0 || column_count > 0xffff || size < header_size) {
+
+        return 0;
+    }
+
+    size_t crc_offset = header_size - 8;
+
+    if (ResultFile::crc32(data, crc_offset) != readUint32(data + crc_offset)) {
+
+        return 0;
+    }
+
+    columnNames.clear();
+
+    for (uint32_t i = 0; i < column_count; ++i) {
+
+        const char *name = reinterpret_cast<const char *>(data + 16 + i * ResultFile::column_name_length);
+
+        columnNames.emplace_back(name, strnlen(name, ResultFile::column_name_length));
+    }
+
+    return header_size;
+}
+
+/** Checks the block at the given offset.
+ *
+ * \returns the number of rows or -1 if there is no complete block.
+ */
+static int64_t parseBlock(const uint8_t *data, size_t size, size_t offset, size_t column_count) {
+
+    if (size - offset < ResultFile::block_header_size || std::memcmp(data + offset, ResultFile::block_magic, sizeof(ResultFile::block_magic)) != 0) {
+
+        return -1;
+    }
+
+    const uint8_t *header = data + offset;
+
+    if (ResultFile::crc32(header, 12) != readUint32(header + 12)) {
+
+        return -1;
+    }
+
+    uint64_t rows = readUint32(header + 4);
+    uint64_t payload_size = rows * column_count * sizeof(double);
+
+    if (size - offset - ResultFile::block_header_size < payload_size) {
+
+        return -1;
+    }
+
+    if (ResultFile::crc32(header + ResultFile::block_header_size, static_cast<size_t>(payload_size)) != readUint32(header + 8)) {
+
+        return -1;
+    }
+
+    return static_cast<int64_t>(rows);
+}
+
+ResultFileWriter::ResultFileWriter(size_t rows_per_block) :
+    file(nullptr),
+    file_end(0),
+    rows_per_block(std::max<size_t>(rows_per_block, 1)),
+    pending_rows(0),
+    appended_rows(0)
+{
+
+}
+
+ResultFileWriter::~ResultFileWriter() {
+
+    this->close();
+}
+
+bool ResultFileWriter::open(std::string path, std::vector<std::string> columnNames) {
+
+    this->close();
+
+    if (columnNames.empty()) {
+
+        std::cerr << "a result file needs at least one column" << std::endl;
+        return false;
+    }
+
+    for (const std::string &name : columnNames) {
+
+        if (name.size() >= ResultFile::column_name_length) {
+
+            std::cerr << "column name too long: " << name << std::endl;
+            return false;
+        }
+    }
+
+    this->columnNames = std::move(columnNames);
+    this->columns.assign(this->columnNames.size() * this->rows_per_block, 0);
+    this->block.assign(ResultFile::block_header_size + this->columns.size() * sizeof(double), 0);
+    this->pending_rows = 0;
+    this->appended_rows = 0;
+
+    std::error_code error;
+
+    // An empty file is left behind by a crash before the header was written.
+    if (std::filesystem::exists(path, error) && std::filesystem::file_size(path, error) > 0) {
+
+        uint64_t valid_end = findValidEnd(path, this->columnNames);
+
+        if (valid_end == 0) {
+
+            std::cerr << path << " is no result file with the same columns, it is not overwritten" << std::endl;
+            return false;
+        }
+
+        // Continue the existing file, a block which was cut off is dropped.
+        std::filesystem::resize_file(path, valid_end, error);
+
+        if (error) {
+
+            std::cerr << "could not truncate " << path << ": " << error.message() << std::endl;
+            return false;
+        }
+
+        this->file = std::fopen(path.c_str(), "ab");
+        this->path = std::move(path);
+        this->file_end = valid_end;
+
+        return this->file != nullptr;
+    }
+
+    this->file = std::fopen(path.c_str(), "wb");
+
+    if (this->file == nullptr) {
+
+        std::cerr << "could not create " << path << std::endl;
+        return false;
+    }
+
+    this->path = std::move(path);
+    this->file_end = ResultFile::headerSize(this->columnNames.size());
+
+    if (this->writeHeader() == false) {
+
+        this->close();
+        return false;
+    }
+
+    return true;
+}
+
+void ResultFileWriter::close() {
+
+    if (this->file == nullptr) {
+
+        return;
+    }
+
+    this->flush();
+
+    // A block which could not be written may have closed the file already.
+    if (this->file != nullptr) {
+
+        std::fclose(this->file);
+        this->file = nullptr;
+    }
+}
+
+bool ResultFileWriter::isOpen() const {
+
+    return this->file != nullptr;
+}
+
+bool ResultFileWriter::append(const double *values, size_t count) {
+
+    if (this->file == nullptr || count != this->columnNames.size()) {
+
+        return false;
+    }
+
+    // The block is still full if writing it failed before.
+    if (this->pending_rows == this->rows_per_block && this->flush() == false) {
+
+        return false;
+    }
+
+    for (size_t column = 0; column < count; ++column) {
+
+        this->columns[column * this->rows_per_block + this->pending_rows] = values[column];
+    }
+
+    this->pending_rows++;
+    this->appended_rows++;
+
+    if (this->pending_rows == this->rows_per_block) {
+
+        return this->flush();
+    }
+
+    return true;
+}
+
+bool ResultFileWriter::append(std::initializer_list<double> values) {
+
+    return this->append(values.begin(), values.size());
+}
+
+bool ResultFileWriter::flush() {
+
+    if (this->file == nullptr) {
+
+        return false;
+    }
+
+    if (this->pending_rows == 0) {
+
+        return std::fflush(this->file) == 0;
+    }
+
+    uint8_t *header = this->block.data();
+    uint8_t *payload = header + ResultFile::block_header_size;
+
+    size_t payload_size = 0;
+
+    for (size_t column = 0; column < this->columnNames.size(); ++column) {
+
+        const double *values = &this->columns[column * this->rows_per_block];
+
+        for (size_t row = 0; row < this->pending_rows; ++row, payload_size += sizeof(double)) {
+            writeDouble(payload + payload_size, values[row]);
+        }
+    }
+
+    std::memcpy(header, ResultFile::block_magic, sizeof(ResultFile::block_magic));
+    writeUint32(header + 4, static_cast<uint32_t>(this->pending_rows));
+    writeUint32(header + 8, ResultFile::crc32(payload, payload_size));
+    writeUint32(header + 12, ResultFile::crc32(header, 12));
+
+    const size_t block_size = ResultFile::block_header_size + payload_size;
+
+    if (std::fwrite(header, 1, block_size, this->file) != block_size || std::fflush(this->file) != 0) {
+
+        std::cerr << "could not write result block to " << this->path << std::endl;
+        this->discardTornBlock();
+        return false;
+    }
+
+    this->file_end += block_size;
+    this->pending_rows = 0;
+
+    return true;
+}
+
+uint64_t ResultFileWriter::getAppendedRows() const {
+
+    return this->appended_rows;
+}
+
+bool ResultFileWriter::writeHeader() {
+
+    std::vector<uint8_t> header(ResultFile::headerSize(this->columnNames.size()), 0);
+
+    std::memcpy(header.data(), ResultFile::file_magic, sizeof(ResultFile::file_magic));
+    writeUint32(&header[8], ResultFile::version);
+    writeUint32(&header[12], static_cast<uint32_t>(this->columnNames.size()));
+
+    for (size_t i = 0; i < this->columnNames.size(); ++i) {
+
+        std::memcpy(&header[16 + i * ResultFile::column_name_length], this->columnNames[i].data(), this->columnNames[i].size());
+    }
+
+    size_t crc_offset = header.size() - 8;
+
+    writeUint32(&header[crc_offset], ResultFile::crc32(header.data(), crc_offset));
+
+    return std::fwrite(header.data(), 1, header.size(), this->file) == header.size() && std::fflush(this->file) == 0;
+}
+
+bool ResultFileWriter::discardTornBlock() {
+
+    // Closing drops what is left in the buffer of the stream.
+    std::fclose(this->file);
+    this->file = nullptr;
+
+    std::error_code error;
+    std::filesystem::resize_file(this->path, this->file_end, error);
+
+    if (error) {
+
+        std::cerr << "could not truncate " << this->path << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    this->file = std::fopen(this->path.c_str(), "ab");
+
+    return this->file != nullptr;
+}
+
+uint64_t ResultFileWriter::findValidEnd(const std::string &path, const std::vector<std::string> &columnNames) {
+
+    ResultFileReader reader;
+
+    if (reader.open(path) == false || reader.getColumnNames() != columnNames) {
+
+        return 0;
+    }
+
+    uint64_t valid_end = ResultFile::headerSize(columnNames.size());
+
+    for (size_t block = 0; block < reader.getBlockCount(); ++block) {
+
+        valid_end += ResultFile::block_header_size + reader.getRowCount(block) * columnNames.size() * sizeof(double);
+    }
+
+    return valid_end;
+}
+
+ResultFileReader::ResultFileReader() :
+    mapping(nullptr),
+    mapping_size(0),
+#ifdef _WIN32
+    file_handle(INVALID_HANDLE_VALUE),
+    mapping_handle(nullptr),
+#endif
+    row_count(0),
+    truncated_tail(false)
+{
+
+}
+
+ResultFileReader::~ResultFileReader() {
+
+    this->close();
+}
+
+bool ResultFileReader::open(std::string path) {
+
+    this->close();
+
+#ifdef _WIN32
+    this->file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (this->file_handle == INVALID_HANDLE_VALUE) {
+
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+
+    if (GetFileSizeEx(this->file_handle, &file_size) == FALSE || file_size.QuadPart == 0) {
+
+        this->close();
+        return false;
+    }
+
+    this->mapping_handle = CreateFileMappingA(this->file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (this->mapping_handle == nullptr) {
+
+        this->close();
+        return false;
+    }
+
+    this->mapping = static_cast<const uint8_t *>(MapViewOfFile(this->mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    this->mapping_size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int file_descriptor = ::open(path.c_str(), O_RDONLY);
+
+    if (file_descriptor < 0) {
+
+        return false;
+    }
+
+    struct stat file_status;
+
+    if (fstat(file_descriptor, &file_status) != 0 || file_status.st_size == 0) {
+
+        ::close(file_descriptor);
+        return false;
+    }
+
+    void *memory = mmap(nullptr, static_cast<size_t>(file_status.st_size), PROT_READ, MAP_SHARED, file_descriptor, 0);
+
+    // The mapping stays valid without the descriptor.
+    ::close(file_descriptor);
+
+    this->mapping = (memory == MAP_FAILED) ? nullptr : static_cast<const uint8_t *>(memory);
+    this->mapping_size = static_cast<size_t>(file_status.st_size);
+#endif
+
+    if (this->mapping == nullptr) {
+
+        this->close();
+        return false;
+    }
+
+    size_t offset = parseHeader(this->mapping, this->mapping_size, this->columnNames);
+
+    if (offset == 0) {
+
+        this->close();
+        return false;
+    }
+
+    int64_t rows;
+
+    while ((rows = parseBlock(this->mapping, this->mapping_size, offset, this->columnNames.size())) >= 0) {
+
+        this->blocks.push_back({reinterpret_cast<const double *>(this->mapping + offset + ResultFile::block_header_size), static_cast<size_t>(rows)});
+        this->row_count += static_cast<uint64_t>(rows);
+
+        offset += ResultFile::block_header_size + static_cast<size_t>(rows) * this->columnNames.size() * sizeof(double);
+    }
+
+    this->truncated_tail = (offset != this->mapping_size);
+
+    return true;
+}
+
+void ResultFileReader::close() {
+
+#ifdef _WIN32
+    if (this->mapping != nullptr) {
+        UnmapViewOfFile(this->mapping);
+    }
+
+    if (this->mapping_handle != nullptr) {
+        CloseHandle(this->mapping_handle);
+        this->mapping_handle = nullptr;
+    }
+
+    if (this->file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->file_handle);
+        this->file_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (this->mapping != nullptr) {
+        munmap(const_cast<uint8_t *>(this->mapping), this->mapping_size);
+    }
+#endif
+
+    this->mapping = nullptr;
+    this->mapping_size = 0;
+    this->columnNames.clear();
+    this->blocks.clear();
+    this->row_count = 0;
+    this->truncated_tail = false;
+}
+
+const std::vector<std::string> &ResultFileReader::getColumnNames() const {
+
+    return this->columnNames;
+}
+
+int ResultFileReader::getColumnIndex(const std::string &name) const {
+
+    for (size_t i = 0; i < this->columnNames.size(); ++i) {
+
+        if (this->columnNames[i] == name) {
+            return static_cast<int>(i);
+        }
+    }
+
+    return -1;
+}
+
+size_t ResultFileReader::getBlockCount() const {
+
+    return this->blocks.size();
+}
+
+size_t ResultFileReader::getRowCount(size_t block) const {
+
+    return this->blocks[block].rows;
+}
+
+uint64_t ResultFileReader::getRowCount() const {
+
+    return this->row_count;
+}
+
+const double *ResultFileReader::getColumn(size_t block, size_t column) const {
+
+    return this->blocks[block].payload + column * this->blocks[block].rows;
+}
+
+bool ResultFileReader::hasTruncatedTail() const {
+
+    return this->truncated_tail;
+}
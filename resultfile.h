@@ -0,0 +1,229 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RESULTFILE_H
+#define RESULTFILE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <algorithm>
+#include <iostream>
+
+/** Append-only binary file of measured values.
+ *
+ * A result file holds a table of double columns, e.g. time, frequency, real
+ * and imaginary part of the impedance. The rows are written in blocks, every
+ * block stores its rows column by column:
+ *
+ * \code
+ * file header:  "THALESRF" | version (u32) | column count (u32) | column names (32 bytes each) | header CRC-32 (u32) | padding (u32)
+ * block header: "BLCK" | row count (u32) | payload CRC-32 (u32) | header CRC-32 (u32)
+ * payload:      row count doubles of column 0 | ... | row count doubles of the last column
+ * \endcode
+ *
+ * All numbers are little endian and all payloads start 8 byte aligned, so a
+ * reader on a little endian host can use the columns straight from a memory
+ * mapping. A block which
+ * was not written completely, e.g. because the program crashed, fails its
+ * checksum and ends the file for the reader.
+ */
+namespace ResultFile {
+
+    static const char file_magic[8] = {'T', 'H', 'A', 'L', 'E', 'S', 'R', 'F'};
+    static const char block_magic[4] = {'B', 'L', 'C', 'K'};
+    static const uint32_t version = 1;
+    static const size_t column_name_length = 32;
+    static const size_t block_header_size = 16;
+
+    /** The size of the file header for the given number of columns. */
+    size_t headerSize(size_t column_count);
+
+    /** CRC-32 as used by zlib, continued from a previous value. */
+    uint32_t crc32(const void *data, size_t length, uint32_t crc = 0);
+}
+
+/** Writes a result file during an acquisition.
+ *
+ * Rows are collected in memory and written as one block when the block is
+ * full or flush() is called, so appending a row does not allocate or write
+ * to the disk.
+ *
+ * \code
+ * ResultFileWriter writer;
+ * writer.open("spectrum.trf", {"frequency", "impedance_real", "impedance_imaginary"});
+ * writer.append({frequency, impedance.real(), impedance.imag()});
+ * \endcode
+ */
+class ResultFileWriter
+{
+public:
+
+    /** Constructor.
+     *
+     * \param [in] rows_per_block the number of rows which are written at once.
+     */
+    ResultFileWriter(size_t rows_per_block = 4096);
+    ~ResultFileWriter();
+
+    ResultFileWriter(const ResultFileWriter &) = delete;
+    ResultFileWriter &operator=(const ResultFileWriter &) = delete;
+
+    /** Opens the file for appending.
+     *
+     * If the file exists with the same columns, the new rows are appended
+     * after the last complete block. A block which was cut off is removed.
+     * A file which does not exist yet is created. Any other file, e.g. one
+     * with other columns or a damaged header, is left alone and open() fails.
+     *
+     * \param [in] path the file name.
+     * \param [in] columnNames the names of the columns, at most 31 characters each.
+     * \returns true on success.
+     */
+    bool open(std::string path, std::vector<std::string> columnNames);
+
+    /** Writes the pending rows and closes the file. */
+    void close();
+
+    bool isOpen() const;
+
+    /** Appends one row.
+     *
+     * \param [in] values one value per column.
+     * \returns false if the number of values does not match or writing a block failed.
+     */
+    bool append(const double *values, size_t count);
+    bool append(std::initializer_list<double> values);
+
+    /** Writes the pending rows as a block and hands them to the operating system.
+     *
+     * Rows which have been flushed survive a crash of the program. If the block
+     * can't be written, it is cut off the file again and the rows are kept for
+     * the next try, appending fails while the block is full.
+     */
+    bool flush();
+
+    /** The number of rows appended since the file was opened. */
+    uint64_t getAppendedRows() const;
+
+protected:
+
+    bool writeHeader();
+
+    /** Finds the end of the last complete block of an existing file with the same columns.
+     *
+     * \returns the size of the valid part of the file or 0 if the file can't be continued.
+     */
+    static uint64_t findValidEnd(const std::string &path, const std::vector<std::string> &columnNames);
+
+    /** Cuts a block which was written in part off the file and opens it again for appending. */
+    bool discardTornBlock();
+
+    std::FILE *file;
+    std::string path;
+
+    /** The size of the file up to the end of the last block which was written completely. */
+    uint64_t file_end;
+
+    std::vector<std::string> columnNames;
+
+    /** The pending rows, column by column with space for a full block. */
+    std::vector<double> columns;
+
+    /** A block encoded for the file, so it is written with one call. */
+    std::vector<uint8_t> block;
+    size_t rows_per_block;
+    size_t pending_rows;
+
+    uint64_t appended_rows;
+};
+
+/** Reads a result file through a memory mapping.
+ *
+ * The columns are not copied, getColumn() points into the mapping, which is
+ * valid until the reader is closed.
+ */
+class ResultFileReader
+{
+public:
+
+    ResultFileReader();
+    ~ResultFileReader();
+
+    ResultFileReader(const ResultFileReader &) = delete;
+    ResultFileReader &operator=(const ResultFileReader &) = delete;
+
+    /** Maps the file and indexes the complete blocks.
+     *
+     * \returns true on success, false if the file can't be mapped or has no valid header.
+     */
+    bool open(std::string path);
+    void close();
+
+    const std::vector<std::string> &getColumnNames() const;
+
+    /** The index of the named column or -1 if there is no such column. */
+    int getColumnIndex(const std::string &name) const;
+
+    size_t getBlockCount() const;
+
+    /** The number of rows in the block. */
+    size_t getRowCount(size_t block) const;
+
+    /** The number of rows in all blocks. */
+    uint64_t getRowCount() const;
+
+    /** The values of a column in a block, getRowCount(block) values. */
+    const double *getColumn(size_t block, size_t column) const;
+
+    /** True if the file continues after the last valid block, e.g. because a write was cut off. */
+    bool hasTruncatedTail() const;
+
+protected:
+
+    struct Block {
+        const double *payload;
+        size_t rows;
+    };
+
+    const uint8_t *mapping;
+    size_t mapping_size;
+
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+
+    std::vector<std::string> columnNames;
+    std::vector<Block> blocks;
+    uint64_t row_count;
+    bool truncated_tail;
+};
+
+#endif // RESULTFILE_H
@@ -0,0 +1,107 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <charconv>
+
+#include "resultfile.h"
+
+/** Converts a result file to CSV.
+ *
+ * Usage: ResultFileToCsv input [output]
+ *
+ * Without output file the CSV is written to stdout. The values are written
+ * with the shortest representation which converts back to the same double.
+ */
+
+int main(int argc, char *argv[]) {
+
+    if (argc < 2 || argc > 3) {
+
+        std::cerr << "Usage: " << argv[0] << " input [output]" << std::endl;
+        return 1;
+    }
+
+    ResultFileReader reader;
+
+    if (reader.open(argv[1]) == false) {
+
+        std::cerr << "could not read result file " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ofstream outputFile;
+
+    if (argc > 2) {
+
+        outputFile.open(argv[2]);
+
+        if (outputFile.is_open() == false) {
+
+            std::cerr << "could not create " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+
+    std::ostream &output = (argc > 2) ? outputFile : std::cout;
+
+    const std::vector<std::string> &columnNames = reader.getColumnNames();
+
+    for (size_t column = 0; column < columnNames.size(); ++column) {
+
+        output << (column > 0 ? "," : "") << columnNames[column];
+    }
+
+    output << "\n";
+
+    char number[32];
+
+    for (size_t block = 0; block < reader.getBlockCount(); ++block) {
+
+        for (size_t row = 0; row < reader.getRowCount(block); ++row) {
+
+            for (size_t column = 0; column < columnNames.size(); ++column) {
+
+                std::to_chars_result result = std::to_chars(number, number + sizeof(number), reader.getColumn(block, column)[row]);
+
+                output << (column > 0 ? "," : "");
+                output.write(number, result.ptr - number);
+            }
+
+            output << "\n";
+        }
+    }
+
+    output.flush();
+
+    if (reader.hasTruncatedTail()) {
+
+        std::cerr << "warning: the file ends with an incomplete block, which was skipped" << std::endl;
+    }
+
+    return output.good() ? 0 : 1;
+}
@@ -0,0 +1,300 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "telegrambuffer.h"
+
+TelegramBuffer::TelegramBuffer() :
+    message_type(0)
+{
+
+}
+
+TelegramBuffer::~TelegramBuffer() {
+
+    this->reset();
+}
+
+TelegramBuffer::TelegramBuffer(TelegramBuffer &&other) :
+    pool(std::move(other.pool)),
+    storage(std::move(other.storage)),
+    message_type(other.message_type),
+    receive_time(other.receive_time)
+{
+
+}
+
+TelegramBuffer &TelegramBuffer::operator=(TelegramBuffer &&other) {
+
+    if (this != &other) {
+
+        this->reset();
+
+        this->pool = std::move(other.pool);
+        this->storage = std::move(other.storage);
+        this->message_type = other.message_type;
+        this->receive_time = other.receive_time;
+    }
+
+    return *this;
+}
+
+const uint8_t *TelegramBuffer::data() const {
+
+    return this->storage.data();
+}
+
+size_t TelegramBuffer::size() const {
+
+    return this->storage.size();
+}
+
+bool TelegramBuffer::empty() const {
+
+    return this->storage.empty();
+}
+
+uint8_t TelegramBuffer::getMessageType() const {
+
+    return this->message_type;
+}
+
+std::chrono::steady_clock::time_point TelegramBuffer::getReceiveTime() const {
+
+    return this->receive_time;
+}
+
+std::vector<uint8_t> TelegramBuffer::release() {
+
+    std::vector<uint8_t> payload(std::move(this->storage));
+
+    this->storage = std::vector<uint8_t>();
+    this->pool.reset();
+
+    return payload;
+}
+
+void TelegramBuffer::reset() {
+
+    if (this->pool) {
+
+        this->pool->recycle(std::move(this->storage));
+        this->pool.reset();
+    }
+
+    this->storage = std::vector<uint8_t>();
+}
+
+TelegramBufferPool::TelegramBufferPool(size_t preallocated_buffers, size_t buffer_capacity) {
+
+    // Twice the number of buffers so recycling never has to grow the list.
+    this->freeBuffers.reserve(preallocated_buffers * 2);
+
+    for (size_t i = 0; i < preallocated_buffers; ++i) {
+
+        this->freeBuffers.emplace_back();
+        this->freeBuffers.back().reserve(buffer_capacity);
+    }
+}
+
+TelegramBuffer TelegramBufferPool::acquire(const uint8_t *payload, size_t length, uint8_t message_type) {
+
+    TelegramBuffer telegram;
+
+    {
+        std::lock_guard<std::mutex> lock(this->freeBuffersGuard);
+
+        if (this->freeBuffers.empty() == false) {
+
+            telegram.storage = std::move(this->freeBuffers.back());
+            this->freeBuffers.pop_back();
+        }
+    }
+
+    telegram.storage.assign(payload, payload + length);
+    telegram.pool = this->shared_from_this();
+    telegram.message_type = message_type;
+    telegram.receive_time = std::chrono::steady_clock::now();
+
+    return telegram;
+}
+
+void TelegramBufferPool::recycle(std::vector<uint8_t> &&buffer) {
+
+    if (buffer.capacity() == 0) {
+
+        return;
+    }
+
+    buffer.clear();
+
+    std::lock_guard<std::mutex> lock(this->freeBuffersGuard);
+
+    this->freeBuffers.push_back(std::move(buffer));
+}
+
+size_t TelegramBufferPool::getAvailableBuffers() {
+
+    std::lock_guard<std::mutex> lock(this->freeBuffersGuard);
+
+    return this->freeBuffers.size();
+}
+
+TelegramQueue::TelegramQueue(size_t initial_capacity) :
+    ring(std::max<size_t>(initial_capacity, 1)),
+    head(0),
+    count(0)
+{
+
+}
+
+void TelegramQueue::push(TelegramBuffer &&telegram) {
+
+    if (this->count == this->ring.size()) {
+
+        // Unroll the ring into a larger one, the oldest telegram goes first.
+        std::vector<TelegramBuffer> largerRing(this->ring.size() * 2);
+
+        for (size_t i = 0; i < this->count; ++i) {
+
+            largerRing[i] = std::move(this->ring[(this->head + i) % this->ring.size()]);
+        }
+
+        this->ring.swap(largerRing);
+        this->head = 0;
+    }
+
+    this->ring[(this->head + this->count) % this->ring.size()] = std::move(telegram);
+    this->count++;
+}
+
+TelegramBuffer TelegramQueue::pop() {
+
+    TelegramBuffer telegram(std::move(this->ring[this->head]));
+
+    this->head = (this->head + 1) % this->ring.size();
+    this->count--;
+
+    return telegram;
+}
+
+const TelegramBuffer &TelegramQueue::front() const {
+
+    return this->ring[this->head];
+}
+
+bool TelegramQueue::empty() const {
+
+    return this->count == 0;
+}
+
+size_t TelegramQueue::size() const {
+
+    return this->count;
+}
+
+void TelegramQueue::clear() {
+
+    while (this->empty() == false) {
+
+        this->pop();
+    }
+}
+
+TelegramRing::TelegramRing(size_t capacity) :
+    head(0),
+    tail(0)
+{
+
+    size_t slot_count = 1;
+
+    while (slot_count < capacity) {
+
+        slot_count *= 2;
+    }
+
+    this->slots.resize(slot_count);
+    this->mask = slot_count - 1;
+}
+
+bool TelegramRing::tryPush(TelegramBuffer &&telegram) {
+
+    const size_t tail = this->tail.load(std::memory_order_relaxed);
+
+    if (tail - this->head.load(std::memory_order_acquire) == this->slots.size()) {
+
+        return false;
+    }
+
+    this->slots[tail & this->mask] = std::move(telegram);
+    this->tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool TelegramRing::tryPop(TelegramBuffer &telegram) {
+
+    const size_t head = this->head.load(std::memory_order_relaxed);
+
+    if (head == this->tail.load(std::memory_order_acquire)) {
+
+        return false;
+    }
+
+    telegram = std::move(this->slots[head & this->mask]);
+    this->head.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+const TelegramBuffer *TelegramRing::front() const {
+
+    const size_t head = this->head.load(std::memory_order_relaxed);
+
+    if (head == this->tail.load(std::memory_order_acquire)) {
+
+        return nullptr;
+    }
+
+    return &this->slots[head & this->mask];
+}
+
+bool TelegramRing::empty() const {
+
+    return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+}
+
+size_t TelegramRing::size() const {
+
+    // The head first, it never passes the tail.
+    const size_t head = this->head.load(std::memory_order_acquire);
+
+    return this->tail.load(std::memory_order_acquire) - head;
+}
+
+size_t TelegramRing::capacity() const {
+
+    return this->slots.size();
+}
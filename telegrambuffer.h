@@ -0,0 +1,207 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TELEGRAMBUFFER_H
+#define TELEGRAMBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class TelegramBufferPool;
+
+/** Move-only handle of the payload of a received telegram.
+ *
+ * The storage comes from a TelegramBufferPool and is handed back to the pool
+ * as soon as the handle is destroyed or reset, so no memory has to be
+ * allocated for the next telegram.
+ */
+class TelegramBuffer
+{
+public:
+
+    TelegramBuffer();
+    ~TelegramBuffer();
+
+    TelegramBuffer(TelegramBuffer &&other);
+    TelegramBuffer &operator=(TelegramBuffer &&other);
+
+    TelegramBuffer(const TelegramBuffer &) = delete;
+    TelegramBuffer &operator=(const TelegramBuffer &) = delete;
+
+    const uint8_t *data() const;
+    size_t size() const;
+    bool empty() const;
+
+    /** The message type the telegram was received with, e.g. 2 for Remote Script. */
+    uint8_t getMessageType() const;
+
+    /** The point in time the telegram has been taken from the socket. */
+    std::chrono::steady_clock::time_point getReceiveTime() const;
+
+    /** Takes the payload out of the handle.
+     *
+     * The storage is not returned to the pool afterwards. It can be handed
+     * back manually with TelegramBufferPool::recycle().
+     */
+    std::vector<uint8_t> release();
+
+    /** Returns the storage to the pool and leaves an empty handle. */
+    void reset();
+
+protected:
+
+    friend class TelegramBufferPool;
+
+    std::shared_ptr<TelegramBufferPool> pool;
+    std::vector<uint8_t> storage;
+    uint8_t message_type;
+    std::chrono::steady_clock::time_point receive_time;
+};
+
+/** Keeps the storage of telegrams which have been consumed for reuse.
+ *
+ * Buffers keep their capacity when they return to the pool, so once the pool
+ * has seen the largest telegrams of a session taking a buffer does not
+ * allocate anymore. The pool is thread safe.
+ *
+ * Always create it with std::make_shared, the handles keep the pool alive.
+ */
+class TelegramBufferPool : public std::enable_shared_from_this<TelegramBufferPool>
+{
+public:
+
+    /** Constructor.
+     *
+     * \param [in] preallocated_buffers the number of buffers which are allocated up front.
+     * \param [in] buffer_capacity the initial capacity of these buffers in bytes.
+     */
+    TelegramBufferPool(size_t preallocated_buffers = 32, size_t buffer_capacity = 512);
+
+    /** Takes a buffer from the pool and copies the payload into it.
+     *
+     * The receive time of the telegram is set to the current time.
+     */
+    TelegramBuffer acquire(const uint8_t *payload, size_t length, uint8_t message_type);
+
+    /** Hands storage back for reuse, e.g. a vector taken by TelegramBuffer::release(). */
+    void recycle(std::vector<uint8_t> &&buffer);
+
+    /** The number of buffers which are currently waiting for reuse. */
+    size_t getAvailableBuffers();
+
+protected:
+
+    std::mutex freeBuffersGuard;
+    std::vector< std::vector<uint8_t> > freeBuffers;
+};
+
+/** First-in-first-out queue of telegram handles.
+ *
+ * Unlike std::queue the queue is a ring on top of a vector which only grows,
+ * so pushing and popping telegrams does not allocate once the queue has seen
+ * its maximal depth. It is not thread safe.
+ */
+class TelegramQueue
+{
+public:
+
+    TelegramQueue(size_t initial_capacity = 64);
+
+    void push(TelegramBuffer &&telegram);
+
+    /** Moves the oldest telegram out of the queue. The queue must not be empty. */
+    TelegramBuffer pop();
+
+    /** The oldest telegram. The queue must not be empty. */
+    const TelegramBuffer &front() const;
+
+    bool empty() const;
+    size_t size() const;
+
+    void clear();
+
+protected:
+
+    std::vector<TelegramBuffer> ring;
+    size_t head;
+    size_t count;
+};
+
+/** Bounded lock-free first-in-first-out ring of telegram handles.
+ *
+ * Exactly one thread may push and one thread may pop at the same time,
+ * without any lock between them. Several consumers have to serialize their
+ * pops with a mutex of their own. The slots are allocated up front, so the
+ * ring never allocates.
+ */
+class TelegramRing
+{
+public:
+
+    /** Constructor.
+     *
+     * \param [in] capacity the number of slots, rounded up to a power of two.
+     */
+    TelegramRing(size_t capacity = 128);
+
+    /** Appends the telegram. Only called by the producer.
+     *
+     * \returns false if the ring is full, the telegram is left untouched then.
+     */
+    bool tryPush(TelegramBuffer &&telegram);
+
+    /** Moves the oldest telegram out of the ring. Only called by the consumer.
+     *
+     * \returns false if the ring is empty.
+     */
+    bool tryPop(TelegramBuffer &telegram);
+
+    /** The oldest telegram without taking it, or nullptr if the ring is empty. Only called by the consumer. */
+    const TelegramBuffer *front() const;
+
+    bool empty() const;
+    size_t size() const;
+    size_t capacity() const;
+
+protected:
+
+    std::vector<TelegramBuffer> slots;
+    size_t mask;
+
+    /** The indices only grow, the slot is the index masked. Each of them gets
+     * its own cache line, so producer and consumer don't invalidate each other.
+     */
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif // TELEGRAMBUFFER_H
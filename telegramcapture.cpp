@@ -0,0 +1,359 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "telegramcapture.h"
+
+#include <algorithm>
+#include <thread>
+
+static void writeUint16(uint8_t *bytes, uint16_t value) {
+
+    bytes[0] = static_cast<uint8_t>(value);
+    bytes[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static void writeUint32(uint8_t *bytes, uint32_t value) {
+
+    writeUint16(bytes, static_cast<uint16_t>(value));
+    writeUint16(bytes + 2, static_cast<uint16_t>(value >> 16));
+}
+
+static void writeUint64(uint8_t *bytes, uint64_t value) {
+
+    writeUint32(bytes, static_cast<uint32_t>(value));
+    writeUint32(bytes + 4, static_cast<uint32_t>(value >> 32));
+}
+
+static uint16_t readUint16(const uint8_t *bytes) {
+
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+static uint32_t readUint32(const uint8_t *bytes) {
+
+    return static_cast<uint32_t>(readUint16(bytes)) | (static_cast<uint32_t>(readUint16(bytes + 2)) << 16);
+}
+
+static uint64_t readUint64(const uint8_t *bytes) {
+
+    return static_cast<uint64_t>(readUint32(bytes)) | (static_cast<uint64_t>(readUint32(bytes + 4)) << 32);
+}
+
+TelegramCaptureWriter::TelegramCaptureWriter(size_t buffer_size) :
+    file(nullptr),
+    buffer_size(std::max<size_t>(buffer_size, TelegramCapture::record_header_size + 0xffff)),
+    record_count(0)
+{
+
+}
+
+TelegramCaptureWriter::~TelegramCaptureWriter() {
+
+    this->close();
+}
+
+bool TelegramCaptureWriter::open(std::string path) {
+
+    this->close();
+
+    std::lock_guard<std::mutex> lock(this->captureGuard);
+
+    this->file = std::fopen(path.c_str(), "wb");
+
+    if (this->file == nullptr) {
+
+        std::cerr << "could not create " << path << std::endl;
+        return false;
+    }
+
+    this->start_time = std::chrono::steady_clock::now();
+    this->record_count = 0;
+    this->pending.clear();
+    this->pending.reserve(this->buffer_size);
+
+    int64_t wall_clock_start = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    uint8_t header[TelegramCapture::header_size];
+
+    std::memcpy(header, TelegramCapture::file_magic, sizeof(TelegramCapture::file_magic));
+    writeUint32(header + 8, TelegramCapture::version);
+    writeUint32(header + 12, 0);
+    writeUint64(header + 16, static_cast<uint64_t>(wall_clock_start));
+
+    if (std::fwrite(header, 1, sizeof(header), this->file) != sizeof(header)) {
+
+        std::cerr << "could not write the capture header" << std::endl;
+        std::fclose(this->file);
+        this->file = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+void TelegramCaptureWriter::close() {
+
+    std::lock_guard<std::mutex> lock(this->captureGuard);
+
+    if (this->file == nullptr) {
+
+        return;
+    }
+
+    this->writePending();
+
+    std::fclose(this->file);
+    this->file = nullptr;
+}
+
+bool TelegramCaptureWriter::isOpen() const {
+
+    std::lock_guard<std::mutex> lock(this->captureGuard);
+
+    return this->file != nullptr;
+}
+
+bool TelegramCaptureWriter::record(CaptureDirection direction, uint8_t message_type, const uint8_t *payload, size_t length, std::chrono::steady_clock::time_point time) {
+
+    if (length > 0xffff) {
+
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->captureGuard);
+
+    if (this->file == nullptr) {
+
+        return false;
+    }
+
+    if (this->pending.size() + TelegramCapture::record_header_size + length > this->buffer_size && this->writePending() == false) {
+
+        return false;
+    }
+
+    // A telegram which was received just before the capture started is recorded at the start.
+    int64_t timestamp = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time - this->start_time).count(), 0);
+
+    uint8_t header[TelegramCapture::record_header_size];
+
+    header[0] = static_cast<uint8_t>(direction);
+    header[1] = message_type;
+    writeUint16(header + 2, static_cast<uint16_t>(length));
+    writeUint64(header + 4, static_cast<uint64_t>(timestamp));
+
+    this->pending.insert(this->pending.end(), header, header + sizeof(header));
+    this->pending.insert(this->pending.end(), payload, payload + length);
+
+    this->record_count++;
+
+    return true;
+}
+
+bool TelegramCaptureWriter::flush() {
+
+    std::lock_guard<std::mutex> lock(this->captureGuard);
+
+    if (this->file == nullptr || this->writePending() == false) {
+
+        return false;
+    }
+
+    return std::fflush(this->file) == 0;
+}
+
+uint64_t TelegramCaptureWriter::getRecordCount() const {
+
+    std::lock_guard<std::mutex> lock(this->captureGuard);
+
+    return this->record_count;
+}
+
+bool TelegramCaptureWriter::writePending() {
+
+    bool written = (std::fwrite(this->pending.data(), 1, this->pending.size(), this->file) == this->pending.size());
+
+    this->pending.clear();
+
+    if (written == false) {
+
+        std::cerr << "could not write the capture" << std::endl;
+    }
+
+    return written;
+}
+
+TelegramCaptureReader::TelegramCaptureReader() :
+    file(nullptr),
+    truncated_tail(false)
+{
+
+}
+
+TelegramCaptureReader::~TelegramCaptureReader() {
+
+    this->close();
+}
+
+bool TelegramCaptureReader::open(std::string path) {
+
+    this->close();
+
+    this->file = std::fopen(path.c_str(), "rb");
+
+    if (this->file == nullptr) {
+
+        std::cerr << "could not open " << path << std::endl;
+        return false;
+    }
+
+    uint8_t header[TelegramCapture::header_size];
+
+    if (std::fread(header, 1, sizeof(header), this->file) != sizeof(header)
+            || std::memcmp(header, TelegramCapture::file_magic, sizeof(TelegramCapture::file_magic)) != 0
+            || readUint32(header + 8) != TelegramCapture::version) {
+
+        std::cerr << path << " is no telegram capture" << std::endl;
+        this->close();
+        return false;
+    }
+
+    this->start_time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(readUint64(header + 16))));
+    this->truncated_tail = false;
+
+    return true;
+}
+
+void TelegramCaptureReader::close() {
+
+    if (this->file == nullptr) {
+
+        return;
+    }
+
+    std::fclose(this->file);
+    this->file = nullptr;
+}
+
+std::chrono::system_clock::time_point TelegramCaptureReader::getStartTime() const {
+
+    return this->start_time;
+}
+
+bool TelegramCaptureReader::readRecord(CaptureRecord &record) {
+
+    if (this->file == nullptr) {
+
+        return false;
+    }
+
+    uint8_t header[TelegramCapture::record_header_size];
+
+    size_t header_bytes = std::fread(header, 1, sizeof(header), this->file);
+
+    if (header_bytes != sizeof(header)) {
+
+        this->truncated_tail = (header_bytes > 0);
+        return false;
+    }
+
+    record.direction = (header[0] == CAPTURE_FROM_TERM) ? CAPTURE_FROM_TERM : CAPTURE_TO_TERM;
+    record.message_type = header[1];
+    record.timestamp = std::chrono::nanoseconds(static_cast<int64_t>(readUint64(header + 4)));
+    record.payload.resize(readUint16(header + 2));
+
+    if (std::fread(record.payload.data(), 1, record.payload.size(), this->file) != record.payload.size()) {
+
+        this->truncated_tail = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool TelegramCaptureReader::hasTruncatedTail() const {
+
+    return this->truncated_tail;
+}
+
+bool TelegramCaptureReader::readAll(std::string path, std::vector<CaptureRecord> &records) {
+
+    TelegramCaptureReader reader;
+
+    if (reader.open(std::move(path)) == false) {
+
+        return false;
+    }
+
+    records.clear();
+
+    CaptureRecord record;
+
+    while (reader.readRecord(record)) {
+
+        records.push_back(record);
+    }
+
+    return true;
+}
+
+CapturePacer::CapturePacer(double speed) :
+    speed(speed),
+    previous_timestamp(0),
+    previous_time(std::chrono::steady_clock::now())
+{
+
+}
+
+void CapturePacer::waitUntilDue(std::chrono::nanoseconds timestamp) {
+
+    if (this->speed <= 0 || timestamp <= this->previous_timestamp) {
+
+        return;
+    }
+
+    const std::chrono::steady_clock::time_point due = this->previous_time + std::chrono::duration_cast<std::chrono::nanoseconds>((timestamp - this->previous_timestamp) / this->speed);
+
+    // Waking up from a sleep takes up to some 100 us, which would add up over
+    // the short gaps between pipelined telegrams. The rest is waited by yielding.
+    const std::chrono::microseconds wakeup_time(200);
+
+    if (due - std::chrono::steady_clock::now() > wakeup_time) {
+
+        std::this_thread::sleep_until(due - wakeup_time);
+    }
+
+    while (std::chrono::steady_clock::now() < due) {
+
+        std::this_thread::yield();
+    }
+}
+
+void CapturePacer::markReplayed(std::chrono::nanoseconds timestamp) {
+
+    this->previous_timestamp = timestamp;
+    this->previous_time = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,229 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TELEGRAMCAPTURE_H
+#define TELEGRAMCAPTURE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <iostream>
+
+/** Binary file of the telegrams exchanged with Term.
+ *
+ * A capture holds the telegrams of one session in the order they passed the
+ * socket, so the session can be inspected and replayed later:
+ *
+ * \code
+ * file header: "THALESTC" | version (u32) | reserved (u32) | start of the capture in ns since 1970 (u64)
+ * record:      direction (u8) | message type (u8) | payload length (u16) | ns since the start (u64) | payload
+ * \endcode
+ *
+ * All numbers are little endian. The timestamps come from the monotonic
+ * clock, they never go backwards even if the system time is changed. A record
+ * which was not written completely ends the file for the reader.
+ */
+namespace TelegramCapture {
+
+    static const char file_magic[8] = {'T', 'H', 'A', 'L', 'E', 'S', 'T', 'C'};
+    static const uint32_t version = 1;
+    static const size_t header_size = 24;
+    static const size_t record_header_size = 12;
+}
+
+enum CaptureDirection {
+    CAPTURE_TO_TERM = 0,
+    CAPTURE_FROM_TERM = 1
+};
+
+/** One telegram of a capture. */
+struct CaptureRecord
+{
+    CaptureDirection direction = CAPTURE_TO_TERM;
+    uint8_t message_type = 0;
+
+    /** The time since the start of the capture. */
+    std::chrono::nanoseconds timestamp = std::chrono::nanoseconds(0);
+
+    std::vector<uint8_t> payload;
+};
+
+/** Writes the telegrams of a connection into a capture file.
+ *
+ * The records are collected in memory and written in chunks, so recording a
+ * telegram neither allocates nor writes to the disk most of the time. All
+ * methods are thread safe, the sending threads and the listener record at the
+ * same time.
+ *
+ * \code
+ * std::shared_ptr<TelegramCaptureWriter> capture = std::make_shared<TelegramCaptureWriter>();
+ * capture->open("session.ttc");
+ * connection.setCapture(capture);
+ * \endcode
+ */
+class TelegramCaptureWriter
+{
+public:
+
+    /** Constructor.
+     *
+     * \param [in] buffer_size the number of bytes which are collected before they are written.
+     */
+    TelegramCaptureWriter(size_t buffer_size = 256 * 1024);
+    ~TelegramCaptureWriter();
+
+    TelegramCaptureWriter(const TelegramCaptureWriter &) = delete;
+    TelegramCaptureWriter &operator=(const TelegramCaptureWriter &) = delete;
+
+    /** Creates or replaces the file, the timestamps start now.
+     *
+     * \returns true on success.
+     */
+    bool open(std::string path);
+
+    /** Writes the pending records and closes the file. */
+    void close();
+
+    bool isOpen() const;
+
+    /** Appends a telegram.
+     *
+     * \param [in] direction if the telegram was sent to or received from Term.
+     * \param [in] message_type the message type of the telegram.
+     * \param [in] payload the payload without the telegram header.
+     * \param [in] length the length of the payload, at most 0xffff bytes.
+     * \param [in] time when the telegram passed the socket, earlier times are recorded as the start.
+     * \returns false if the file is not open or writing failed.
+     */
+    bool record(CaptureDirection direction, uint8_t message_type, const uint8_t *payload, size_t length, std::chrono::steady_clock::time_point time);
+
+    /** Writes the pending records and hands them to the operating system. */
+    bool flush();
+
+    /** The number of telegrams recorded since the file was opened. */
+    uint64_t getRecordCount() const;
+
+protected:
+
+    bool writePending();
+
+    mutable std::mutex captureGuard;
+
+    std::FILE *file;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    /** The records which have not been written yet. Its capacity is kept. */
+    std::vector<uint8_t> pending;
+    size_t buffer_size;
+
+    /** Guarded by captureGuard like the pending records it counts. */
+    uint64_t record_count;
+};
+
+/** Reads a capture file record by record. */
+class TelegramCaptureReader
+{
+public:
+
+    TelegramCaptureReader();
+    ~TelegramCaptureReader();
+
+    TelegramCaptureReader(const TelegramCaptureReader &) = delete;
+    TelegramCaptureReader &operator=(const TelegramCaptureReader &) = delete;
+
+    /** Opens the file and checks the header.
+     *
+     * \returns true on success, false if the file can't be opened or is no capture.
+     */
+    bool open(std::string path);
+    void close();
+
+    /** The wall clock time when the capture was started. */
+    std::chrono::system_clock::time_point getStartTime() const;
+
+    /** Reads the next record.
+     *
+     * \param [out] record the record, its payload keeps its capacity for the next call.
+     * \returns false at the end of the file.
+     */
+    bool readRecord(CaptureRecord &record);
+
+    /** True if the file ended inside a record, e.g. because the program crashed while capturing. */
+    bool hasTruncatedTail() const;
+
+    /** Reads all records of a file.
+     *
+     * \returns false if the file can't be opened or is no capture.
+     */
+    static bool readAll(std::string path, std::vector<CaptureRecord> &records);
+
+protected:
+
+    std::FILE *file;
+
+    std::chrono::system_clock::time_point start_time;
+    bool truncated_tail;
+};
+
+/** Times the records of a capture during a replay.
+ *
+ * Every record is due after the same distance to the previous record as in
+ * the capture, divided by the speed. The distance is measured from the point
+ * in time the previous record was actually replayed, so a record which is late
+ * does not make the following ones come in a burst. That keeps e.g. the
+ * latency of the instrument or the time the client spent between two
+ * commands.
+ */
+class CapturePacer
+{
+public:
+
+    /** Constructor.
+     *
+     * \param [in] speed 1 for the original speed, 2 for twice as fast, 0 for as fast as possible.
+     */
+    CapturePacer(double speed = 1.0);
+
+    /** Sleeps until the record with the timestamp is due. */
+    void waitUntilDue(std::chrono::nanoseconds timestamp);
+
+    /** Marks that the record with the timestamp has been replayed now, the next records are timed from here. */
+    void markReplayed(std::chrono::nanoseconds timestamp);
+
+protected:
+
+    double speed;
+
+    std::chrono::nanoseconds previous_timestamp;
+    std::chrono::steady_clock::time_point previous_time;
+};
+
+#endif // TELEGRAMCAPTURE_H
@@ -0,0 +1,235 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "telegramreactor.h"
+#include "thalesremoteconnection.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+TelegramReactor::TelegramReactor() :
+    epoll_handle(-1),
+    wakeup_handle(-1),
+    next_key(1),
+    dispatching_connection(nullptr),
+    running(false)
+{
+
+#ifdef __linux__
+    this->epoll_handle = epoll_create1(EPOLL_CLOEXEC);
+    this->wakeup_handle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (this->epoll_handle < 0 || this->wakeup_handle < 0) {
+
+        std::cerr << "could not create the telegram reactor" << std::endl;
+        return;
+    }
+
+    // Key 0 is the wakeup event, the connections start at 1.
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+
+    epoll_ctl(this->epoll_handle, EPOLL_CTL_ADD, this->wakeup_handle, &event);
+
+    this->running = true;
+    this->reactorThread = std::thread(&TelegramReactor::reactorJob, this);
+#endif
+
+}
+
+TelegramReactor::~TelegramReactor() {
+
+#ifdef __linux__
+    if (this->reactorThread.joinable()) {
+
+        {
+            std::lock_guard<std::mutex> lock(this->connectionsGuard);
+            this->running = false;
+        }
+
+        uint64_t wakeup = 1;
+
+        if (write(this->wakeup_handle, &wakeup, sizeof(wakeup)) != sizeof(wakeup)) {
+
+            std::cerr << "could not wake up the telegram reactor" << std::endl;
+        }
+
+        this->reactorThread.join();
+    }
+
+    if (this->wakeup_handle >= 0) {
+        close(this->wakeup_handle);
+    }
+
+    if (this->epoll_handle >= 0) {
+        close(this->epoll_handle);
+    }
+#endif
+
+}
+
+bool TelegramReactor::isSupported() const {
+
+    return this->reactorThread.joinable();
+}
+
+size_t TelegramReactor::getConnectionCount() {
+
+    std::lock_guard<std::mutex> lock(this->connectionsGuard);
+
+    return this->connections.size();
+}
+
+bool TelegramReactor::attach(ThalesRemoteConnection *connection, int socket_handle) {
+
+#ifdef __linux__
+    std::lock_guard<std::mutex> lock(this->connectionsGuard);
+
+    if (this->running == false) {
+
+        return false;
+    }
+
+    uint64_t key = this->next_key++;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u64 = key;
+
+    if (epoll_ctl(this->epoll_handle, EPOLL_CTL_ADD, socket_handle, &event) != 0) {
+
+        return false;
+    }
+
+    this->connections[key] = {connection, socket_handle};
+    this->connectionKeys[connection] = key;
+
+    return true;
+#else
+    (void) connection;
+    (void) socket_handle;
+
+    return false;
+#endif
+
+}
+
+void TelegramReactor::detach(ThalesRemoteConnection *connection) {
+
+    std::unique_lock<std::mutex> lock(this->connectionsGuard);
+
+    auto key = this->connectionKeys.find(connection);
+
+    if (key != this->connectionKeys.end()) {
+
+        this->unregister(key->second);
+    }
+
+    this->dispatchFinished.wait(lock, [this, connection]() {
+        return this->dispatching_connection != connection;
+    });
+}
+
+void TelegramReactor::unregister(uint64_t key) {
+
+    auto registered = this->connections.find(key);
+
+    if (registered == this->connections.end()) {
+
+        return;
+    }
+
+#ifdef __linux__
+    epoll_ctl(this->epoll_handle, EPOLL_CTL_DEL, registered->second.socket_handle, nullptr);
+#endif
+
+    this->connectionKeys.erase(registered->second.connection);
+    this->connections.erase(registered);
+}
+
+void TelegramReactor::reactorJob() {
+
+#ifdef __linux__
+    const int max_events = 64;
+    struct epoll_event events[max_events];
+
+    while (true) {
+
+        int event_count = epoll_wait(this->epoll_handle, events, max_events, -1);
+
+        if (event_count < 0 && errno != EINTR) {
+
+            std::cerr << "telegram reactor failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(this->connectionsGuard);
+
+        if (this->running == false) {
+
+            break;
+        }
+
+        for (int i = 0; i < event_count; ++i) {
+
+            auto registered = this->connections.find(events[i].data.u64);
+
+            // Detached meanwhile, or the wakeup event.
+            if (registered == this->connections.end()) {
+
+                continue;
+            }
+
+            ThalesRemoteConnection *connection = registered->second.connection;
+
+            this->dispatching_connection = connection;
+
+            lock.unlock();
+
+            bool receiving = connection->receiveAvailableTelegrams();
+
+            if (receiving == false) {
+
+                connection->finishReceiving();
+            }
+
+            lock.lock();
+
+            if (receiving == false) {
+
+                this->unregister(events[i].data.u64);
+            }
+
+            this->dispatching_connection = nullptr;
+            this->dispatchFinished.notify_all();
+        }
+    }
+#endif
+
+}
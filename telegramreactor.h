@@ -0,0 +1,115 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TELEGRAMREACTOR_H
+#define TELEGRAMREACTOR_H
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <memory>
+
+class ThalesRemoteConnection;
+
+/** One thread receiving the telegrams of many connections.
+ *
+ * Normally every ThalesRemoteConnection starts its own thread which blocks
+ * in recv. Connections which were given a reactor with
+ * ThalesRemoteConnection::setReactor() instead register their socket here and
+ * a single thread waits for all of them with epoll.
+ *
+ * Telegram handlers and reply callbacks of all these connections run on the
+ * reactor thread, one after the other, so they have to return quickly.
+ *
+ * The reactor is only available on Linux. Elsewhere isSupported() returns
+ * false and the connections fall back to their own threads.
+ */
+class TelegramReactor
+{
+public:
+
+    TelegramReactor();
+    ~TelegramReactor();
+
+    TelegramReactor(const TelegramReactor &) = delete;
+    TelegramReactor &operator=(const TelegramReactor &) = delete;
+
+    /** Checks if the reactor thread is running. */
+    bool isSupported() const;
+
+    /** The number of connections which are currently served. */
+    size_t getConnectionCount();
+
+protected:
+
+    friend class ThalesRemoteConnection;
+
+    /** Starts receiving the telegrams of the connection.
+     *
+     * \returns false if the socket could not be registered.
+     */
+    bool attach(ThalesRemoteConnection *connection, int socket_handle);
+
+    /** Stops serving the connection.
+     *
+     * When the call returns, the reactor thread does not touch the connection
+     * anymore. Must not be called from the reactor thread.
+     */
+    void detach(ThalesRemoteConnection *connection);
+
+    void reactorJob();
+
+    int epoll_handle;
+
+    /** Wakes up the reactor thread for shutting down. */
+    int wakeup_handle;
+
+    std::mutex connectionsGuard;
+    std::condition_variable dispatchFinished;
+
+    struct Registration {
+        ThalesRemoteConnection *connection;
+        int socket_handle;
+    };
+
+    /** Takes the socket out of the epoll set and forgets the connection. connectionsGuard has to be locked. */
+    void unregister(uint64_t key);
+
+    /** The registered connections by the key given to epoll. */
+    std::unordered_map<uint64_t, Registration> connections;
+    std::unordered_map<ThalesRemoteConnection *, uint64_t> connectionKeys;
+    uint64_t next_key;
+
+    /** The connection the reactor thread is receiving for right now. */
+    ThalesRemoteConnection *dispatching_connection;
+
+    bool running;
+    std::thread reactorThread;
+};
+
+#endif // TELEGRAMREACTOR_H
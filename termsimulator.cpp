@@ -0,0 +1,719 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "termsimulator.h"
+
+#ifdef _WIN32
+#define SHUT_RDWR 2
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+TermSimulator::TermSimulator() :
+
+    listen_socket(INVALID_SOCKET),
+    listen_port(0),
+    running(false),
+    acceptWorker(nullptr),
+    reply_latency(0),
+    reply_jitter(0),
+    jitterGenerator(std::random_device()()),
+    series_resistance(10),
+    charge_transfer_resistance(100),
+    capacitance(10e-6),
+    registered_clients(0),
+    replay_speed(1.0),
+    replay_mismatches(0)
+{
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2,2), &wsaData);
+#endif
+
+}
+
+TermSimulator::~TermSimulator() {
+
+    this->stop();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+
+}
+
+bool TermSimulator::start(unsigned short port) {
+
+    if (this->running) {
+
+        return false;
+    }
+
+    this->listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+#ifdef _WIN32
+    if (this->listen_socket == INVALID_SOCKET) {
+#else
+    if (this->listen_socket < 0) {
+#endif
+
+        std::cerr << "simulator: could not create socket" << std::endl;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(this->listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char *>(&reuse), sizeof(reuse));
+
+    struct sockaddr_in address = {};
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (bind(this->listen_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0
+            || listen(this->listen_socket, SOMAXCONN) < 0) {
+
+        std::cerr << "simulator: could not listen on port " << port << std::endl;
+        closeSocket(this->listen_socket);
+        this->listen_socket = INVALID_SOCKET;
+        return false;
+    }
+
+    socklen_t address_length = sizeof(address);
+    getsockname(this->listen_socket, reinterpret_cast<struct sockaddr *>(&address), &address_length);
+    this->listen_port = ntohs(address.sin_port);
+
+    this->running = true;
+    this->acceptWorker = new std::thread(&TermSimulator::acceptJob, this);
+
+    return true;
+}
+
+void TermSimulator::stop() {
+
+    if (this->running == false) {
+
+        return;
+    }
+
+    this->running = false;
+
+    // Makes sure the blocking accept function returns.
+    shutdown(this->listen_socket, SHUT_RDWR);
+    closeSocket(this->listen_socket);
+
+    this->acceptWorker->join();
+    delete this->acceptWorker;
+    this->acceptWorker = nullptr;
+
+    this->listen_socket = INVALID_SOCKET;
+
+    std::vector<std::thread> workers;
+
+    this->connectionsGuard.lock();
+
+    for (SOCKET client_socket : this->connectionSockets) {
+
+        shutdown(client_socket, SHUT_RDWR);
+    }
+
+    workers.swap(this->connectionWorkers);
+    this->finishedWorkers.clear();
+
+    this->connectionsGuard.unlock();
+
+    for (std::thread &worker : workers) {
+
+        worker.join();
+    }
+
+    this->connectionSockets.clear();
+}
+
+bool TermSimulator::isRunning() const {
+
+    return this->running;
+}
+
+unsigned short TermSimulator::getPort() const {
+
+    return this->listen_port;
+}
+
+void TermSimulator::setLatency(std::chrono::microseconds latency, std::chrono::microseconds jitter) {
+
+    std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+    this->reply_latency = latency;
+    this->reply_jitter = jitter;
+}
+
+void TermSimulator::setJitterSeed(unsigned int seed) {
+
+    std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+    this->jitterGenerator.seed(seed);
+}
+
+void TermSimulator::setCellModel(double series_resistance, double charge_transfer_resistance, double capacitance) {
+
+    std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+    this->series_resistance = series_resistance;
+    this->charge_transfer_resistance = charge_transfer_resistance;
+    this->capacitance = capacitance;
+}
+
+unsigned long TermSimulator::getRegisteredClients() const {
+
+    return this->registered_clients;
+}
+
+void TermSimulator::setReplay(std::vector<CaptureRecord> records, double speed) {
+
+    std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+    if (records.empty()) {
+
+        this->replayRecords.reset();
+
+    } else {
+
+        this->replayRecords = std::make_shared<const std::vector<CaptureRecord> >(std::move(records));
+    }
+
+    this->replay_speed = speed;
+    this->replay_mismatches = 0;
+}
+
+unsigned long TermSimulator::getReplayMismatches() const {
+
+    return this->replay_mismatches;
+}
+
+void TermSimulator::acceptJob() {
+
+    while (this->running) {
+
+        SOCKET client_socket = accept(this->listen_socket, nullptr, nullptr);
+
+#ifdef _WIN32
+        if (client_socket == INVALID_SOCKET) {
+#else
+        if (client_socket < 0) {
+#endif
+
+            if (this->running) {
+
+                continue;
+            }
+
+            break;
+        }
+
+        // Replies of pipelined requests go out back to back.
+        int no_delay = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&no_delay), sizeof(no_delay));
+
+        this->joinFinishedConnections();
+
+        std::lock_guard<std::mutex> lock(this->connectionsGuard);
+
+        this->connectionSockets.push_back(client_socket);
+        this->connectionWorkers.emplace_back(&TermSimulator::connectionJob, this, client_socket);
+    }
+}
+
+void TermSimulator::joinFinishedConnections() {
+
+    std::vector<std::thread> finished;
+
+    {
+        std::lock_guard<std::mutex> lock(this->connectionsGuard);
+
+        for (std::thread::id id : this->finishedWorkers) {
+
+            auto worker = std::find_if(this->connectionWorkers.begin(), this->connectionWorkers.end(), [id](const std::thread &thread) {
+                return thread.get_id() == id;
+            });
+
+            if (worker != this->connectionWorkers.end()) {
+
+                finished.push_back(std::move(*worker));
+                this->connectionWorkers.erase(worker);
+            }
+        }
+
+        this->finishedWorkers.clear();
+    }
+
+    // The threads are about to return, so this does not block for long.
+    for (std::thread &worker : finished) {
+
+        worker.join();
+    }
+}
+
+void TermSimulator::connectionJob(SOCKET client_socket) {
+
+    SimulatedInstrument instrument;
+    std::string connectionName;
+
+    DelayedReplies delayedReplies;
+    std::thread replyWriter(&TermSimulator::replyWriterJob, this, client_socket, std::ref(delayedReplies));
+
+    if (this->readRegistration(client_socket, connectionName)) {
+
+        this->registered_clients++;
+
+        std::shared_ptr<const std::vector<CaptureRecord> > replayRecords;
+        double replay_speed;
+
+        {
+            std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+            replayRecords = this->replayRecords;
+            replay_speed = this->replay_speed;
+        }
+
+        size_t replay_position = 0;
+        CapturePacer pacer(replay_speed);
+
+        if (replayRecords) {
+
+            pacer.markReplayed(replayRecords->front().timestamp);
+            this->replayFromTerm(client_socket, *replayRecords, replay_position, pacer);
+        }
+
+        std::vector<char> payload;
+
+        while (this->running) {
+
+            char header_bytes[3];
+
+            if (receiveAll(client_socket, header_bytes, 3) == false) {
+
+                break;
+            }
+
+            uint16_t payload_length;
+            std::memcpy(&payload_length, header_bytes, 2);
+            unsigned char message_type = static_cast<unsigned char>(header_bytes[2]);
+
+            payload.resize(payload_length);
+
+            if (receiveAll(client_socket, payload.data(), payload_length) == false) {
+
+                break;
+            }
+
+            std::string payloadString(payload.data(), payload.size());
+
+            if (message_type == 4 && payloadString == "\xff\xff") {
+
+                // the client is closing the connection
+                break;
+            }
+
+            if (replayRecords && replay_position < replayRecords->size()) {
+
+                const CaptureRecord &expected = (*replayRecords)[replay_position];
+
+                if (expected.message_type != message_type || expected.payload.size() != payload.size()
+                        || std::memcmp(expected.payload.data(), payload.data(), payload.size()) != 0) {
+
+                    this->replay_mismatches++;
+                }
+
+                pacer.markReplayed(expected.timestamp);
+                replay_position++;
+
+                this->replayFromTerm(client_socket, *replayRecords, replay_position, pacer);
+
+            } else if (message_type == 2) {
+
+                this->sendReply(client_socket, delayedReplies, this->processRemoteScript(instrument, payloadString));
+
+            } else {
+
+                // control messages like "2,ScriptRemote" on 0x80 and everything
+                // else is simply mirrored.
+                sendTelegram(client_socket, payloadString, message_type);
+            }
+        }
+    }
+
+    delayedReplies.guard.lock();
+    delayedReplies.closing = true;
+    delayedReplies.guard.unlock();
+
+    delayedReplies.changed.notify_all();
+    replyWriter.join();
+
+    std::lock_guard<std::mutex> lock(this->connectionsGuard);
+
+    // Closed under the lock, so stop() can't shut down the descriptor after it was reused.
+    this->connectionSockets.erase(std::remove(this->connectionSockets.begin(), this->connectionSockets.end(), client_socket), this->connectionSockets.end());
+    this->finishedWorkers.push_back(std::this_thread::get_id());
+
+    closeSocket(client_socket);
+}
+
+bool TermSimulator::readRegistration(SOCKET client_socket, std::string &connectionName) {
+
+    // 2 bytes name length, 2 bytes protocol version, 2 bytes buffer size, 2 internal bytes
+    unsigned char header_bytes[8];
+
+    if (receiveAll(client_socket, reinterpret_cast<char *>(header_bytes), sizeof(header_bytes)) == false) {
+
+        return false;
+    }
+
+    if (header_bytes[2] != 0x02 || header_bytes[3] != 0xd0) {
+
+        std::cerr << "simulator: unknown protocol version in registration packet" << std::endl;
+        return false;
+    }
+
+    uint16_t name_length;
+    std::memcpy(&name_length, header_bytes, 2);
+
+    connectionName.resize(name_length);
+
+    return receiveAll(client_socket, &connectionName[0], name_length);
+}
+
+std::string TermSimulator::processRemoteScript(SimulatedInstrument &instrument, const std::string &payload) {
+
+    // The payload looks like "1:Pset=0:" or "1:Frq=1000:Ampl=10:IMPEDANCE:".
+    // The reply repeats the leading number followed by the results of all
+    // queries, or "ok" if there was nothing to report.
+
+    size_t separator = payload.find(':');
+
+    if (separator == std::string::npos) {
+
+        return "error: malformed command:";
+    }
+
+    std::string reply = payload.substr(0, separator + 1);
+    bool results_added = false;
+
+    size_t command_begin = separator + 1;
+
+    while (command_begin < payload.size()) {
+
+        size_t command_end = payload.find(':', command_begin);
+
+        if (command_end == std::string::npos) {
+
+            command_end = payload.size();
+        }
+
+        if (command_end > command_begin) {
+
+            std::string result = this->processRemoteCommand(instrument, payload.substr(command_begin, command_end - command_begin));
+
+            if (result.empty() == false) {
+
+                reply += result + ":";
+                results_added = true;
+            }
+        }
+
+        command_begin = command_end + 1;
+    }
+
+    if (results_added == false) {
+
+        reply += "ok:";
+    }
+
+    return reply;
+}
+
+std::string TermSimulator::processRemoteCommand(SimulatedInstrument &instrument, const std::string &command) {
+
+    char buffer[128];
+
+    size_t assignment = command.find('=');
+
+    if (assignment == std::string::npos) {
+
+        double total_resistance;
+
+        {
+            std::lock_guard<std::mutex> lock(this->settingsGuard);
+            total_resistance = this->series_resistance + this->charge_transfer_resistance;
+        }
+
+        double potential = 0;
+        double current = 0;
+
+        if (instrument.potentiostat_enabled) {
+
+            if (instrument.galvanostatic) {
+
+                current = instrument.current_setpoint;
+                potential = current * total_resistance;
+
+            } else {
+
+                potential = instrument.potential_setpoint;
+                current = potential / total_resistance;
+            }
+        }
+
+        if (command == "CURRENT") {
+
+            std::snprintf(buffer, sizeof(buffer), "current= %.6eA", current);
+
+        } else if (command == "POTENTIAL") {
+
+            std::snprintf(buffer, sizeof(buffer), "potential= %.6eV", potential);
+
+        } else if (command == "IMPEDANCE") {
+
+            std::complex<double> impedance = this->calculateImpedance(instrument.frequency);
+            std::snprintf(buffer, sizeof(buffer), "impedance= %.6e,%.6e", impedance.real(), impedance.imag());
+
+        } else {
+
+            return "error: unknown command " + command;
+        }
+
+        return std::string(buffer);
+    }
+
+    std::string name = command.substr(0, assignment);
+    double value = std::strtod(command.c_str() + assignment + 1, nullptr);
+
+    if (name == "Pset") {
+
+        instrument.potential_setpoint = value;
+
+    } else if (name == "Cset") {
+
+        instrument.current_setpoint = value;
+
+    } else if (name == "Frq") {
+
+        // Like the instrument, impossible frequencies are rejected and the last one is kept.
+        if ((value > 0) == false) {
+
+            return "error: frequency out of range";
+        }
+
+        instrument.frequency = value;
+
+    } else if (name == "Ampl") {
+
+        instrument.amplitude = value;
+
+    } else if (name == "Nw") {
+
+        instrument.number_of_periods = static_cast<int>(value);
+
+    } else if (name == "Gal") {
+
+        instrument.galvanostatic = (value != 0);
+
+    } else if (name == "Pot") {
+
+        instrument.potentiostat_enabled = (value != 0);
+
+    } else if (name != "GAL") {
+
+        return "error: unknown parameter " + name;
+    }
+
+    return std::string();
+}
+
+std::complex<double> TermSimulator::calculateImpedance(double frequency) {
+
+    std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+    const double omega = 2.0 * 3.14159265358979323846 * frequency;
+    const std::complex<double> parallel_element = this->charge_transfer_resistance / std::complex<double>(1.0, omega * this->charge_transfer_resistance * this->capacitance);
+
+    return this->series_resistance + parallel_element;
+}
+
+void TermSimulator::replayFromTerm(SOCKET client_socket, const std::vector<CaptureRecord> &records, size_t &position, CapturePacer &pacer) {
+
+    while (position < records.size() && records[position].direction == CAPTURE_FROM_TERM) {
+
+        const CaptureRecord &record = records[position];
+
+        pacer.waitUntilDue(record.timestamp);
+
+        sendTelegram(client_socket, std::string(record.payload.begin(), record.payload.end()), record.message_type);
+
+        pacer.markReplayed(record.timestamp);
+        position++;
+    }
+}
+
+void TermSimulator::sendReply(SOCKET client_socket, DelayedReplies &delayedReplies, std::string &&reply) {
+
+    std::chrono::microseconds delay = this->nextReplyDelay();
+
+    std::unique_lock<std::mutex> lock(delayedReplies.guard);
+
+    if (delay.count() == 0 && delayedReplies.replies.empty() && delayedReplies.sending == false) {
+
+        // Nothing is waiting, so the reply can go out right away. The writer
+        // won't send anything meanwhile because only this thread adds replies.
+        lock.unlock();
+        sendTelegram(client_socket, reply, 2);
+        return;
+    }
+
+    std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + delay;
+
+    // replies never overtake each other, like on a real connection
+    if (delayedReplies.replies.empty() == false && due < delayedReplies.replies.back().first) {
+
+        due = delayedReplies.replies.back().first;
+    }
+
+    delayedReplies.replies.emplace_back(due, std::move(reply));
+
+    lock.unlock();
+    delayedReplies.changed.notify_all();
+}
+
+void TermSimulator::replyWriterJob(SOCKET client_socket, DelayedReplies &delayedReplies) {
+
+    std::unique_lock<std::mutex> lock(delayedReplies.guard);
+
+    while (true) {
+
+        delayedReplies.changed.wait(lock, [&delayedReplies]() {
+            return delayedReplies.closing || delayedReplies.replies.empty() == false;
+        });
+
+        if (delayedReplies.replies.empty()) {
+
+            break;
+        }
+
+        std::chrono::steady_clock::time_point due = delayedReplies.replies.front().first;
+
+        if (std::chrono::steady_clock::now() < due && delayedReplies.closing == false) {
+
+            delayedReplies.changed.wait_until(lock, due);
+            continue;
+        }
+
+        std::string reply = std::move(delayedReplies.replies.front().second);
+        delayedReplies.replies.pop_front();
+        delayedReplies.sending = true;
+
+        lock.unlock();
+        sendTelegram(client_socket, reply, 2);
+        lock.lock();
+
+        delayedReplies.sending = false;
+    }
+}
+
+std::chrono::microseconds TermSimulator::nextReplyDelay() {
+
+    std::lock_guard<std::mutex> lock(this->settingsGuard);
+
+    std::chrono::microseconds delay = this->reply_latency;
+
+    if (this->reply_jitter.count() > 0) {
+
+        std::uniform_int_distribution<long long> distribution(0, this->reply_jitter.count());
+        delay += std::chrono::microseconds(distribution(this->jitterGenerator));
+    }
+
+    return delay;
+}
+
+bool TermSimulator::receiveAll(SOCKET socket_handle, char *buffer, size_t length) {
+
+    size_t total_received_bytes = 0;
+
+    while (total_received_bytes < length) {
+
+        auto received_bytes = recv(socket_handle, buffer + total_received_bytes, static_cast<int>(length - total_received_bytes), 0);
+
+        if (received_bytes <= 0) {
+
+            return false;
+        }
+
+        total_received_bytes += static_cast<size_t>(received_bytes);
+    }
+
+    return true;
+}
+
+bool TermSimulator::sendTelegram(SOCKET socket_handle, const std::string &payload, unsigned char message_type) {
+
+    std::string packet;
+    uint16_t payload_length = static_cast<uint16_t>(payload.size());
+
+    packet.reserve(payload.size() + 3);
+
+    packet.push_back(reinterpret_cast<char *>(&payload_length)[0]);
+    packet.push_back(reinterpret_cast<char *>(&payload_length)[1]);
+    packet.push_back(static_cast<char>(message_type));
+    packet += payload;
+
+    size_t total_sent_bytes = 0;
+
+    while (total_sent_bytes < packet.size()) {
+
+        auto sent_bytes = send(socket_handle, packet.data() + total_sent_bytes, static_cast<int>(packet.size() - total_sent_bytes), MSG_NOSIGNAL);
+
+        if (sent_bytes <= 0) {
+
+            return false;
+        }
+
+        total_sent_bytes += static_cast<size_t>(sent_bytes);
+    }
+
+    return true;
+}
+
+void TermSimulator::closeSocket(SOCKET socket_handle) {
+
+#ifdef _WIN32
+    closesocket(socket_handle);
+#else
+    close(socket_handle);
+#endif
+
+}
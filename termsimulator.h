@@ -0,0 +1,216 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TERMSIMULATOR_H
+#define TERMSIMULATOR_H
+
+#include <string>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <complex>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include "thalesremoteconnection.h"
+#include "telegramcapture.h"
+
+/** A stand-in for Term (The Thales Terminal) for loopback testing.
+ *
+ * Listens on a TCP port and speaks the same framing as ThalesRemoteConnection:
+ * the registration packet sent by connectToTerm, telegrams consisting of a
+ * 2 byte length, 1 byte message type and the payload, and the 0xffff
+ * disconnect message on "channel" 4.
+ *
+ * Remote Script telegrams (message type 2) are answered like Thales would,
+ * using a simple simulated cell (a resistor in series with a parallel RC
+ * element). Telegrams with any other message type are echoed back unchanged
+ * which makes the simulator usable as a raw loopback peer.
+ *
+ * Every connection gets its own simulated instrument state, so several
+ * clients can be served at the same time.
+ */
+class TermSimulator
+{
+public:
+
+    TermSimulator();
+    ~TermSimulator();
+
+    /** Start listening for clients.
+     *
+     * \param [in] port the TCP port to listen on. 0 picks a free port, see getPort().
+     * \returns true on success, false if failed
+     */
+    bool start(unsigned short port = 0);
+
+    /** Close all connections and stop the server threads. */
+    void stop();
+
+    bool isRunning() const;
+
+    /** The port the simulator is actually listening on. */
+    unsigned short getPort() const;
+
+    /** Sets the time until Remote Script commands are answered.
+     *
+     * Every reply is delayed by latency plus a uniformly distributed random
+     * value between zero and jitter. The delay behaves like a network link:
+     * commands sent back to back are delayed at the same time, but the
+     * replies keep their order.
+     *
+     * \param [in] latency the fixed part of the reply delay.
+     * \param [in] jitter the maximal random part of the reply delay.
+     */
+    void setLatency(std::chrono::microseconds latency, std::chrono::microseconds jitter = std::chrono::microseconds(0));
+
+    /** Seed the random number generator used for the jitter to get reproducible runs. */
+    void setJitterSeed(unsigned int seed);
+
+    /** Sets the parameters of the simulated cell.
+     *
+     * \param [in] series_resistance the electrolyte resistance in ohm.
+     * \param [in] charge_transfer_resistance the resistance parallel to the capacitance in ohm.
+     * \param [in] capacitance the double layer capacitance in farad.
+     */
+    void setCellModel(double series_resistance, double charge_transfer_resistance, double capacitance);
+
+    /** The number of clients which completed the registration so far. */
+    unsigned long getRegisteredClients() const;
+
+    /** Answers like Term did in a capture instead of simulating the cell.
+     *
+     * Every client is served the capture from its beginning. The telegrams
+     * Term sent are sent as soon as the client has sent the telegrams which
+     * preceded them in the capture, timed by a CapturePacer, so the latency of
+     * the captured instrument is kept. When the capture is exhausted the
+     * simulator goes on simulating.
+     *
+     * \param [in] records the capture, an empty vector switches back to simulating for new clients.
+     * \param [in] speed 1 for the original timing, 2 for twice as fast, 0 for as fast as possible.
+     */
+    void setReplay(std::vector<CaptureRecord> records, double speed = 1.0);
+
+    /** The number of telegrams of replayed clients which differed from the capture. */
+    unsigned long getReplayMismatches() const;
+
+protected:
+
+    /** The state of the instrument behind one connection. */
+    struct SimulatedInstrument {
+        double potential_setpoint = 0;
+        double current_setpoint = 0;
+        double frequency = 1000;
+        double amplitude = 10;          // mV or mA like Remote Script
+        int number_of_periods = 1;
+        bool galvanostatic = false;
+        bool potentiostat_enabled = false;
+    };
+
+    /** The replies of one connection which are waiting for their delay to pass. */
+    struct DelayedReplies {
+        std::mutex guard;
+        std::condition_variable changed;
+        std::deque< std::pair<std::chrono::steady_clock::time_point, std::string> > replies;
+        bool sending = false;
+        bool closing = false;
+    };
+
+    SOCKET listen_socket;
+    unsigned short listen_port;
+
+    std::atomic<bool> running;
+    std::thread *acceptWorker;
+
+    /** The sockets and threads of the open connections, a connection removes its socket when it ends. */
+    std::mutex connectionsGuard;
+    std::vector<SOCKET> connectionSockets;
+    std::vector<std::thread> connectionWorkers;
+
+    /** The threads of the connections which ended and wait to be joined. */
+    std::vector<std::thread::id> finishedWorkers;
+
+    /** Joins the threads of the connections which ended. */
+    void joinFinishedConnections();
+
+    std::mutex settingsGuard;
+    std::chrono::microseconds reply_latency;
+    std::chrono::microseconds reply_jitter;
+    std::mt19937 jitterGenerator;
+
+    double series_resistance;
+    double charge_transfer_resistance;
+    double capacitance;
+
+    std::atomic<unsigned long> registered_clients;
+
+    std::shared_ptr<const std::vector<CaptureRecord> > replayRecords;
+    double replay_speed;
+    std::atomic<unsigned long> replay_mismatches;
+
+    /** Accepts new clients and starts a thread for every one of them. */
+    void acceptJob();
+
+    /** Serves one client until it disconnects or the simulator is stopped. */
+    void connectionJob(SOCKET client_socket);
+
+    /** Reads and checks the registration packet sent by connectToTerm. */
+    bool readRegistration(SOCKET client_socket, std::string &connectionName);
+
+    /** Processes a Remote Script payload like "1:Frq=1000:IMPEDANCE:" and builds the reply. */
+    std::string processRemoteScript(SimulatedInstrument &instrument, const std::string &payload);
+
+    /** Executes one single command of a (possibly compound) Remote Script payload. */
+    std::string processRemoteCommand(SimulatedInstrument &instrument, const std::string &command);
+
+    std::complex<double> calculateImpedance(double frequency);
+
+    /** Sends the telegrams of Term in the capture from position on until the next telegram of the client. */
+    void replayFromTerm(SOCKET client_socket, const std::vector<CaptureRecord> &records, size_t &position, CapturePacer &pacer);
+
+    /** Sends a Remote Script reply now or queues it for the writer if a delay is configured. */
+    void sendReply(SOCKET client_socket, DelayedReplies &delayedReplies, std::string &&reply);
+
+    /** Sends the delayed replies of one connection when they are due. */
+    void replyWriterJob(SOCKET client_socket, DelayedReplies &delayedReplies);
+
+    /** The configured latency plus a random jitter. */
+    std::chrono::microseconds nextReplyDelay();
+
+    static bool receiveAll(SOCKET socket_handle, char *buffer, size_t length);
+    static bool sendTelegram(SOCKET socket_handle, const std::string &payload, unsigned char message_type);
+    static void closeSocket(SOCKET socket_handle);
+};
+
+#endif // TERMSIMULATOR_H
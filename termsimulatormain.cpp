@@ -0,0 +1,115 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <csignal>
+
+#include "termsimulator.h"
+
+/** Runs the Term simulator standalone so any client can be pointed at it.
+ *
+ * Usage: TermSimulator [port] [latency in us] [jitter in us] [--replay capture] [--speed factor]
+ *
+ * With --replay the clients are answered like in the capture, see
+ * TermSimulator::setReplay(). The speed 0 replays as fast as possible.
+ */
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void handleSignal(int) {
+
+    stop_requested = 1;
+}
+
+int main(int argc, char *argv[]) {
+
+    unsigned short port = 260;
+    long latency = 0;
+    long jitter = 0;
+    std::string replayPath;
+    double speed = 1.0;
+
+    std::vector<std::string> positionalArguments;
+
+    for (int i = 1; i < argc; ++i) {
+
+        std::string argument = argv[i];
+
+        if (argument == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (argument == "--speed" && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+        } else {
+            positionalArguments.push_back(argument);
+        }
+    }
+
+    if (positionalArguments.size() > 0) {
+        port = static_cast<unsigned short>(std::atoi(positionalArguments[0].c_str()));
+    }
+
+    if (positionalArguments.size() > 1) {
+        latency = std::atol(positionalArguments[1].c_str());
+    }
+
+    if (positionalArguments.size() > 2) {
+        jitter = std::atol(positionalArguments[2].c_str());
+    }
+
+    TermSimulator simulator;
+
+    simulator.setLatency(std::chrono::microseconds(latency), std::chrono::microseconds(jitter));
+
+    if (replayPath.empty() == false) {
+
+        std::vector<CaptureRecord> records;
+
+        if (TelegramCaptureReader::readAll(replayPath, records) == false) {
+
+            return 1;
+        }
+
+        simulator.setReplay(std::move(records), speed);
+    }
+
+    if (simulator.start(port) == false) {
+
+        return 1;
+    }
+
+    std::cout << "Term simulator listening on port " << simulator.getPort() << std::endl;
+
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    while (stop_requested == 0) {
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    simulator.stop();
+
+    return 0;
+}
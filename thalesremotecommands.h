@@ -0,0 +1,245 @@
+﻿/******************************************************************
+ *  ____       __                        __    __   __      _ __
+ * /_  / ___ _/ /  ___  ___ ___________ / /__ / /__/ /_____(_) /__
+ *  / /_/ _ `/ _ \/ _ \/ -_) __/___/ -_) / -_)  '_/ __/ __/ /  '_/
+ * /___/\_,_/_//_/_//_/\__/_/      \__/_/\__/_/\_\\__/_/ /_/_/\_\
+ *
+ * Copyright 2019 ZAHNER-elektrik I. Zahner-Schiller GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef THALESREMOTECOMMANDS_H
+#define THALESREMOTECOMMANDS_H
+
+#include <string_view>
+#include <array>
+#include <complex>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+/** The Remote Script commands the wrapper knows, described at compile time.
+ *
+ * Every command is a type, so a misspelled command does not compile and
+ * nothing is looked up or concatenated at runtime. A setpoint describes the
+ * name it is assigned with, the type of its value, the range the value is
+ * clamped to and the factor which converts it into the unit Remote Script
+ * expects. Only Nw and GAL have a range of their own, the other setpoints
+ * are sent as they are and Remote Script rejects values it can't set. A
+ * query describes the command and the key of its value in the reply.
+ *
+ * \code
+ * ThalesRemoteScriptWrapper::CommandBatch batch;
+ * batch.set<ThalesRemoteCommands::Frequency>(1000).set<ThalesRemoteCommands::Amplitude>(10e-3);
+ * batch.query<ThalesRemoteCommands::Impedance>();
+ * std::complex<double> impedance = remoteScript.executeBatch(batch).get<ThalesRemoteCommands::Impedance>();
+ * \endcode
+ *
+ * Adding a command only takes another descriptor like the ones below.
+ */
+namespace ThalesRemoteCommands {
+
+    /** The base of the setpoint descriptors, sent as "name=value". */
+    struct SetpointCommand {};
+
+    /** The base of the query descriptors, answered with "reply_key= value unit". */
+    struct QueryCommand {};
+
+    template<typename Command>
+    constexpr bool is_setpoint = std::is_base_of<SetpointCommand, Command>::value;
+
+    template<typename Command>
+    constexpr bool is_query = std::is_base_of<QueryCommand, Command>::value;
+
+    /** Potential setpoint in V. */
+    struct PotentialSetpoint : SetpointCommand {
+        typedef double value_type;
+        static constexpr std::string_view name = "Pset";
+        static constexpr double scale = 1;
+        static constexpr double minimum = std::numeric_limits<double>::lowest();
+        static constexpr double maximum = std::numeric_limits<double>::max();
+    };
+
+    /** Current setpoint in A. */
+    struct CurrentSetpoint : SetpointCommand {
+        typedef double value_type;
+        static constexpr std::string_view name = "Cset";
+        static constexpr double scale = 1;
+        static constexpr double minimum = std::numeric_limits<double>::lowest();
+        static constexpr double maximum = std::numeric_limits<double>::max();
+    };
+
+    /** Frequency of impedance measurements in Hz. */
+    struct Frequency : SetpointCommand {
+        typedef double value_type;
+        static constexpr std::string_view name = "Frq";
+        static constexpr double scale = 1;
+        static constexpr double minimum = std::numeric_limits<double>::lowest();
+        static constexpr double maximum = std::numeric_limits<double>::max();
+    };
+
+    /** Amplitude of impedance measurements in V or A, Remote Script takes mV or mA. */
+    struct Amplitude : SetpointCommand {
+        typedef double value_type;
+        static constexpr std::string_view name = "Ampl";
+        static constexpr double scale = 1e3;
+        static constexpr double minimum = std::numeric_limits<double>::lowest();
+        static constexpr double maximum = std::numeric_limits<double>::max();
+    };
+
+    /** The number of periods averaged for an impedance measurement. */
+    struct NumberOfPeriods : SetpointCommand {
+        typedef int value_type;
+        static constexpr std::string_view name = "Nw";
+        static constexpr int scale = 1;
+        static constexpr int minimum = 1;
+        static constexpr int maximum = 100;
+    };
+
+    /** Switches the potentiostat on or off. */
+    struct Potentiostat : SetpointCommand {
+        typedef bool value_type;
+        static constexpr std::string_view name = "Pot";
+    };
+
+    /** Galvanostatic operation of the potentiostat. */
+    struct Galvanostatic : SetpointCommand {
+        typedef bool value_type;
+        static constexpr std::string_view name = "Gal";
+    };
+
+    /** 1 for galvanostatic, -1 for pseudo galvanostatic and 0 for potentiostatic measurements. */
+    struct GalvanostaticMode : SetpointCommand {
+        typedef int value_type;
+        static constexpr std::string_view name = "GAL";
+        static constexpr int scale = 1;
+        static constexpr int minimum = -1;
+        static constexpr int maximum = 1;
+    };
+
+    /** Potential in V. */
+    struct Potential : QueryCommand {
+        typedef double value_type;
+        static constexpr std::string_view query = "POTENTIAL";
+        static constexpr std::string_view reply_key = "potential";
+    };
+
+    /** Current in A. */
+    struct Current : QueryCommand {
+        typedef double value_type;
+        static constexpr std::string_view query = "CURRENT";
+        static constexpr std::string_view reply_key = "current";
+    };
+
+    /** Impedance in Ohm at the set frequency, amplitude and number of periods. */
+    struct Impedance : QueryCommand {
+        typedef std::complex<double> value_type;
+        static constexpr std::string_view query = "IMPEDANCE";
+        static constexpr std::string_view reply_key = "impedance";
+    };
+
+    /** The setpoints Remote Script keeps until they are changed, the wrapper caches them.
+     *
+     * The index of a setpoint is its slot in the cache of the wrapper.
+     */
+    constexpr std::string_view cached_setpoints[] = {
+        PotentialSetpoint::name,
+        CurrentSetpoint::name,
+        Frequency::name,
+        Amplitude::name,
+        NumberOfPeriods::name,
+        Galvanostatic::name,
+        GalvanostaticMode::name,
+        Potentiostat::name
+    };
+
+    constexpr size_t cached_setpoint_count = sizeof(cached_setpoints) / sizeof(cached_setpoints[0]);
+
+    /** The cache slot of a setpoint name or cached_setpoint_count if it is not cached. */
+    constexpr size_t cacheSlot(std::string_view name) {
+
+        for (size_t slot = 0; slot < cached_setpoint_count; ++slot) {
+
+            if (cached_setpoints[slot] == name) {
+                return slot;
+            }
+        }
+
+        return cached_setpoint_count;
+    }
+
+    /** The cache slot of a setpoint, worked out by the compiler. */
+    template<typename Setpoint>
+    constexpr size_t cacheSlot() {
+
+        static_assert(is_setpoint<Setpoint>, "not a Remote Script setpoint");
+
+        return cacheSlot(Setpoint::name);
+    }
+
+    /** "name=" of a setpoint, put together by the compiler. */
+    template<typename Setpoint>
+    struct Assignment {
+
+        static constexpr std::array<char, Setpoint::name.size() + 1> makeText() {
+
+            std::array<char, Setpoint::name.size() + 1> text = {};
+
+            for (size_t i = 0; i < Setpoint::name.size(); ++i) {
+                text[i] = Setpoint::name[i];
+            }
+
+            text[Setpoint::name.size()] = '=';
+
+            return text;
+        }
+
+        static constexpr std::array<char, Setpoint::name.size() + 1> text = makeText();
+    };
+
+    template<typename Setpoint>
+    constexpr std::string_view assignment() {
+
+        static_assert(is_setpoint<Setpoint>, "not a Remote Script setpoint");
+
+        return std::string_view(Assignment<Setpoint>::text.data(), Assignment<Setpoint>::text.size());
+    }
+
+    /** Clamps the value into the range of the setpoint and converts it into the unit of Remote Script.
+     *
+     * Remote Script takes -1 for true and 0 for false.
+     */
+    template<typename Setpoint>
+    constexpr auto toRemoteValue(typename Setpoint::value_type value) {
+
+        static_assert(is_setpoint<Setpoint>, "not a Remote Script setpoint");
+
+        if constexpr (std::is_same<typename Setpoint::value_type, bool>::value) {
+
+            return value ? -1 : 0;
+
+        } else {
+
+            // NaN is passed on, it fails every comparison.
+            return std::clamp(value, Setpoint::minimum, Setpoint::maximum) * Setpoint::scale;
+        }
+    }
+}
+
+#endif // THALESREMOTECOMMANDS_H
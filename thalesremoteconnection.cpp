@@ -29,10 +29,38 @@
 ThalesRemoteConnection::ThalesRemoteConnection() :
 
     socket_handle(INVALID_SOCKET),
+    connection_generation(0),
+    receive_buffer_begin(0),
+    receive_buffer_end(0),
+    telegramBufferPool(std::make_shared<TelegramBufferPool>()),
+    waiting_consumers(0),
+    single_consumer(false),
+    max_queued_telegrams(0),
+    max_queued_bytes(0),
+    overflow_policy(OVERFLOW_BLOCK),
+    queued_telegrams(0),
+    queued_bytes(0),
+    high_water_telegrams(0),
+    high_water_bytes(0),
+    dropped_oldest_telegrams(0),
+    dropped_newest_telegrams(0),
+    listener_blocks(0),
+    listener_blocked_microseconds(0),
+    listener_waiting_for_room(false),
+    pipeline_depth(16),
+    outstanding_requests(0),
     receiving_worker_is_running(false),
-    receivingWorker(nullptr)
+    receivingWorker(nullptr),
+    attached_to_reactor(false),
+    capturing(false)
 {
 
+    for (size_t i = 0; i < this->receivedTelegrams.size(); ++i) {
+
+        this->receivedTelegrams[i] = nullptr;
+        this->handled_message_types[i] = false;
+    }
+
 #ifdef _WIN32
     WSADATA wsaData;
     WSAStartup(MAKEWORD(2,2), &wsaData);
@@ -42,13 +70,29 @@ ThalesRemoteConnection::ThalesRemoteConnection() :
 
 ThalesRemoteConnection::~ThalesRemoteConnection() {
 
+    for (std::atomic<ReceiveQueue *> &queue : this->receivedTelegrams) {
+
+        delete queue.load();
+    }
+
 #ifdef _WIN32
     WSACleanup();
 #endif
 
 }
 
-bool ThalesRemoteConnection::connectToTerm(std::string address, std::string connectionName) {
+bool ThalesRemoteConnection::connectToTerm(std::string address, std::string connectionName, const std::chrono::duration<int, std::milli> timeout, unsigned short port) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    bool connected = this->establishConnection(std::move(address), std::move(connectionName), timeout, port);
+
+    this->metrics.recordConnect(std::chrono::steady_clock::now() - start, connected);
+
+    return connected;
+}
+
+bool ThalesRemoteConnection::establishConnection(std::string address, std::string connectionName, const std::chrono::duration<int, std::milli> timeout, unsigned short port) {
 
     this->socket_handle = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -70,7 +114,7 @@ bool ThalesRemoteConnection::connectToTerm(std::string address, std::string conn
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
 
-    if (getaddrinfo(address.data(), "260", &hints, &result_pointer) != 0) {
+    if (getaddrinfo(address.data(), std::to_string(port).data(), &hints, &result_pointer) != 0) {
 
         std::cerr << "error while resolving address" << std::endl;
         this->closeSocket();
@@ -87,22 +131,28 @@ bool ThalesRemoteConnection::connectToTerm(std::string address, std::string conn
         return false;
     }
 
-    if (connect(this->socket_handle, first_addr->ai_addr, static_cast<int>(first_addr->ai_addrlen)) < 0) {
+    bool connected = this->connectSocket(first_addr->ai_addr, first_addr->ai_addrlen, timeout);
+
+    freeaddrinfo(result_pointer);
+
+    if (connected == false) {
 
         std::cerr << "could not connect to term" << std::endl;
         this->closeSocket();
         return false;
     }
 
-    this->startTelegramListener();
+    this->applySocketSettings();
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    // The listener is running before anything is sent, so no reply can get lost.
+    this->startTelegramListener();
+    this->applyListenerSettings();
 
     unsigned short payload_length = static_cast<unsigned short>(connectionName.length());
 
     std::vector<unsigned char> registration_packet;
 
-    registration_packet.reserve(payload_length + 6);
+    registration_packet.reserve(payload_length + 8);
 
     registration_packet.push_back(reinterpret_cast<unsigned char *>(&payload_length)[0]);
     registration_packet.push_back(reinterpret_cast<unsigned char *>(&payload_length)[1]);
@@ -116,15 +166,28 @@ bool ThalesRemoteConnection::connectToTerm(std::string address, std::string conn
     registration_packet.insert(registration_packet.end(), fixedHeaderBytes.begin(), fixedHeaderBytes.end());
 
     std::copy(connectionName.begin(), connectionName.end(), std::back_inserter(registration_packet));   // header
-    send(this->socket_handle, reinterpret_cast<char *>(registration_packet.data()), static_cast<int>(registration_packet.size()), 0);               // payload (here the "device name")
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(800));
+    // payload (here the "device name"), a peer which resets the connection must not raise SIGPIPE
+    if (send(this->socket_handle, reinterpret_cast<char *>(registration_packet.data()), static_cast<int>(registration_packet.size()), MSG_NOSIGNAL) != static_cast<int>(registration_packet.size())) {
+
+        std::cerr << "could not register at term" << std::endl;
+        this->stopTelegramListener();
+        this->closeSocket();
+        return false;
+    }
+
+    this->connection_generation++;
 
     return true;
 }
 
 void ThalesRemoteConnection::disconnectFromTerm() {
 
+    if (this->socket_handle == INVALID_SOCKET) {
+
+        return;
+    }
+
     // just 0xffff on "channel" 4 is the message to disconnect for Term
 
     this->sendTelegram("\xff\xff", 4);
@@ -135,268 +198,1389 @@ void ThalesRemoteConnection::disconnectFromTerm() {
 
 bool ThalesRemoteConnection::isConnectedToTerm() const {
 
+    // The listener stops as soon as Term closes the connection, the socket stays open until disconnectFromTerm().
 #ifdef _WIN32
-    return (this->socket_handle != INVALID_SOCKET);
+    return (this->socket_handle != INVALID_SOCKET) && this->receiving_worker_is_running;
 #else
-    return (this->socket_handle > 0);
+    return (this->socket_handle > 0) && this->receiving_worker_is_running;
 #endif
 
 }
 
-void ThalesRemoteConnection::sendTelegram(std::string payload, char message_type) {
+void ThalesRemoteConnection::setReactor(std::shared_ptr<TelegramReactor> reactor) {
 
-    std::vector<char> packet;
-    uint16_t payload_length = static_cast<uint16_t>(payload.size());
+    this->reactor = std::move(reactor);
+}
 
-    packet.reserve(payload_length + 3);
+unsigned long ThalesRemoteConnection::getConnectionGeneration() const {
 
-    // header
-    packet.push_back(reinterpret_cast<char *>(&payload_length)[0]);
-    packet.push_back(reinterpret_cast<char *>(&payload_length)[1]);
-    packet.push_back(message_type);
+    return this->connection_generation;
+}
 
-    std::copy(payload.begin(), payload.end(), std::back_inserter(packet));
+ThalesRemoteConnection::SocketSettings ThalesRemoteConnection::SocketSettings::forProfile(SocketProfile profile) {
+
+    SocketSettings settings;
+
+    switch (profile) {
+    case SOCKET_PROFILE_LOW_LATENCY:
+        // A dead instrument is noticed after some 8 s instead of hours.
+        settings.keep_alive = true;
+        settings.keep_alive_idle = 5;
+        settings.keep_alive_interval = 1;
+        settings.keep_alive_count = 3;
+        settings.busy_poll = 50;
+        settings.listener_priority = 1;
+        break;
+    case SOCKET_PROFILE_THROUGHPUT:
+        // Pipelined telegrams go out in full segments, the buffers hold a burst of large telegrams.
+        settings.no_delay = false;
+        settings.receive_buffer_size = 4 * 1024 * 1024;
+        settings.send_buffer_size = 4 * 1024 * 1024;
+        settings.keep_alive = true;
+        settings.keep_alive_idle = 60;
+        break;
+    case SOCKET_PROFILE_DEFAULT:
+        break;
+    }
 
-    send(this->socket_handle, reinterpret_cast<char *>(packet.data()), static_cast<int>(packet.size()), 0);
+    return settings;
 }
 
-void ThalesRemoteConnection::sendTelegram(std::vector<unsigned char> payload, unsigned char message_type) {
+void ThalesRemoteConnection::setSocketProfile(SocketProfile profile) {
 
-    std::vector<unsigned char> packet;
-    uint16_t payload_length = static_cast<uint16_t>(payload.size());
+    this->socket_settings = SocketSettings::forProfile(profile);
+}
 
-    packet.reserve(payload_length + 3);
+void ThalesRemoteConnection::setSocketSettings(const SocketSettings &settings) {
 
-    // header
-    packet.push_back(reinterpret_cast<unsigned char *>(&payload_length)[0]);
-    packet.push_back(reinterpret_cast<unsigned char *>(&payload_length)[1]);
-    packet.push_back(message_type);
+    this->socket_settings = settings;
+}
 
-    packet.insert(packet.end(), payload.begin(), payload.end());
+ThalesRemoteConnection::SocketSettings ThalesRemoteConnection::getSocketSettings() const {
 
-    send(this->socket_handle, reinterpret_cast<char *>(packet.data()), static_cast<int>(packet.size()), 0);
+    return this->socket_settings;
 }
 
+ThalesRemoteConnection::SocketSettings ThalesRemoteConnection::getEffectiveSocketSettings() const {
 
-std::string ThalesRemoteConnection::waitForStringTelegram() {
-
-    while (this->telegramReceived() == false) {
+    return this->effective_socket_settings;
+}
 
-        // Make sure the thread hangs here. The mutex will be unlocked upon
-        // receiving the next telegram.
-        this->telegramsAvailableMutex.lock();
-    }
+static void setSocketOption(SOCKET socket_handle, int level, int option, int value) {
 
-    return this->receiveStringTelegram();
+    setsockopt(socket_handle, level, option, reinterpret_cast<char *>(&value), sizeof(value));
 }
 
-std::vector<uint8_t> ThalesRemoteConnection::waitForTelegram() {
+static int getSocketOption(SOCKET socket_handle, int level, int option) {
+
+    int value = 0;
+
+#ifdef _WIN32
+    int length = sizeof(value);
+#else
+    socklen_t length = sizeof(value);
+#endif
 
-    while (this->telegramReceived() == false) {
+    if (getsockopt(socket_handle, level, option, reinterpret_cast<char *>(&value), &length) != 0) {
 
-        // Make sure the thread hangs here. The mutex will be unlocked upon
-        // receiving the next telegram.
-        this->telegramsAvailableMutex.lock();
+        return 0;
     }
 
-    return this->receiveTelegram();
+    return value;
 }
 
-std::vector<uint8_t> ThalesRemoteConnection::waitForTelegram(const std::chrono::duration<int, std::milli> timeout) {
+void ThalesRemoteConnection::applySocketSettings() {
 
-    std::chrono::milliseconds startTime = this->getCurrentTimeInMilliseconds();
-    std::chrono::duration<int, std::milli> remainingTime;
-    std::chrono::duration<int, std::milli> elapsedTime;
+    const SocketSettings &settings = this->socket_settings;
+    SocketSettings &effective = this->effective_socket_settings;
 
-    while (this->telegramReceived() == false) {
+    // Pipelined requests are small telegrams written back to back, Nagle's
+    // algorithm would hold them back until the previous ones are acknowledged.
+    setSocketOption(this->socket_handle, IPPROTO_TCP, TCP_NODELAY, settings.no_delay ? 1 : 0);
 
-        elapsedTime = this->getCurrentTimeInMilliseconds() - startTime;
+    // Setting the sizes turns off the automatic sizing, so they are only set on request.
+    if (settings.receive_buffer_size > 0) {
+        setSocketOption(this->socket_handle, SOL_SOCKET, SO_RCVBUF, settings.receive_buffer_size);
+    }
+
+    if (settings.send_buffer_size > 0) {
+        setSocketOption(this->socket_handle, SOL_SOCKET, SO_SNDBUF, settings.send_buffer_size);
+    }
+
+    setSocketOption(this->socket_handle, SOL_SOCKET, SO_KEEPALIVE, settings.keep_alive ? 1 : 0);
 
-        // Check if the timeout has already occured
-        if (elapsedTime > timeout) {
+    effective.no_delay = getSocketOption(this->socket_handle, IPPROTO_TCP, TCP_NODELAY) != 0;
+    effective.receive_buffer_size = getSocketOption(this->socket_handle, SOL_SOCKET, SO_RCVBUF);
+    effective.send_buffer_size = getSocketOption(this->socket_handle, SOL_SOCKET, SO_SNDBUF);
+    effective.keep_alive = getSocketOption(this->socket_handle, SOL_SOCKET, SO_KEEPALIVE) != 0;
+    effective.keep_alive_idle = 0;
+    effective.keep_alive_interval = 0;
+    effective.keep_alive_count = 0;
+    effective.busy_poll = 0;
 
-            return std::vector<uint8_t>();
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+    if (settings.keep_alive) {
+
+        if (settings.keep_alive_idle > 0) {
+            setSocketOption(this->socket_handle, IPPROTO_TCP, TCP_KEEPIDLE, settings.keep_alive_idle);
+        }
+
+        if (settings.keep_alive_interval > 0) {
+            setSocketOption(this->socket_handle, IPPROTO_TCP, TCP_KEEPINTVL, settings.keep_alive_interval);
         }
 
-        remainingTime = timeout - elapsedTime;
+        if (settings.keep_alive_count > 0) {
+            setSocketOption(this->socket_handle, IPPROTO_TCP, TCP_KEEPCNT, settings.keep_alive_count);
+        }
+    }
 
-        // This function may randomly fail (according to the documentation of std::timed_mutex).
-        this->telegramsAvailableMutex.try_lock_for(remainingTime);
+    effective.keep_alive_idle = getSocketOption(this->socket_handle, IPPROTO_TCP, TCP_KEEPIDLE);
+    effective.keep_alive_interval = getSocketOption(this->socket_handle, IPPROTO_TCP, TCP_KEEPINTVL);
+    effective.keep_alive_count = getSocketOption(this->socket_handle, IPPROTO_TCP, TCP_KEEPCNT);
+#endif
 
-        // Just re-check after it failed and freze for the remaining time if needed.
+#ifdef SO_BUSY_POLL
+    // Raising it above net.core.busy_read needs CAP_NET_ADMIN, without it stays off.
+    if (settings.busy_poll > 0) {
+        setSocketOption(this->socket_handle, SOL_SOCKET, SO_BUSY_POLL, settings.busy_poll);
     }
 
-    // If a telegram was received while waiting it can be delivered.
-    return this->receiveTelegram();
+    effective.busy_poll = getSocketOption(this->socket_handle, SOL_SOCKET, SO_BUSY_POLL);
+#endif
 }
 
-std::string ThalesRemoteConnection::waitForStringTelegram(const std::chrono::duration<int, std::milli> timeout) {
+void ThalesRemoteConnection::applyListenerSettings() {
 
-    std::vector<uint8_t> telegram = waitForTelegram(timeout);
+    const SocketSettings &settings = this->socket_settings;
+    SocketSettings &effective = this->effective_socket_settings;
 
-    return std::string(reinterpret_cast<char *>(telegram.data()), telegram.size());
-}
+    effective.listener_cpu = -1;
+    effective.listener_priority = 0;
 
-std::string ThalesRemoteConnection::receiveStringTelegram() {
+    // The reactor thread is shared with other connections, it is left alone.
+    if (this->receivingWorker == nullptr) {
 
-    std::vector<uint8_t> telegram = this->receiveTelegram();
+        return;
+    }
 
-    return std::string(reinterpret_cast<char *>(telegram.data()), telegram.size());
-}
+#ifdef __linux__
+    pthread_t listener = this->receivingWorker->native_handle();
 
-std::vector<uint8_t> ThalesRemoteConnection::receiveTelegram() {
+    if (settings.listener_cpu >= 0 && settings.listener_cpu < CPU_SETSIZE) {
 
-    std::vector<uint8_t> receivedTelegram;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(settings.listener_cpu, &cpus);
 
-    // Making sure we won't read from the queue while the thread might be
-    // in the process of putting in a new telegram.
-    this->receivedTelegramsGuard.lock();
+        if (pthread_setaffinity_np(listener, sizeof(cpus), &cpus) == 0) {
+
+            effective.listener_cpu = settings.listener_cpu;
 
-    if (this->receivedTelegrams.empty() == false) {
+        } else {
 
-        receivedTelegram = this->receivedTelegrams.front();
-        this->receivedTelegrams.pop();
+            std::cerr << "could not pin the listener thread to cpu " << settings.listener_cpu << std::endl;
+        }
     }
 
-    this->receivedTelegramsGuard.unlock();
+    if (settings.listener_priority > 0) {
+
+        struct sched_param parameters = {};
+        parameters.sched_priority = settings.listener_priority;
+
+        // Fails without the privilege, the listener keeps the normal scheduling then.
+        if (pthread_setschedparam(listener, SCHED_FIFO, &parameters) == 0) {
+
+            effective.listener_priority = settings.listener_priority;
+        }
+    }
+#else
+    (void) settings;
+#endif
+}
 
-    return receivedTelegram;
+bool ThalesRemoteConnection::sendTelegram(std::string_view payload, uint8_t message_type) {
+
+    return this->sendTelegram(reinterpret_cast<const uint8_t *>(payload.data()), payload.size(), message_type);
 }
 
-std::string ThalesRemoteConnection::sendStringAndWaitForReplyString(std::string payload, char message_type) {
+bool ThalesRemoteConnection::sendTelegram(const std::vector<uint8_t> &payload, uint8_t message_type) {
 
-    // This is just a convenience method.
-    this->sendTelegram(payload, message_type);
-    return this->waitForStringTelegram();
+    return this->sendTelegram(payload.data(), payload.size(), message_type);
 }
 
-bool ThalesRemoteConnection::telegramReceived() {
+bool ThalesRemoteConnection::sendTelegram(const uint8_t *payload, size_t length, uint8_t message_type) {
 
-    bool telegramsAvailable = false;
+    std::lock_guard<std::mutex> lock(this->sendGuard);
 
-    this->receivedTelegramsGuard.lock();
+    // Requests are only registered under the send mutex, so without
+    // outstanding requests none can be waiting for a reply of this type.
+    bool behind_requests = false;
+    const std::chrono::steady_clock::time_point sent_time = std::chrono::steady_clock::now();
 
-    telegramsAvailable = !this->receivedTelegrams.empty();
+    if (this->outstanding_requests > 0) {
 
-    this->receivedTelegramsGuard.unlock();
+        std::lock_guard<std::mutex> queueLock(this->receivedTelegramsGuard);
 
-    return telegramsAvailable;
-}
+        // The reply comes after the ones of the pending requests and is marked for the queue.
+        if (this->pendingReplies[message_type] && this->pendingReplies[message_type]->empty() == false) {
 
-void ThalesRemoteConnection::clearIncomingTelegramQueue() {
+            this->pendingReplies[message_type]->push_back({ReplyCallback(), sent_time});
+            this->outstanding_requests++;
+            behind_requests = true;
+        }
+    }
 
-    this->receivedTelegramsGuard.lock();
+    if (this->writeTelegram(payload, length, message_type)) {
 
-    while(this->receivedTelegrams.empty() == false) {
-        this->receivedTelegrams.pop();
+        return true;
     }
 
-    this->receivedTelegramsGuard.unlock();
+    if (behind_requests) {
+
+        ReplyCallback placeholder;
+        this->withdrawPendingReply(message_type, sent_time, placeholder);
+    }
+
+    return false;
 }
 
-std::vector<uint8_t> ThalesRemoteConnection::readTelegramFromSocket() {
+bool ThalesRemoteConnection::writeTelegram(const uint8_t *payload, size_t length, uint8_t message_type) {
+
+    if (length > 0xffff) {
+
+        std::cerr << "telegram payload too long" << std::endl;
+        return false;
+    }
+
+    uint16_t payload_length = static_cast<uint16_t>(length);
+
+    // header
+    uint8_t header[3];
+    std::memcpy(header, &payload_length, 2);
+    header[2] = message_type;
+
+    size_t remaining_bytes = sizeof(header) + length;
+
+    // Recorded before it is sent, otherwise the listener could record the reply first.
+    if (this->capturing) {
+
+        this->captureTelegram(CAPTURE_TO_TERM, message_type, payload, length, std::chrono::steady_clock::now());
+    }
 
 #ifdef _WIN32
-    int received_bytes;
-    int total_received_bytes = 0;
-#else
-    ssize_t received_bytes;
-    size_t total_received_bytes = 0;
-#endif
+    WSABUF buffers[2];
+    buffers[0].buf = reinterpret_cast<char *>(header);
+    buffers[0].len = sizeof(header);
+    buffers[1].buf = reinterpret_cast<char *>(const_cast<uint8_t *>(payload));
+    buffers[1].len = static_cast<ULONG>(length);
 
-    char header_bytes[3];
-    unsigned short *length_data = reinterpret_cast<unsigned short*>(header_bytes);
+    WSABUF *next_buffer = buffers;
+    DWORD buffer_count = 2;
 
-    do {
+    while (remaining_bytes > 0) {
 
-        // Firstly we try to read the three header bytes of the telegram.
-        received_bytes = recv(this->socket_handle, &header_bytes[total_received_bytes], 3 - total_received_bytes, 0);
+        DWORD sent_bytes = 0;
 
-        // Quit if the socket has been shut down.
-        if (received_bytes == 0) {
+        if (WSASend(this->socket_handle, next_buffer, buffer_count, &sent_bytes, 0, nullptr, nullptr) != 0) {
 
-            return std::vector<uint8_t>();
+            return false;
         }
 
-#ifdef _WIN32
-        total_received_bytes += received_bytes;
+        remaining_bytes -= sent_bytes;
+
+        // Skip what has been sent already in case of a partial write.
+        while (buffer_count > 0 && sent_bytes >= next_buffer->len) {
+
+            sent_bytes -= next_buffer->len;
+            next_buffer++;
+            buffer_count--;
+        }
+
+        if (buffer_count > 0) {
+
+            next_buffer->buf += sent_bytes;
+            next_buffer->len -= sent_bytes;
+        }
+    }
 #else
-        total_received_bytes += static_cast<size_t>(received_bytes);
-#endif
+    struct iovec buffers[2];
+    buffers[0].iov_base = header;
+    buffers[0].iov_len = sizeof(header);
+    buffers[1].iov_base = const_cast<uint8_t *>(payload);
+    buffers[1].iov_len = length;
 
-    } while (total_received_bytes < 3);
+    struct msghdr message = {};
+    message.msg_iov = buffers;
+    message.msg_iovlen = 2;
 
-    std::vector<uint8_t> incoming_packet;
-    incoming_packet.resize(*length_data);
+    while (remaining_bytes > 0) {
 
-    total_received_bytes = 0;
+        ssize_t sent_bytes = sendmsg(this->socket_handle, &message, MSG_NOSIGNAL);
+
+        if (sent_bytes < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
 
-    do {
+        remaining_bytes -= static_cast<size_t>(sent_bytes);
 
-        received_bytes = recv(this->socket_handle, reinterpret_cast<char *>(incoming_packet.data() + total_received_bytes), *length_data - total_received_bytes, 0);
+        // Skip what has been sent already in case of a partial write.
+        size_t skipped_bytes = static_cast<size_t>(sent_bytes);
 
-        if (received_bytes == 0) {
+        while (message.msg_iovlen > 0 && skipped_bytes >= message.msg_iov->iov_len) {
 
-            return std::vector<uint8_t>();
+            skipped_bytes -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
         }
 
-#ifdef _WIN32
-        total_received_bytes += received_bytes;
-#else
-        total_received_bytes += static_cast<size_t>(received_bytes);
+        if (message.msg_iovlen > 0) {
+
+            message.msg_iov->iov_base = static_cast<uint8_t *>(message.msg_iov->iov_base) + skipped_bytes;
+            message.msg_iov->iov_len -= skipped_bytes;
+        }
+    }
 #endif
 
-    } while (total_received_bytes < *length_data);
+    this->metrics.recordTelegramOut(message_type, length);
 
-    return incoming_packet;
+    return true;
 }
 
-void ThalesRemoteConnection::telegramListenerJob() {
 
-    do {
+std::string ThalesRemoteConnection::waitForStringTelegram(uint8_t message_type) {
 
-        // Most of the time the thread will be blocking here
-        std::vector<uint8_t> telegram = readTelegramFromSocket();
+    TelegramBuffer telegram = this->waitForTelegramBuffer(message_type);
 
-        if (telegram.size() > 0) {
+    return std::string(reinterpret_cast<const char *>(telegram.data()), telegram.size());
+}
+
+std::vector<uint8_t> ThalesRemoteConnection::waitForTelegram(uint8_t message_type) {
+
+    return this->waitForTelegramBuffer(message_type).release();
+}
+
+TelegramBuffer ThalesRemoteConnection::waitForTelegramBuffer(uint8_t message_type) {
+
+    return this->waitForQueuedTelegram(message_type, nullptr);
+}
+
+std::vector<uint8_t> ThalesRemoteConnection::waitForTelegram(const std::chrono::duration<int, std::milli> timeout, uint8_t message_type) {
+
+    return this->waitForTelegramBuffer(timeout, message_type).release();
+}
+
+TelegramBuffer ThalesRemoteConnection::waitForTelegramBuffer(const std::chrono::duration<int, std::milli> timeout, uint8_t message_type) {
+
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+
+    return this->waitForQueuedTelegram(message_type, &deadline);
+}
+
+std::string ThalesRemoteConnection::waitForStringTelegram(const std::chrono::duration<int, std::milli> timeout, uint8_t message_type) {
 
-            this->receivedTelegramsGuard.lock();
+    TelegramBuffer telegram = this->waitForTelegramBuffer(timeout, message_type);
 
-            this->receivedTelegrams.push(telegram);
+    return std::string(reinterpret_cast<const char *>(telegram.data()), telegram.size());
+}
+
+std::string ThalesRemoteConnection::receiveStringTelegram(uint8_t message_type) {
+
+    TelegramBuffer telegram = this->receiveTelegramBuffer(message_type);
+
+    return std::string(reinterpret_cast<const char *>(telegram.data()), telegram.size());
+}
+
+std::vector<uint8_t> ThalesRemoteConnection::receiveTelegram(uint8_t message_type) {
+
+    return this->receiveTelegramBuffer(message_type).release();
+}
+
+TelegramBuffer ThalesRemoteConnection::receiveTelegramBuffer(uint8_t message_type) {
+
+    return this->popTelegram(message_type);
+}
+
+void ThalesRemoteConnection::recycleTelegram(std::vector<uint8_t> &&telegram) {
+
+    this->telegramBufferPool->recycle(std::move(telegram));
+}
+
+std::string ThalesRemoteConnection::sendStringAndWaitForReplyString(std::string_view payload, uint8_t message_type) {
+
+    TelegramBuffer reply = this->sendTelegramAndWaitForReply(payload, message_type);
+
+    return std::string(reinterpret_cast<const char *>(reply.data()), reply.size());
+}
+
+TelegramBuffer ThalesRemoteConnection::sendTelegramAndWaitForReply(std::string_view payload, uint8_t message_type) {
+
+    // The reply is delivered to the stack of this function. The callback
+    // only captures two pointers, so std::function does not allocate.
+    struct {
+        TelegramBuffer reply;
+        bool received = false;
+    } pendingReply;
+
+    auto *pendingReplyPointer = &pendingReply;
+
+    this->sendTelegramAndExpectReply(payload, message_type, [this, pendingReplyPointer](TelegramBuffer &&reply) {
+
+        std::lock_guard<std::mutex> lock(this->receivedTelegramsGuard);
+
+        pendingReplyPointer->reply = std::move(reply);
+        pendingReplyPointer->received = true;
+
+        this->telegramsAvailable.notify_all();
+    });
+
+    std::unique_lock<std::mutex> lock(this->receivedTelegramsGuard);
+
+    this->telegramsAvailable.wait(lock, [&pendingReply]() {
+        return pendingReply.received;
+    });
+
+    return std::move(pendingReply.reply);
+}
+
+bool ThalesRemoteConnection::sendTelegramAndExpectReply(std::string_view payload, uint8_t message_type, ReplyCallback callback) {
+
+    // Wait for a free slot in the pipeline.
+    std::unique_lock<std::mutex> queueLock(this->receivedTelegramsGuard);
+
+    this->pipelineSlotAvailable.wait(queueLock, [this]() {
+        return this->outstanding_requests < this->pipeline_depth || this->receiving_worker_is_running == false;
+    });
+
+    if (this->receiving_worker_is_running == false) {
+
+        queueLock.unlock();
+        callback(TelegramBuffer());
+        return false;
+    }
+
+    this->outstanding_requests++;
+
+    queueLock.unlock();
+
+    // Registering the callback and sending happen while holding the send
+    // mutex, so the order of the callbacks is the order on the wire.
+    std::lock_guard<std::mutex> sendLock(this->sendGuard);
+
+    queueLock.lock();
+
+    // The connection may have closed while waiting for the send mutex, nobody
+    // would complete the request anymore. finishReceiving() resets the count.
+    if (this->receiving_worker_is_running == false) {
+
+        queueLock.unlock();
+        callback(TelegramBuffer());
+        return false;
+    }
+
+    if (!this->pendingReplies[message_type]) {
+
+        this->pendingReplies[message_type].reset(new std::deque<PendingReply>());
+    }
+
+    const std::chrono::steady_clock::time_point sent_time = std::chrono::steady_clock::now();
+
+    this->pendingReplies[message_type]->push_back({std::move(callback), sent_time});
+
+    queueLock.unlock();
+
+    if (this->writeTelegram(reinterpret_cast<const uint8_t *>(payload.data()), payload.size(), message_type)) {
+
+        return true;
+    }
+
+    // If the connection dropped, finishReceiving() has completed the request already.
+    if (this->withdrawPendingReply(message_type, sent_time, callback)) {
+
+        callback(TelegramBuffer());
+    }
+
+    return false;
+}
+
+std::future<std::string> ThalesRemoteConnection::sendStringAndGetReplyFuture(std::string_view payload, uint8_t message_type) {
+
+    std::shared_ptr< std::promise<std::string> > promise = std::make_shared< std::promise<std::string> >();
+    std::future<std::string> future = promise->get_future();
+
+    this->sendTelegramAndExpectReply(payload, message_type, [promise](TelegramBuffer &&reply) {
+        promise->set_value(std::string(reinterpret_cast<const char *>(reply.data()), reply.size()));
+    });
+
+    return future;
+}
+
+void ThalesRemoteConnection::setPipelineDepth(size_t depth) {
 
-            // unlock the mutex in case the client thread is
-            // blocking while waiting for an incoming telegram
-            this->telegramsAvailableMutex.unlock();
+    this->receivedTelegramsGuard.lock();
+
+    this->pipeline_depth = std::max<size_t>(depth, 1);
+
+    this->receivedTelegramsGuard.unlock();
+
+    this->pipelineSlotAvailable.notify_all();
+}
+
+size_t ThalesRemoteConnection::getPipelineDepth() {
+
+    std::lock_guard<std::mutex> lock(this->receivedTelegramsGuard);
+
+    return this->pipeline_depth;
+}
+
+size_t ThalesRemoteConnection::getOutstandingRequests() {
+
+    std::lock_guard<std::mutex> lock(this->receivedTelegramsGuard);
+
+    return this->outstanding_requests;
+}
+
+bool ThalesRemoteConnection::telegramReceived(uint8_t message_type) {
+
+    return this->hasTelegram(message_type);
+}
+
+void ThalesRemoteConnection::clearIncomingTelegramQueue() {
+
+    for (std::atomic<ReceiveQueue *> &queuePointer : this->receivedTelegrams) {
+
+        ReceiveQueue *queue = queuePointer.load(std::memory_order_acquire);
+
+        if (queue == nullptr) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> consumerLock(queue->consumerGuard);
 
-            this->receivedTelegramsGuard.unlock();
+        size_t telegrams = 0;
+        size_t bytes = 0;
 
+        for (TelegramBuffer telegram = this->takeFromQueue(queue); telegram.empty() == false; telegram = this->takeFromQueue(queue)) {
+
+            telegrams++;
+            bytes += telegram.size();
         }
 
-    } while (this->receiving_worker_is_running);
+        this->releaseQueuedTelegrams(telegrams, bytes);
+    }
 }
 
-void ThalesRemoteConnection::startTelegramListener() {
+void ThalesRemoteConnection::setTelegramHandler(uint8_t message_type, std::function<void(TelegramBuffer &&telegram)> handler) {
 
-    this->receiving_worker_is_running = true;
-    this->telegramsAvailableMutex.lock();
-    this->receivingWorker = new std::thread(&ThalesRemoteConnection::telegramListenerJob, this);
+    std::lock_guard<std::mutex> lock(this->receivedTelegramsGuard);
+
+    if (handler) {
+
+        this->telegramHandlers[message_type] = std::make_shared<TelegramHandler>(std::move(handler));
+
+    } else {
+
+        this->telegramHandlers[message_type].reset();
+    }
+
+    this->handled_message_types[message_type] = static_cast<bool>(this->telegramHandlers[message_type]);
 }
 
-void ThalesRemoteConnection::stopTelegramListener() {
+void ThalesRemoteConnection::setReceiveQueueMode(ReceiveQueueMode mode) {
 
-    // Makes sure the blocking recv function returns so the thread
-    // can be shut down gracefully.
-    shutdown(this->socket_handle, SHUT_RD);
+    this->single_consumer = (mode == QUEUE_SINGLE_CONSUMER);
+}
 
-    this->receiving_worker_is_running = false;
-    this->receivingWorker->join();
+ThalesRemoteConnection::ReceiveQueueMode ThalesRemoteConnection::getReceiveQueueMode() const {
+
+    return this->single_consumer ? QUEUE_SINGLE_CONSUMER : QUEUE_MULTIPLE_CONSUMERS;
+}
+
+void ThalesRemoteConnection::setReceiveQueueLimits(size_t max_telegrams, size_t max_bytes, OverflowPolicy policy) {
+
+    this->receivedTelegramsGuard.lock();
+
+    this->max_queued_telegrams = max_telegrams;
+    this->max_queued_bytes = max_bytes;
+    this->overflow_policy = policy;
 
-    this->telegramsAvailableMutex.unlock();
+    this->receivedTelegramsGuard.unlock();
+
+    // A waiting listener has to check the new limits.
+    this->receiveQueueRoomAvailable.notify_all();
+}
+
+ThalesRemoteConnection::ReceiveQueueStatistics ThalesRemoteConnection::getReceiveQueueStatistics() const {
+
+    ReceiveQueueStatistics statistics;
+
+    statistics.queued_telegrams = this->queued_telegrams;
+    statistics.queued_bytes = this->queued_bytes;
+    statistics.high_water_telegrams = this->high_water_telegrams;
+    statistics.high_water_bytes = this->high_water_bytes;
+    statistics.dropped_oldest = this->dropped_oldest_telegrams;
+    statistics.dropped_newest = this->dropped_newest_telegrams;
+    statistics.listener_blocks = this->listener_blocks;
+    statistics.listener_blocked_time = std::chrono::microseconds(this->listener_blocked_microseconds);
+
+    return statistics;
+}
+
+void ThalesRemoteConnection::resetReceiveQueueStatistics() {
+
+    this->high_water_telegrams = this->queued_telegrams.load();
+    this->high_water_bytes = this->queued_bytes.load();
+    this->dropped_oldest_telegrams = 0;
+    this->dropped_newest_telegrams = 0;
+    this->listener_blocks = 0;
+    this->listener_blocked_microseconds = 0;
+}
+
+ConnectionMetrics &ThalesRemoteConnection::getMetrics() {
+
+    return this->metrics;
 }
 
-std::chrono::milliseconds ThalesRemoteConnection::getCurrentTimeInMilliseconds() const {
+MetricsSnapshot ThalesRemoteConnection::getMetricsSnapshot() {
+
+    MetricsSnapshot snapshot = this->metrics.getSnapshot();
+    ReceiveQueueStatistics statistics = this->getReceiveQueueStatistics();
+
+    snapshot.queued_telegrams = statistics.queued_telegrams;
+    snapshot.queued_bytes = statistics.queued_bytes;
+    snapshot.high_water_telegrams = statistics.high_water_telegrams;
+    snapshot.high_water_bytes = statistics.high_water_bytes;
+    snapshot.dropped_telegrams = statistics.dropped_oldest + statistics.dropped_newest;
+    snapshot.outstanding_requests = this->outstanding_requests;
+
+    return snapshot;
+}
+
+void ThalesRemoteConnection::setCapture(std::shared_ptr<TelegramCaptureWriter> capture) {
+
+    this->capturing = false;
+    std::atomic_store(&this->capture, capture);
+    this->capturing = (capture != nullptr);
+}
+
+std::shared_ptr<TelegramCaptureWriter> ThalesRemoteConnection::getCapture() const {
+
+    return std::atomic_load(&this->capture);
+}
+
+void ThalesRemoteConnection::captureTelegram(CaptureDirection direction, uint8_t message_type, const uint8_t *payload, size_t length, std::chrono::steady_clock::time_point time) {
+
+    std::shared_ptr<TelegramCaptureWriter> capture = std::atomic_load(&this->capture);
+
+    if (capture) {
+
+        capture->record(direction, message_type, payload, length, time);
+    }
+}
+
+TelegramBuffer ThalesRemoteConnection::popTelegram(uint8_t message_type) {
+
+    ReceiveQueue *queue = this->receivedTelegrams[message_type].load(std::memory_order_acquire);
+
+    if (queue == nullptr) {
+
+        return TelegramBuffer();
+    }
+
+    std::unique_lock<std::mutex> consumerLock(queue->consumerGuard, std::defer_lock);
+
+    if (this->consumersLock()) {
+
+        consumerLock.lock();
+    }
+
+    TelegramBuffer telegram = this->takeFromQueue(queue);
+
+    if (telegram.empty() == false) {
+
+        this->releaseQueuedTelegrams(1, telegram.size());
+    }
+
+    return telegram;
+}
+
+TelegramBuffer ThalesRemoteConnection::takeFromQueue(ReceiveQueue *queue) {
+
+    TelegramBuffer telegram;
+
+    // The overflow only gets telegrams while it is not empty, so everything
+    // in it arrived after the telegrams in the ring.
+    if (queue->ring.tryPop(telegram) == false && queue->overflow_count > 0) {
+
+        std::lock_guard<std::mutex> lock(this->receivedTelegramsGuard);
+
+        if (queue->overflow.empty() == false) {
+
+            telegram = queue->overflow.pop();
+            queue->overflow_count--;
+        }
+    }
+
+    return telegram;
+}
+
+void ThalesRemoteConnection::releaseQueuedTelegrams(size_t telegrams, size_t bytes) {
+
+    this->queued_telegrams -= telegrams;
+    this->queued_bytes -= bytes;
+
+    if (this->listener_waiting_for_room) {
+
+        // The listener is inside wait() once it released the lock.
+        this->receivedTelegramsGuard.lock();
+        this->receivedTelegramsGuard.unlock();
+
+        this->receiveQueueRoomAvailable.notify_all();
+    }
+}
+
+bool ThalesRemoteConnection::consumersLock() const {
+
+    // Dropping the oldest telegram makes the listener a consumer as well.
+    return this->single_consumer == false || this->overflow_policy == OVERFLOW_DROP_OLDEST;
+}
+
+bool ThalesRemoteConnection::hasRoomForTelegram(size_t size) const {
+
+    const size_t max_telegrams = this->max_queued_telegrams;
+    const size_t max_bytes = this->max_queued_bytes;
+    const size_t telegrams = this->queued_telegrams;
+
+    // A telegram larger than the byte limit is queued once the queues are empty.
+    return (max_telegrams == 0 || telegrams < max_telegrams) &&
+           (max_bytes == 0 || telegrams == 0 || this->queued_bytes + size <= max_bytes);
+}
+
+bool ThalesRemoteConnection::makeRoomForTelegram(size_t size) {
+
+    while (this->hasRoomForTelegram(size) == false) {
+
+        switch (this->overflow_policy) {
+
+        case OVERFLOW_DROP_NEWEST:
+
+            this->dropped_newest_telegrams++;
+            return false;
+
+        case OVERFLOW_DROP_OLDEST:
+
+            if (this->dropOldestTelegram() == false) {
+
+                return true;
+            }
+
+            this->dropped_oldest_telegrams++;
+            break;
+
+        case OVERFLOW_BLOCK: {
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            std::unique_lock<std::mutex> lock(this->receivedTelegramsGuard);
+
+            this->listener_waiting_for_room = true;
+            this->listener_blocks++;
+
+            this->receiveQueueRoomAvailable.wait(lock, [this, size]() {
+                return this->hasRoomForTelegram(size) || this->overflow_policy != OVERFLOW_BLOCK || this->receiving_worker_is_running == false;
+            });
+
+            this->listener_waiting_for_room = false;
+
+            lock.unlock();
+
+            this->listener_blocked_microseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+            // Nobody is going to take the telegram anymore.
+            if (this->receiving_worker_is_running == false) {
+
+                return false;
+            }
+
+            break;
+        }
+        }
+    }
+
+    return true;
+}
+
+bool ThalesRemoteConnection::dropOldestTelegram() {
+
+    ReceiveQueue *oldestQueue = nullptr;
+    std::chrono::steady_clock::time_point oldest_receive_time;
+
+    for (std::atomic<ReceiveQueue *> &queuePointer : this->receivedTelegrams) {
+
+        ReceiveQueue *queue = queuePointer.load(std::memory_order_relaxed);
+
+        if (queue == nullptr) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> consumerLock(queue->consumerGuard);
+
+        std::chrono::steady_clock::time_point receive_time;
+
+        if (queue->ring.front() != nullptr) {
+
+            receive_time = queue->ring.front()->getReceiveTime();
+
+        } else if (queue->overflow_count > 0) {
+
+            std::lock_guard<std::mutex> lock(this->receivedTelegramsGuard);
+
+            receive_time = queue->overflow.front().getReceiveTime();
+
+        } else {
+
+            continue;
+        }
+
+        if (oldestQueue == nullptr || receive_time < oldest_receive_time) {
+
+            oldestQueue = queue;
+            oldest_receive_time = receive_time;
+        }
+    }
+
+    if (oldestQueue == nullptr) {
+
+        return false;
+    }
+
+    std::lock_guard<std::mutex> consumerLock(oldestQueue->consumerGuard);
+
+    // A consumer may have taken it meanwhile, which made room as well.
+    TelegramBuffer telegram = this->takeFromQueue(oldestQueue);
+
+    if (telegram.empty()) {
+
+        return true;
+    }
+
+    this->releaseQueuedTelegrams(1, telegram.size());
+
+    return true;
+}
+
+bool ThalesRemoteConnection::hasTelegram(uint8_t message_type) const {
+
+    const ReceiveQueue *queue = this->receivedTelegrams[message_type].load(std::memory_order_acquire);
+
+    return queue && (queue->ring.empty() == false || queue->overflow_count > 0);
+}
+
+TelegramBuffer ThalesRemoteConnection::waitForQueuedTelegram(uint8_t message_type, const std::chrono::steady_clock::time_point *deadline) {
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    TelegramBuffer telegram = this->popTelegram(message_type);
+
+    while (telegram.empty()) {
+
+        std::unique_lock<std::mutex> lock(this->receivedTelegramsGuard);
+
+        this->waiting_consumers++;
+
+        // Pairs with the fence in queueTelegram(): either this thread sees
+        // the new telegram or the listener sees this thread waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        auto ready = [this, message_type]() {
+            return this->hasTelegram(message_type) || this->receiving_worker_is_running == false;
+        };
+
+        bool woken = true;
+
+        if (deadline) {
+
+            woken = this->telegramsAvailable.wait_until(lock, *deadline, ready);
+
+        } else {
+
+            this->telegramsAvailable.wait(lock, ready);
+        }
+
+        this->waiting_consumers--;
+
+        lock.unlock();
+
+        // If a telegram was received while waiting it can be delivered.
+        telegram = this->popTelegram(message_type);
+
+        // Otherwise another consumer was faster, unless it's over.
+        if (woken == false || this->receiving_worker_is_running == false) {
+
+            break;
+        }
+    }
+
+    this->metrics.recordTelegramWait(std::chrono::steady_clock::now() - start);
+
+    return telegram;
+}
+
+bool ThalesRemoteConnection::connectSocket(const struct sockaddr *address, size_t address_length, const std::chrono::duration<int, std::milli> timeout) {
+
+    // Connecting in non-blocking mode and polling for completion, otherwise
+    // connect would hang for the system timeout if the host does not answer.
+
+#ifdef _WIN32
+    u_long non_blocking = 1;
+    ioctlsocket(this->socket_handle, FIONBIO, &non_blocking);
+#else
+    int flags = fcntl(this->socket_handle, F_GETFL, 0);
+    fcntl(this->socket_handle, F_SETFL, flags | O_NONBLOCK);
+#endif
+
+    bool connected = (connect(this->socket_handle, address, static_cast<int>(address_length)) == 0);
+
+#ifdef _WIN32
+    bool in_progress = (connected == false && WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+    bool in_progress = (connected == false && (errno == EINPROGRESS || errno == EINTR));
+#endif
+
+    if (in_progress) {
+
+        struct pollfd descriptor = {};
+        descriptor.fd = this->socket_handle;
+        descriptor.events = POLLOUT;
+
+#ifdef _WIN32
+        int ready = WSAPoll(&descriptor, 1, timeout.count());
+#else
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+        int ready;
+
+        do {
+
+            // poll may be interrupted by signals, so the remaining time is recalculated.
+            std::chrono::milliseconds remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            ready = poll(&descriptor, 1, static_cast<int>(std::max(remaining.count(), static_cast<std::chrono::milliseconds::rep>(0))));
+
+        } while (ready < 0 && errno == EINTR);
+#endif
+
+        if (ready > 0) {
+
+            int error = 0;
+            socklen_t error_length = sizeof(error);
+
+            getsockopt(this->socket_handle, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&error), &error_length);
+
+            connected = (error == 0);
+        }
+    }
+
+    // Back to blocking mode for the listener.
+
+#ifdef _WIN32
+    non_blocking = 0;
+    ioctlsocket(this->socket_handle, FIONBIO, &non_blocking);
+#else
+    fcntl(this->socket_handle, F_SETFL, flags);
+#endif
+
+    return connected;
+}
+
+bool ThalesRemoteConnection::readTelegramFromSocket(TelegramBuffer &telegram) {
+
+    // The socket is read in large chunks into the receive buffer and the
+    // telegrams are taken from there. A burst of telegrams only costs a
+    // single recv call this way.
+
+    while (this->takeTelegramFromBuffer(telegram) == false) {
+
+        // Quit if the socket has been shut down or an error occured.
+        if (this->receiveIntoBuffer(0) <= 0) {
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ThalesRemoteConnection::receiveAvailableTelegrams() {
+
+    // Only one chunk per call, epoll reports the socket again if there is more,
+    // so a busy connection can't starve the others of the reactor.
+    long received_bytes = this->receiveIntoBuffer(MSG_DONTWAIT);
+
+    if (received_bytes == 0) {
+
+        return false;
+    }
+
+    if (received_bytes < 0) {
+
+        return (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    TelegramBuffer telegram;
+
+    while (this->takeTelegramFromBuffer(telegram)) {
+
+        if (telegram.size() > 0) {
+
+            this->queueTelegram(std::move(telegram));
+        }
+    }
+
+    return true;
+}
+
+bool ThalesRemoteConnection::takeTelegramFromBuffer(TelegramBuffer &telegram) {
+
+    size_t available_bytes = this->receive_buffer_end - this->receive_buffer_begin;
+    uint8_t *telegram_begin = this->receiveBuffer.get() + this->receive_buffer_begin;
+
+    if (available_bytes < 3) {
+
+        return false;
+    }
+
+    uint16_t payload_length;
+    std::memcpy(&payload_length, telegram_begin, 2);
+
+    if (available_bytes < 3u + payload_length) {
+
+        return false;
+    }
+
+    telegram = this->telegramBufferPool->acquire(telegram_begin + 3, payload_length, telegram_begin[2]);
+    this->receive_buffer_begin += 3u + payload_length;
+
+    this->metrics.recordTelegramIn(telegram_begin[2], payload_length);
+
+    if (this->capturing) {
+
+        this->captureTelegram(CAPTURE_FROM_TERM, telegram.getMessageType(), telegram.data(), telegram.size(), telegram.getReceiveTime());
+    }
+
+    return true;
+}
+
+long ThalesRemoteConnection::receiveIntoBuffer(int flags) {
+
+    // Move the incomplete rest to the front to make room for the next chunk.
+    if (this->receive_buffer_begin > 0) {
+
+        size_t available_bytes = this->receive_buffer_end - this->receive_buffer_begin;
+
+        std::memmove(this->receiveBuffer.get(), this->receiveBuffer.get() + this->receive_buffer_begin, available_bytes);
+
+        this->receive_buffer_begin = 0;
+        this->receive_buffer_end = available_bytes;
+    }
+
+    char *free_space = reinterpret_cast<char *>(this->receiveBuffer.get() + this->receive_buffer_end);
+    size_t free_bytes = receive_buffer_size - this->receive_buffer_end;
+
+    while (true) {
+
+#ifdef _WIN32
+        int received_bytes = recv(this->socket_handle, free_space, static_cast<int>(free_bytes), flags);
+#else
+        ssize_t received_bytes = recv(this->socket_handle, free_space, free_bytes, flags);
+
+        if (received_bytes < 0 && errno == EINTR) {
+
+            continue;
+        }
+#endif
+
+        if (received_bytes > 0) {
+
+            this->receive_buffer_end += static_cast<size_t>(received_bytes);
+        }
+
+        return static_cast<long>(received_bytes);
+    }
+}
+
+void ThalesRemoteConnection::queueTelegram(TelegramBuffer &&telegram) {
+
+    const uint8_t message_type = telegram.getMessageType();
+
+    // A request is registered before it is sent, so without outstanding
+    // requests and handlers the telegram can't be anything but queued.
+    if (this->outstanding_requests > 0 || this->handled_message_types[message_type]) {
+
+        this->receivedTelegramsGuard.lock();
+
+        // Replies to requests sent with sendTelegramAndExpectReply come first,
+        // they are matched in the order the requests were sent.
+        bool reply_to_raw_telegram = false;
+
+        if (this->pendingReplies[message_type] && this->pendingReplies[message_type]->empty() == false) {
+
+            ReplyCallback callback = std::move(this->pendingReplies[message_type]->front().callback);
+            std::chrono::steady_clock::time_point sent_time = this->pendingReplies[message_type]->front().sent_time;
+            this->pendingReplies[message_type]->pop_front();
+            this->outstanding_requests--;
+
+            if (callback) {
+
+                this->receivedTelegramsGuard.unlock();
+
+                this->metrics.recordReply(message_type, telegram.getReceiveTime() - sent_time);
+
+                this->pipelineSlotAvailable.notify_all();
+
+                callback(std::move(telegram));
+                return;
+            }
+
+            // The reply to a telegram sent with sendTelegram(), it goes where any other telegram goes.
+            reply_to_raw_telegram = true;
+        }
+
+        // Keeping a reference, so the handler can be replaced while it is running.
+        std::shared_ptr<TelegramHandler> handler = this->telegramHandlers[message_type];
+
+        this->receivedTelegramsGuard.unlock();
+
+        if (reply_to_raw_telegram) {
+
+            this->pipelineSlotAvailable.notify_all();
+        }
+
+        if (handler) {
+
+            (*handler)(std::move(telegram));
+            return;
+        }
+    }
+
+    // Only the listener creates queues, so it can read the pointer relaxed.
+    ReceiveQueue *queue = this->receivedTelegrams[message_type].load(std::memory_order_relaxed);
+
+    if (queue == nullptr) {
+
+        queue = new ReceiveQueue();
+        this->receivedTelegrams[message_type].store(queue, std::memory_order_release);
+    }
+
+    const size_t size = telegram.size();
+
+    if (this->makeRoomForTelegram(size) == false) {
+
+        return;
+    }
+
+    // Counted before queueing, so a consumer never takes more than was counted.
+    const size_t telegrams = ++this->queued_telegrams;
+    const size_t bytes = (this->queued_bytes += size);
+
+    if (telegrams > this->high_water_telegrams) {
+        this->high_water_telegrams = telegrams;
+    }
+
+    if (bytes > this->high_water_bytes) {
+        this->high_water_bytes = bytes;
+    }
+
+    if (queue->overflow_count > 0 || queue->ring.tryPush(std::move(telegram)) == false) {
+
+        this->receivedTelegramsGuard.lock();
+
+        queue->overflow.push(std::move(telegram));
+        queue->overflow_count++;
+
+        this->receivedTelegramsGuard.unlock();
+
+        this->telegramsAvailable.notify_all();
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // wake up the client threads which are waiting for an incoming telegram
+    if (this->waiting_consumers > 0) {
+
+        // A waiter which has just checked the queue is inside wait() once it released the lock.
+        this->receivedTelegramsGuard.lock();
+        this->receivedTelegramsGuard.unlock();
+
+        this->telegramsAvailable.notify_all();
+    }
+}
+
+void ThalesRemoteConnection::telegramListenerJob() {
+
+    TelegramBuffer telegram;
+
+    while (this->receiving_worker_is_running) {
+
+        // Most of the time the thread will be blocking here
+        if (this->readTelegramFromSocket(telegram) == false) {
+
+            break;
+        }
+
+        if (telegram.size() > 0) {
+
+            this->queueTelegram(std::move(telegram));
+        }
+    }
+
+    this->finishReceiving();
+}
+
+void ThalesRemoteConnection::finishReceiving() {
+
+    // Nothing will arrive anymore, so nobody should keep waiting.
+    std::vector<ReplyCallback> unansweredRequests;
+
+    this->receivedTelegramsGuard.lock();
+
+    this->receiving_worker_is_running = false;
+
+    for (std::unique_ptr< std::deque<PendingReply> > &pendingRequests : this->pendingReplies) {
+
+        if (pendingRequests) {
+
+            for (PendingReply &pendingRequest : *pendingRequests) {
+
+                if (pendingRequest.callback) {
+                    unansweredRequests.push_back(std::move(pendingRequest.callback));
+                }
+            }
+
+            pendingRequests->clear();
+        }
+    }
+
+    this->outstanding_requests = 0;
+
+    this->receivedTelegramsGuard.unlock();
+
+    this->telegramsAvailable.notify_all();
+    this->pipelineSlotAvailable.notify_all();
+
+    for (ReplyCallback &callback : unansweredRequests) {
+
+        callback(TelegramBuffer());
+    }
+}
+
+bool ThalesRemoteConnection::withdrawPendingReply(uint8_t message_type, std::chrono::steady_clock::time_point sent_time, ReplyCallback &callback) {
+
+    std::unique_lock<std::mutex> queueLock(this->receivedTelegramsGuard);
+
+    std::unique_ptr< std::deque<PendingReply> > &pendingRequests = this->pendingReplies[message_type];
+
+    // The sender holds the send mutex, so nobody registered a request after it.
+    if (this->receiving_worker_is_running == false || !pendingRequests || pendingRequests->empty() || pendingRequests->back().sent_time != sent_time) {
+
+        return false;
+    }
+
+    callback = std::move(pendingRequests->back().callback);
+    pendingRequests->pop_back();
+    this->outstanding_requests--;
+
+    queueLock.unlock();
+
+    this->pipelineSlotAvailable.notify_all();
+
+    return true;
+}
+
+void ThalesRemoteConnection::startTelegramListener() {
+
+    if (!this->receiveBuffer) {
+        this->receiveBuffer.reset(new uint8_t[receive_buffer_size]);
+    }
+
+    this->receive_buffer_begin = 0;
+    this->receive_buffer_end = 0;
+
+    // Nothing of the last connection may block or answer the requests of this one.
+    std::vector<ReplyCallback> unansweredRequests;
+
+    this->receivedTelegramsGuard.lock();
+
+    for (std::unique_ptr< std::deque<PendingReply> > &pendingRequests : this->pendingReplies) {
+
+        if (pendingRequests) {
+
+            for (PendingReply &pendingRequest : *pendingRequests) {
+
+                if (pendingRequest.callback) {
+                    unansweredRequests.push_back(std::move(pendingRequest.callback));
+                }
+            }
+
+            pendingRequests->clear();
+        }
+    }
+
+    this->outstanding_requests = 0;
+
+    for (size_t i = 0; i < this->telegramHandlers.size(); ++i) {
+        this->handled_message_types[i] = static_cast<bool>(this->telegramHandlers[i]);
+    }
+
+    this->receiving_worker_is_running = true;
+
+    this->receivedTelegramsGuard.unlock();
+
+    for (ReplyCallback &callback : unansweredRequests) {
+
+        callback(TelegramBuffer());
+    }
+
+    if (this->reactor && this->reactor->attach(this, static_cast<int>(this->socket_handle))) {
+
+        this->attached_to_reactor = true;
+        return;
+    }
+
+    this->receivingWorker = new std::thread(&ThalesRemoteConnection::telegramListenerJob, this);
+}
+
+void ThalesRemoteConnection::stopTelegramListener() {
+
+    // Makes sure the blocking recv function returns so the thread
+    // can be shut down gracefully.
+    shutdown(this->socket_handle, SHUT_RD);
+
+    // A listener waiting for room in the queues has to give up as well.
+    this->receivedTelegramsGuard.lock();
+    this->receiving_worker_is_running = false;
+    this->receivedTelegramsGuard.unlock();
+
+    this->receiveQueueRoomAvailable.notify_all();
+
+    if (this->attached_to_reactor) {
+
+        this->reactor->detach(this);
+        this->attached_to_reactor = false;
+
+        this->finishReceiving();
+        return;
+    }
+
+    this->receivingWorker->join();
+
+    delete this->receivingWorker;
+    this->receivingWorker = nullptr;
 
-    return std::chrono::duration_cast<std::chrono::milliseconds >(std::chrono::system_clock::now().time_since_epoch());
+    this->telegramsAvailable.notify_all();
 }
 
 void ThalesRemoteConnection::closeSocket() {
@@ -28,15 +28,24 @@
 #define THALESREMOTECONNECTION_H
 
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
 #include <thread>
 #include <unistd.h>
-#include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <vector>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <deque>
+#include <future>
 
 #ifdef _WIN32
 
@@ -52,12 +61,28 @@
 #define INVALID_SOCKET -1
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
 
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#include "telegrambuffer.h"
+#include "telegramreactor.h"
+#include "connectionmetrics.h"
+#include "telegramcapture.h"
+
 class ThalesRemoteConnection
 {
 public:
@@ -67,98 +92,526 @@ public:
 
     /** Connect to Term (The Thales Terminal)
      *
-     * \param [in] address the hostname or ip-address of the host running Term
-     * \returns true on success, false if failed
+     * Returns as soon as the TCP connection is established and the registration
+     * has been sent. Term processes the telegrams of a connection in order, so
+     * it is not necessary to wait before sending the first commands.
      *
-     * \todo actually just hangs if the host is up but Term has not been started.
+     * \param [in] address the hostname or ip-address of the host running Term
+     * \param [in] connectionName the name this client registers with, e.g. "ScriptRemote".
+     * \param [in] timeout the maximal time to wait for the TCP connection to be established.
+     * \param [in] port the TCP port Term is listening on. Only needs to be changed for simulators.
+     * \returns true on success, false if failed or the timeout was reached
      */
-    bool connectToTerm(std::string address, std::string connectionName);
+    bool connectToTerm(std::string address, std::string connectionName,
+                       const std::chrono::duration<int, std::milli> timeout = std::chrono::milliseconds(5000),
+                       unsigned short port = term_port);
 
     /** Close the connection to Term and cleanup.
      *
      * Stops the thread used for receiving telegrams assynchronously and shuts down
-     * the network connection.
+     * the network connection. Has to be called as well after Term closed the
+     * connection and does nothing if there is no connection.
      */
     void disconnectFromTerm();
 
     /** Check if the connection to Term is open.
      *
-     * \returns true if connected, false if not.
+     * \returns true if connected, false if not or if Term has closed the connection.
      */
     bool isConnectedToTerm() const;
 
+    /** Lets the reactor receive the telegrams instead of a thread of this connection.
+     *
+     * Has to be set before connectToTerm(). Several connections can share one
+     * reactor, which saves a thread per connection. Telegram handlers and
+     * reply callbacks then run on the reactor thread. If the reactor is not
+     * supported on this platform the connection uses its own thread.
+     *
+     * \param [in] reactor the reactor or nullptr for an own thread.
+     */
+    void setReactor(std::shared_ptr<TelegramReactor> reactor);
+
+    /** Counts the successful connects, so users can tell that the connection has been reestablished.
+     *
+     * \returns a number which changes with every connectToTerm().
+     */
+    unsigned long getConnectionGeneration() const;
+
+    enum SocketProfile {
+        /** TCP_NODELAY, everything else as the operating system sets it. */
+        SOCKET_PROFILE_DEFAULT,
+        /** For request/reply: TCP_NODELAY, busy polling, quick keepalive and a real-time listener thread. */
+        SOCKET_PROFILE_LOW_LATENCY,
+        /** For streaming many telegrams: Nagle's algorithm coalesces small telegrams, large socket buffers. */
+        SOCKET_PROFILE_THROUGHPUT
+    };
+
+    /** The socket options of the connection and the scheduling of its listener thread. */
+    struct SocketSettings {
+
+        /** TCP_NODELAY, disables Nagle's algorithm. */
+        bool no_delay = true;
+
+        /** SO_RCVBUF and SO_SNDBUF in bytes, 0 keeps the automatic sizing of the operating system. */
+        int receive_buffer_size = 0;
+        int send_buffer_size = 0;
+
+        /** Probes an idle connection, so a vanished instrument is noticed. The times are in seconds, 0 keeps the system default. */
+        bool keep_alive = false;
+        int keep_alive_idle = 0;
+        int keep_alive_interval = 0;
+        int keep_alive_count = 0;
+
+        /** SO_BUSY_POLL, the microseconds a blocking receive polls the network device before it sleeps, 0 for off. Linux only. */
+        int busy_poll = 0;
+
+        /** The CPU the listener thread is pinned to, -1 for any. Linux only. */
+        int listener_cpu = -1;
+
+        /** The SCHED_FIFO priority of the listener thread, 0 for normal scheduling. Needs the privilege to raise priorities. */
+        int listener_priority = 0;
+
+        /** The settings of a profile. */
+        static SocketSettings forProfile(SocketProfile profile);
+    };
+
+    /** Selects the socket settings of the following connectToTerm() calls.
+     *
+     * The default is SOCKET_PROFILE_DEFAULT. The listener settings only apply
+     * to the own listener thread of the connection, not to a TelegramReactor.
+     *
+     * \param [in] profile the profile.
+     */
+    void setSocketProfile(SocketProfile profile);
+
+    /** Like setSocketProfile() with settings of your own, e.g. a profile with the listener_cpu set. */
+    void setSocketSettings(const SocketSettings &settings);
+    SocketSettings getSocketSettings() const;
+
+    /** The settings which took effect with the last connectToTerm().
+     *
+     * The socket options are read back from the socket, so settings the
+     * operating system refused or adjusted show their actual value. Linux
+     * e.g. reports twice the buffer sizes which were set and keeps busy
+     * polling off without the privilege to raise it. The listener settings
+     * are -1 and 0 if they could not be applied.
+     */
+    SocketSettings getEffectiveSocketSettings() const;
+
     /** Send a telegram (data) to Term)
      *
-     * \param [in] payload the actual data which is being sent to Term.
+     * The header and the payload are written with a single vectored send call
+     * straight from the caller's memory. Telegrams sent from several threads
+     * at the same time don't get mixed up.
+     *
+     * If requests of the same message type sent with sendTelegramAndExpectReply()
+     * are still waiting for their replies, Term answers this telegram after
+     * them. Its reply is then put into the queue, where waitForTelegram()
+     * finds it, instead of being taken for the reply to a request. Term has
+     * to answer such a telegram, otherwise the replies of the requests sent
+     * after it would go into the queue as well.
+     *
+     * \param [in] payload the actual data which is being sent to Term. At most 65535 bytes.
      * \param [in] message_type used internally by the DevCli dll. Depends on context. Most of the time 2.
+     * \returns true on success, false if the payload is too long or the connection failed.
      */
-    void sendTelegram(std::string payload, char message_type);
-    void sendTelegram(std::vector<unsigned char> payload, unsigned char message_type);
+    bool sendTelegram(std::string_view payload, uint8_t message_type);
+    bool sendTelegram(const std::vector<uint8_t> &payload, uint8_t message_type);
+    bool sendTelegram(const uint8_t *payload, size_t length, uint8_t message_type);
 
-    /** Block infinitely until the next Telegram is arriving.
+    /** Block infinitely until the next Telegram of the given message type is arriving.
      *
+     * Incoming telegrams are kept in a separate queue for every message type.
      * If some Telegram has already arrived it will just return the last one from the queue.
+     * Any number of threads may wait at the same time unless the queue mode is
+     * QUEUE_SINGLE_CONSUMER, they are all woken up if the connection is closed.
      *
+     * \param [in] message_type the message type of the telegram to wait for. Remote Script uses 2.
      * \returns the last received telegram or an empty string if someting went wrong.
      */
-    std::string waitForStringTelegram();
-    std::vector<uint8_t> waitForTelegram();
+    std::string waitForStringTelegram(uint8_t message_type = 2);
+    std::vector<uint8_t> waitForTelegram(uint8_t message_type = 2);
+    TelegramBuffer waitForTelegramBuffer(uint8_t message_type = 2);
 
-    /** Block maximal <timeout> milliseconds while waiting for an incoming telegram.
+    /** Block maximal <timeout> milliseconds while waiting for an incoming telegram of the given message type.
      *
      * If some Telegram has already arrived it will just return the last one from the queue.
+     * The timeout is measured with a monotonic clock, so changes of the system time don't matter.
      *
      * \returns the last received telegram or an empty string if the timeout was reached or something went wrong.
      */
-    std::string waitForStringTelegram(const std::chrono::duration<int, std::milli> timeout);
-    std::vector<uint8_t> waitForTelegram(const std::chrono::duration<int, std::milli> timeout);
+    std::string waitForStringTelegram(const std::chrono::duration<int, std::milli> timeout, uint8_t message_type = 2);
+    std::vector<uint8_t> waitForTelegram(const std::chrono::duration<int, std::milli> timeout, uint8_t message_type = 2);
+    TelegramBuffer waitForTelegramBuffer(const std::chrono::duration<int, std::milli> timeout, uint8_t message_type = 2);
 
-    /** Immediately return the last received telegram.
+    /** Immediately return the last received telegram of the given message type.
      *
      * \returns the last received telegram or an empty string if no telegram was received or something went wrong.
      */
-    std::string receiveStringTelegram();
-    std::vector<uint8_t> receiveTelegram();
+    std::string receiveStringTelegram(uint8_t message_type = 2);
+    std::vector<uint8_t> receiveTelegram(uint8_t message_type = 2);
+
+    /** Immediately return the last received telegram without copying it.
+     *
+     * The telegram's storage goes back to the pool of receive buffers as soon
+     * as the handle is destroyed, so receiving telegrams this way does not
+     * allocate memory once the pool is warmed up.
+     *
+     * \returns the last received telegram or an empty handle if no telegram was received.
+     */
+    TelegramBuffer receiveTelegramBuffer(uint8_t message_type = 2);
+
+    /** Hand the storage of a telegram returned by receiveTelegram() back for reuse.
+     *
+     * \param [in] telegram the telegram which is not needed anymore.
+     */
+    void recycleTelegram(std::vector<uint8_t> &&telegram);
 
     /** Convenience function: Send a telegram and wait for it's reply.
+     *
+     * The reply is expected with the same message type and matched with the
+     * request like for sendTelegramAndExpectReply(), so telegrams which are
+     * still in the queue or belong to other message types don't interfere.
      *
      * \param [in] payload the actual data which is being sent to Term.
      * \param [in] message_type used internally by the DevCli dll. Depends on context. Most of the time 2.
-     * \returns the last received telegram or an empty string if someting went wrong.
+     * \returns the reply or an empty string if someting went wrong.
+     */
+    std::string sendStringAndWaitForReplyString(std::string_view payload, uint8_t message_type);
+
+    /** Like sendStringAndWaitForReplyString() but returns the telegram, which knows when it arrived.
+     *
+     * \returns the reply or an empty handle if someting went wrong.
+     */
+    TelegramBuffer sendTelegramAndWaitForReply(std::string_view payload, uint8_t message_type);
+
+    typedef std::function<void(TelegramBuffer &&reply)> ReplyCallback;
+
+    /** Send a telegram and call back when its reply arrives.
+     *
+     * Several requests can be sent back to back without waiting for the
+     * replies (pipelining). Term answers the telegrams of a message type in
+     * order, so the replies are matched with the requests of the same message
+     * type in the order they were sent. Replies to pipelined requests are not
+     * put into the queue of their message type.
+     *
+     * If there are already as many unanswered requests as the pipeline depth
+     * allows, the call blocks until a reply arrives.
+     *
+     * The callback is called on the thread receiving the telegrams, so it
+     * should return quickly. If the connection is closed before the reply
+     * arrives, it is called with an empty telegram.
+     *
+     * \param [in] payload the actual data which is being sent to Term.
+     * \param [in] message_type used internally by the DevCli dll. Depends on context. Most of the time 2.
+     * \param [in] callback called with the reply.
+     * \returns true on success, false if the telegram could not be sent.
+     */
+    bool sendTelegramAndExpectReply(std::string_view payload, uint8_t message_type, ReplyCallback callback);
+
+    /** Pipelined version of sendStringAndWaitForReplyString.
+     *
+     * \returns a future which gets the reply, or an empty string if the connection failed.
+     * \sa sendTelegramAndExpectReply()
+     */
+    std::future<std::string> sendStringAndGetReplyFuture(std::string_view payload, uint8_t message_type);
+
+    /** Sets the maximal number of requests which may wait for their reply at the same time.
      *
-     * \warning If the queue is not empty the last received telegram will be returned. Recommended to flush the queue first.
-     * \sa clearIncomingTelegramQueue();
+     * \param [in] depth the window size, at least 1. The default is 16.
      */
-    std::string sendStringAndWaitForReplyString(std::string payload, char message_type);
+    void setPipelineDepth(size_t depth);
+    size_t getPipelineDepth();
+
+    /** The number of requests which have been sent and are waiting for their reply. */
+    size_t getOutstandingRequests();
 
-    /** Checks if there is some telegram in the queue.
+    /** Checks if there is some telegram of the given message type in the queue.
      *
      * \returns true if there is some telegram in the queue and false if not.
      */
-    bool telegramReceived();
+    bool telegramReceived(uint8_t message_type = 2);
 
-    /** Clears the queue of incoming telegrams.
+    /** Clears the queues of incoming telegrams of all message types.
      *
-     * All telegrams received to this point will be discarded.
+     * All telegrams received to this point will be discarded. In
+     * QUEUE_SINGLE_CONSUMER mode only the consumer thread may call it.
      *
      * \warning This does not stop new telegrams from being received after calling this method!
      */
     void clearIncomingTelegramQueue();
 
+    /** Handles the telegrams of a message type with a callback instead of queueing them.
+     *
+     * Meant for notifications which Term sends unsolicited. The handler is
+     * called on the thread receiving the telegrams, so it should return quickly.
+     *
+     * \param [in] message_type the message type to handle.
+     * \param [in] handler the callback, or an empty function to queue the telegrams again.
+     */
+    void setTelegramHandler(uint8_t message_type, std::function<void(TelegramBuffer &&telegram)> handler);
+
+    enum ReceiveQueueMode {
+        /** Any number of threads may take telegrams of the same message type, they take turns. */
+        QUEUE_MULTIPLE_CONSUMERS,
+        /** Only one thread at a time takes the telegrams of a message type, without any lock. */
+        QUEUE_SINGLE_CONSUMER
+    };
+
+    /** Selects how the telegram queues are consumed.
+     *
+     * The listener never locks the queues, it is the only producer. Consumers
+     * of the same message type are serialized by a mutex of the queue unless
+     * the mode is QUEUE_SINGLE_CONSUMER, which skips it. Consumers of
+     * different message types never contend. The default is QUEUE_MULTIPLE_CONSUMERS.
+     *
+     * \param [in] mode the mode, only change it while no thread is consuming.
+     */
+    void setReceiveQueueMode(ReceiveQueueMode mode);
+    ReceiveQueueMode getReceiveQueueMode() const;
+
+    /** What happens to a telegram which does not fit into the receive queues anymore. */
+    enum OverflowPolicy {
+        /** The listener stops reading from the socket until there is room, so TCP throttles Term. */
+        OVERFLOW_BLOCK,
+        /** The oldest queued telegram of any message type is discarded. */
+        OVERFLOW_DROP_OLDEST,
+        /** The telegram which just arrived is discarded. */
+        OVERFLOW_DROP_NEWEST
+    };
+
+    /** Limits the telegrams which are queued and not taken by a consumer yet.
+     *
+     * The limits count the telegrams of all message types together, telegrams
+     * delivered to reply callbacks and handlers don't count. Without limits the
+     * queues grow as long as there is memory.
+     *
+     * With OVERFLOW_BLOCK no reply can arrive while the listener waits, so
+     * threads waiting for replies have to be different from the ones emptying
+     * the queues. A blocked connection on a TelegramReactor stalls all
+     * connections of the reactor. OVERFLOW_DROP_OLDEST makes the listener take
+     * telegrams out of the queues, so consumers lock even in
+     * QUEUE_SINGLE_CONSUMER mode.
+     *
+     * \param [in] max_telegrams the maximal number of queued telegrams, 0 for no limit.
+     * \param [in] max_bytes the maximal sum of the payload sizes of the queued telegrams, 0 for no limit.
+     * \param [in] policy what to do with telegrams beyond the limits.
+     */
+    void setReceiveQueueLimits(size_t max_telegrams, size_t max_bytes, OverflowPolicy policy);
+
+    struct ReceiveQueueStatistics {
+
+        /** The telegrams and payload bytes waiting in the queues right now. */
+        size_t queued_telegrams;
+        size_t queued_bytes;
+
+        /** The maximum of the values above since the last resetReceiveQueueStatistics(). */
+        size_t high_water_telegrams;
+        size_t high_water_bytes;
+
+        unsigned long dropped_oldest;
+        unsigned long dropped_newest;
+
+        /** How often and how long the listener waited for room with OVERFLOW_BLOCK. */
+        unsigned long listener_blocks;
+        std::chrono::microseconds listener_blocked_time;
+    };
+
+    ReceiveQueueStatistics getReceiveQueueStatistics() const;
+
+    /** Sets the high-water marks to the current occupancy and the counters to 0. */
+    void resetReceiveQueueStatistics();
+
+    /** The counters and latency histograms of this connection.
+     *
+     * They count telegrams and bytes per message type, the latency of replies
+     * per message type, the time spent in waitForTelegram() and connectToTerm().
+     * ThalesRemoteScriptWrapper adds the latency of its commands.
+     */
+    ConnectionMetrics &getMetrics();
+
+    /** Copies the metrics together with the state of the receive queues, e.g. for exporting them. */
+    MetricsSnapshot getMetricsSnapshot();
+
+    /** Records every telegram sent to and received from Term into a capture file.
+     *
+     * The telegrams are recorded where they pass the socket, with the point
+     * in time they were handed to or taken from the socket, so the order in
+     * the capture is the order on the wire. The capture can be set and
+     * removed while the connection is running.
+     *
+     * \param [in] capture an open capture or nullptr to stop recording.
+     */
+    void setCapture(std::shared_ptr<TelegramCaptureWriter> capture);
+    std::shared_ptr<TelegramCaptureWriter> getCapture() const;
+
 protected:
 
     static const int term_port = 260;
 
     SOCKET socket_handle;
 
+    std::atomic<unsigned long> connection_generation;
+
+    /** Serializes the senders, so the bytes of telegrams don't interleave. */
+    std::mutex sendGuard;
+
+    /** Room for two telegrams of the maximal size including their headers. */
+    static const size_t receive_buffer_size = 2 * (0xffff + 3);
+
+    /** The bytes read from the socket which have not been taken as telegram yet
+     * are between receive_buffer_begin and receive_buffer_end.
+     *
+     * It is not cleared, so the operating system only provides the pages which
+     * telegrams have reached. Most telegrams are small and are moved to the
+     * front, so an idle connection costs little resident memory.
+     */
+    std::unique_ptr<uint8_t[]> receiveBuffer;
+    size_t receive_buffer_begin;
+    size_t receive_buffer_end;
+
+    std::shared_ptr<TelegramBufferPool> telegramBufferPool;
+
+    typedef std::function<void(TelegramBuffer &&telegram)> TelegramHandler;
+
+    /** The telegrams of one message type which wait for a consumer.
+     *
+     * The listener pushes into the ring without locking. If the ring is full
+     * the telegrams go into the overflow queue, which is protected by
+     * receivedTelegramsGuard, until the consumers have emptied it. The ring is
+     * emptied first, so the order is kept.
+     */
+    struct ReceiveQueue {
+
+        TelegramRing ring;
+        TelegramQueue overflow;
+        std::atomic<size_t> overflow_count;
+
+        /** Serializes the consumers in QUEUE_MULTIPLE_CONSUMERS mode. */
+        std::mutex consumerGuard;
+
+        ReceiveQueue() : overflow_count(0) {}
+    };
+
     std::mutex receivedTelegramsGuard;
-    std::queue< std::vector<uint8_t> > receivedTelegrams;
 
-    std::timed_mutex telegramsAvailableMutex;
+    /** One queue per message type, created by the listener when the first telegram of a type arrives. */
+    std::array<std::atomic<ReceiveQueue *>, 256> receivedTelegrams;
+
+    std::array<std::shared_ptr<TelegramHandler>, 256> telegramHandlers;
 
-    bool receiving_worker_is_running;
+    /** Set for the message types with a handler, so the listener can check without locking. */
+    std::array<std::atomic<bool>, 256> handled_message_types;
+
+    /** The number of threads blocking in waitForTelegram, the listener only notifies if there are some. */
+    std::atomic<size_t> waiting_consumers;
+
+    std::atomic<bool> single_consumer;
+
+    /** The limits are only changed under receivedTelegramsGuard. */
+    std::atomic<size_t> max_queued_telegrams;
+    std::atomic<size_t> max_queued_bytes;
+    std::atomic<OverflowPolicy> overflow_policy;
+
+    /** Incremented by the listener before queueing, decremented by the consumers after taking. */
+    std::atomic<size_t> queued_telegrams;
+    std::atomic<size_t> queued_bytes;
+
+    std::atomic<size_t> high_water_telegrams;
+    std::atomic<size_t> high_water_bytes;
+    std::atomic<unsigned long> dropped_oldest_telegrams;
+    std::atomic<unsigned long> dropped_newest_telegrams;
+    std::atomic<unsigned long> listener_blocks;
+    std::atomic<int64_t> listener_blocked_microseconds;
+
+    /** Set while the listener waits for room, the consumers only notify then. */
+    std::atomic<bool> listener_waiting_for_room;
+
+    /** Signaled when a consumer took a telegram while the listener waits for room. */
+    std::condition_variable receiveQueueRoomAvailable;
+
+    /** A request waiting for its reply. The callback is empty for telegrams sent with sendTelegram(), their reply is queued. */
+    struct PendingReply {
+        ReplyCallback callback;
+        std::chrono::steady_clock::time_point sent_time;
+    };
+
+    /** The callbacks of the requests waiting for their reply, per message type. */
+    std::array<std::unique_ptr< std::deque<PendingReply> >, 256> pendingReplies;
+    size_t pipeline_depth;
+
+    /** Changed under receivedTelegramsGuard, read without lock by the listener. */
+    std::atomic<size_t> outstanding_requests;
+
+    /** Signaled when a request got its reply and the pipeline has room again. */
+    std::condition_variable pipelineSlotAvailable;
+
+    /** Signaled when a telegram has been queued or the listener stopped. */
+    std::condition_variable telegramsAvailable;
+
+    std::atomic<bool> receiving_worker_is_running;
     std::thread *receivingWorker;
 
+    std::shared_ptr<TelegramReactor> reactor;
+    bool attached_to_reactor;
+
+    ConnectionMetrics metrics;
+
+    /** Only accessed with std::atomic_load and std::atomic_store. */
+    std::shared_ptr<TelegramCaptureWriter> capture;
+
+    /** Set while a capture is set, so the telegrams are only recorded then without touching the pointer. */
+    std::atomic<bool> capturing;
+
+    void captureTelegram(CaptureDirection direction, uint8_t message_type, const uint8_t *payload, size_t length, std::chrono::steady_clock::time_point time);
+
+    SocketSettings socket_settings;
+    SocketSettings effective_socket_settings;
+
+    /** Applies the socket options and reads back the ones which took effect. */
+    void applySocketSettings();
+
+    /** Applies the affinity and the priority to the listener thread. */
+    void applyListenerSettings();
+
+    /** connectToTerm() without the metrics. */
+    bool establishConnection(std::string address, std::string connectionName, const std::chrono::duration<int, std::milli> timeout, unsigned short port);
+
+    friend class TelegramReactor;
+
+    /** Called by the reactor when the socket is readable.
+     *
+     * Reads one chunk without blocking and queues the complete telegrams.
+     *
+     * \returns false if the socket has been shut down or an error occured.
+     */
+    bool receiveAvailableTelegrams();
+
+    /** Wakes up everybody waiting for telegrams once nothing will arrive anymore. */
+    void finishReceiving();
+
+    /** Takes back the last pending reply of the message type after its telegram could not be sent.
+     *
+     * \param [in] message_type the message type of the telegram.
+     * \param [in] sent_time the time the pending reply was registered with.
+     * \param [out] callback the callback of the pending reply.
+     * \returns false if finishReceiving() has already completed the pending reply.
+     */
+    bool withdrawPendingReply(uint8_t message_type, std::chrono::steady_clock::time_point sent_time, ReplyCallback &callback);
+
+    /** Takes the next complete telegram out of the receive buffer.
+     *
+     * \returns false if the buffer does not hold a complete telegram.
+     */
+    bool takeTelegramFromBuffer(TelegramBuffer &telegram);
+
+    /** Appends the received data to the receive buffer.
+     *
+     * \param [in] flags passed to recv, e.g. MSG_DONTWAIT.
+     * \returns the number of received bytes, 0 if the socket has been shut down or -1 on errors.
+     */
+    long receiveIntoBuffer(int flags);
+
     /** The method running in a separate thread, pushing the
      * incomming packets into the queue.
      */
@@ -170,11 +623,64 @@ protected:
     /** Stops the thread handling the incoming data gracefully. */
     void stopTelegramListener();
 
-    /** Reads the raw telegram structure from the socket stream. */
-    std::vector<uint8_t> readTelegramFromSocket();
+    /** Connects the socket without blocking longer than the timeout.
+     *
+     * \returns true if the connection was established, false if it failed or the timeout was reached.
+     */
+    bool connectSocket(const struct sockaddr *address, size_t address_length, const std::chrono::duration<int, std::milli> timeout);
+
+    /** Reads the next raw telegram structure from the socket stream.
+     *
+     * \param [out] telegram the payload of the telegram.
+     * \returns true on success, false if the socket has been shut down or an error occured.
+     */
+    bool readTelegramFromSocket(TelegramBuffer &telegram);
+
+    /** Writes a telegram to the socket. sendGuard has to be locked. */
+    bool writeTelegram(const uint8_t *payload, size_t length, uint8_t message_type);
+
+    /** Makes a telegram read from the socket available to the consumers. */
+    void queueTelegram(TelegramBuffer &&telegram);
+
+    /** Takes the oldest telegram of the given type out of the queue. receivedTelegramsGuard must not be locked.
+     *
+     * \returns the telegram or an empty handle if there is none.
+     */
+    TelegramBuffer popTelegram(uint8_t message_type);
+
+    /** Checks for telegrams of the given type without locking. */
+    bool hasTelegram(uint8_t message_type) const;
+
+    /** Checks if one more telegram of the given size fits into the limits. */
+    bool hasRoomForTelegram(size_t size) const;
+
+    /** Makes room for the telegram according to the overflow policy. Only called by the listener.
+     *
+     * \returns false if the telegram has to be dropped.
+     */
+    bool makeRoomForTelegram(size_t size);
+
+    /** Takes the oldest telegram of all message types out of the queues. Only called by the listener.
+     *
+     * \returns false if all queues are empty.
+     */
+    bool dropOldestTelegram();
 
-    /** Helper function getting the current time in milliseconds. */
-    std::chrono::milliseconds getCurrentTimeInMilliseconds() const;
+    /** Takes the oldest telegram out of the queue. consumerGuard of the queue has to be locked unless the consumer is alone. */
+    TelegramBuffer takeFromQueue(ReceiveQueue *queue);
+
+    /** Accounts for telegrams taken out of the queues and wakes up the listener waiting for room. */
+    void releaseQueuedTelegrams(size_t telegrams, size_t bytes);
+
+    /** Checks if the consumers have to lock the queues. */
+    bool consumersLock() const;
+
+    /** Blocks until a telegram of the given type is queued, the deadline has passed or the listener stopped.
+     *
+     * \param [in] deadline the deadline or nullptr to wait infinitely.
+     * \returns the telegram or an empty handle.
+     */
+    TelegramBuffer waitForQueuedTelegram(uint8_t message_type, const std::chrono::steady_clock::time_point *deadline);
 
     void closeSocket();
 
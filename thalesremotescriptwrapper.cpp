@@ -26,178 +26,736 @@
 
 #include "thalesremotescriptwrapper.h"
 
+#include <cctype>
+
 ThalesRemoteScriptWrapper::ThalesRemoteScriptWrapper(ThalesRemoteConnection * const remoteConnection) :
-    remoteConnection(remoteConnection)
+    remoteConnection(remoteConnection),
+    setpoint_cache_enabled(true),
+    cache_epoch(0),
+    cache_connection_generation(remoteConnection->getConnectionGeneration()),
+    saved_round_trips(0),
+    suppressed_setpoints(0)
 {
 
 }
 
 std::string ThalesRemoteScriptWrapper::executeRemoteCommand(std::string command) {
-    return remoteConnection->sendStringAndWaitForReplyString("1:" + command + ":", 2);
+
+    this->invalidateSetpointCache();
+
+    return this->sendRemoteCommand(command);
+}
+
+ThalesRemoteScriptWrapper::BatchReply ThalesRemoteScriptWrapper::executeBatch(const CommandBatch &batch) {
+
+    SetpointWrites writes;
+
+    std::string commands = this->removeKnownSetpoints(batch, writes);
+
+    if (commands.empty() && batch.empty() == false) {
+
+        return BatchReply(std::string());
+    }
+
+    std::string reply = this->sendRemoteCommand(commands);
+
+    this->acknowledgeSetpoints(writes, isAcknowledged(reply));
+
+    return BatchReply(std::move(reply));
+}
+
+std::future<std::string> ThalesRemoteScriptWrapper::submitRemoteCommand(std::string command) {
+
+    this->invalidateSetpointCache();
+
+    return remoteConnection->sendStringAndGetReplyFuture("1:" + command + ":", 2);
+}
+
+std::future<std::string> ThalesRemoteScriptWrapper::submitBatch(const CommandBatch &batch) {
+
+    std::shared_ptr< std::promise<std::string> > promise = std::make_shared< std::promise<std::string> >();
+    std::future<std::string> future = promise->get_future();
+
+    this->executeBatchAsync(batch, [promise](BatchReply &&reply) {
+        promise->set_value(reply.getReply());
+    });
+
+    return future;
+}
+
+void ThalesRemoteScriptWrapper::executeBatchAsync(const CommandBatch &batch, BatchCallback callback) {
+
+    SetpointWrites writes;
+
+    std::string commands = this->removeKnownSetpoints(batch, writes);
+
+    if (commands.empty() && batch.empty() == false) {
+
+        callback(BatchReply(std::string()));
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string name(getCommandName(commands));
+
+    remoteConnection->sendTelegramAndExpectReply("1:" + commands + ":", 2, [this, start, name = std::move(name), writes = std::move(writes), callback = std::move(callback)](TelegramBuffer &&reply) {
+
+        this->acknowledgeSetpoints(writes, isAcknowledged(std::string_view(reinterpret_cast<const char *>(reply.data()), reply.size())));
+
+        std::chrono::steady_clock::time_point receive_time = reply.getReceiveTime();
+        bool replied = (reply.empty() == false);
+
+        callback(BatchReply(std::string(reinterpret_cast<const char *>(reply.data()), reply.size())));
+
+        // The callback delivers the result, so it counts as overhead.
+        if (replied) {
+
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            this->remoteConnection->getMetrics().recordCommand(name, end - start, end - receive_time);
+        }
+    });
+}
+
+std::future<ThalesRemoteScriptWrapper::BatchReply> ThalesRemoteScriptWrapper::executeBatchAsync(const CommandBatch &batch) {
+
+    std::shared_ptr< std::promise<BatchReply> > promise = std::make_shared< std::promise<BatchReply> >();
+    std::future<BatchReply> future = promise->get_future();
+
+    this->executeBatchAsync(batch, [promise](BatchReply &&reply) {
+        promise->set_value(std::move(reply));
+    });
+
+    return future;
 }
 
 void ThalesRemoteScriptWrapper::forceThalesIntoRemoteScript() {
 
+    this->invalidateSetpointCache();
+
     remoteConnection->sendStringAndWaitForReplyString("2,ScriptRemote", 0x80);
 }
 
 double ThalesRemoteScriptWrapper::getCurrent() {
 
-    return this->requestValueAndParseUsingRegexp("CURRENT", std::regex("current=\\s*(.*?)A?:"));
+    return this->executeBatch(CommandBatch().queryCurrent()).getCurrent();
 }
 
 double ThalesRemoteScriptWrapper::getPotential() {
 
-    return this->requestValueAndParseUsingRegexp("POTENTIAL", std::regex("potential=\\s*(.*?)V?:"));
+    return this->executeBatch(CommandBatch().queryPotential()).getPotential();
+}
+
+std::future<double> ThalesRemoteScriptWrapper::getCurrentAsync() {
+
+    return this->requestAsync(CommandBatch().queryCurrent(), &BatchReply::getCurrent);
+}
+
+std::future<double> ThalesRemoteScriptWrapper::getPotentialAsync() {
+
+    return this->requestAsync(CommandBatch().queryPotential(), &BatchReply::getPotential);
 }
 
 void ThalesRemoteScriptWrapper::setCurrent(double current) {
 
-    this->setValue("Cset", current);
+    this->executeBatch(CommandBatch().setCurrent(current));
 }
 
 void ThalesRemoteScriptWrapper::setPotential(double potential) {
 
-
-    this->setValue("Pset", potential);
+    this->executeBatch(CommandBatch().setPotential(potential));
 }
 
 void ThalesRemoteScriptWrapper::enablePotentiostat(bool enabled) {
 
-    if (enabled == true) {
+    this->executeBatch(CommandBatch().enablePotentiostat(enabled));
+}
+
+void ThalesRemoteScriptWrapper::setPotentiostatMode(ThalesRemoteScriptWrapper::PotentiostatMode potentiostatMode)
+{
+    CommandBatch batch;
+
+    batch.setPotentiostatMode(potentiostatMode);
 
-        this->executeRemoteCommand("Pot=-1");
-    } else {
+    if (batch.empty() == false) {
 
-        this->executeRemoteCommand("Pot=0");
+        this->executeBatch(batch);
     }
 }
 
-void ThalesRemoteScriptWrapper::setPotentiostatMode(ThalesRemoteScriptWrapper::PotentiostatMode potentiostatMode)
-{
-    std::string command;
+void ThalesRemoteScriptWrapper::setFrequency(double frequency) {
+
+    this->executeBatch(CommandBatch().setFrequency(frequency));
+}
+
+void ThalesRemoteScriptWrapper::setAmplitude(double amplitude) {
+
+    this->executeBatch(CommandBatch().setAmplitude(amplitude));
+}
+
+void ThalesRemoteScriptWrapper::setValue(std::string name, double value) {
+
+    this->executeBatch(CommandBatch().setValue(name, value));
+}
+
+void ThalesRemoteScriptWrapper::setValue(std::string name, int value) {
+
+    this->executeBatch(CommandBatch().setValue(name, value));
+}
+
+void ThalesRemoteScriptWrapper::setNumberOfPeriods(int number_of_periods) {
+
+    this->executeBatch(CommandBatch().setNumberOfPeriods(number_of_periods));
+}
+
+std::complex<double> ThalesRemoteScriptWrapper::getImpedance() {
+
+    return this->executeBatch(CommandBatch().queryImpedance()).getImpedance();
+}
+
+std::complex<double> ThalesRemoteScriptWrapper::getImpedance(double frequency) {
+
+    return this->executeBatch(CommandBatch().setFrequency(frequency).queryImpedance()).getImpedance();
+}
+
+std::complex<double> ThalesRemoteScriptWrapper::getImpedance(double frequency, double amplitude, int number_of_periods) {
+
+    CommandBatch batch;
+
+    batch.setFrequency(frequency);
+    batch.setAmplitude(amplitude);
+    batch.setNumberOfPeriods(number_of_periods);
+    batch.queryImpedance();
+
+    return this->executeBatch(batch).getImpedance();
+}
+
+std::future< std::complex<double> > ThalesRemoteScriptWrapper::getImpedanceAsync() {
+
+    return this->requestAsync(CommandBatch().queryImpedance(), &BatchReply::getImpedance);
+}
+
+std::future< std::complex<double> > ThalesRemoteScriptWrapper::getImpedanceAsync(double frequency) {
+
+    return this->requestAsync(CommandBatch().setFrequency(frequency).queryImpedance(), &BatchReply::getImpedance);
+}
+
+std::future< std::complex<double> > ThalesRemoteScriptWrapper::getImpedanceAsync(double frequency, double amplitude, int number_of_periods) {
+
+    CommandBatch batch;
+
+    batch.setFrequency(frequency);
+    batch.setAmplitude(amplitude);
+    batch.setNumberOfPeriods(number_of_periods);
+    batch.queryImpedance();
+
+    return this->requestAsync(batch, &BatchReply::getImpedance);
+}
+
+void ThalesRemoteScriptWrapper::setSetpointCacheEnabled(bool enabled) {
+
+    std::lock_guard<std::mutex> lock(this->setpointCacheGuard);
+
+    this->setpoint_cache_enabled = enabled;
+}
+
+void ThalesRemoteScriptWrapper::invalidateSetpointCache() {
+
+    std::lock_guard<std::mutex> lock(this->setpointCacheGuard);
+
+    this->forgetSetpoints();
+}
+
+unsigned long ThalesRemoteScriptWrapper::getSavedRoundTrips() {
+
+    std::lock_guard<std::mutex> lock(this->setpointCacheGuard);
+
+    return this->saved_round_trips;
+}
+
+unsigned long ThalesRemoteScriptWrapper::getSuppressedSetpoints() {
+
+    std::lock_guard<std::mutex> lock(this->setpointCacheGuard);
+
+    return this->suppressed_setpoints;
+}
+
+std::string ThalesRemoteScriptWrapper::sendRemoteCommand(const std::string &command) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    TelegramBuffer reply = remoteConnection->sendTelegramAndWaitForReply("1:" + command + ":", 2);
+
+    std::string replyString(reinterpret_cast<const char *>(reply.data()), reply.size());
+
+    if (reply.empty() == false) {
+
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        remoteConnection->getMetrics().recordCommand(getCommandName(command), end - start, end - reply.getReceiveTime());
+    }
+
+    return replyString;
+}
+
+std::string_view ThalesRemoteScriptWrapper::getCommandName(std::string_view commands) {
+
+    while (commands.empty() == false && commands.back() == ':') {
+
+        commands.remove_suffix(1);
+    }
+
+    size_t separator = commands.rfind(':');
+
+    if (separator != std::string_view::npos) {
+
+        commands.remove_prefix(separator + 1);
+    }
+
+    return commands.substr(0, commands.find('='));
+}
+
+std::string ThalesRemoteScriptWrapper::removeKnownSetpoints(const CommandBatch &batch, SetpointWrites &writes) {
+
+    std::lock_guard<std::mutex> lock(this->setpointCacheGuard);
+
+    const unsigned long connection_generation = this->remoteConnection->getConnectionGeneration();
+
+    if (connection_generation != this->cache_connection_generation) {
+
+        // A new connection may well be a restarted Thales.
+        this->forgetSetpoints();
+        this->cache_connection_generation = connection_generation;
+    }
+
+    writes.cache_epoch = this->cache_epoch;
+
+    const std::string_view commands = batch.getCommands();
+
+    std::string remainingCommands;
+    remainingCommands.reserve(commands.size());
+
+    size_t commands_in_batch = 0;
+    size_t suppressed_in_batch = 0;
+
+    // The batch knows where its cached setpoints start, so their names are not looked up again.
+    std::vector<CommandBatch::SetpointPosition>::const_iterator nextSetpoint = batch.setpoints.begin();
+
+    for (size_t position = 0; position < commands.size();) {
+
+        size_t separator = commands.find(':', position);
+        size_t end = (separator == std::string_view::npos) ? commands.size() : separator;
+
+        std::string_view command = commands.substr(position, end - position);
+
+        bool is_cached_setpoint = (nextSetpoint != batch.setpoints.end() && nextSetpoint->begin == position);
+        size_t slot = is_cached_setpoint ? (nextSetpoint++)->slot : 0;
+
+        position = end + 1;
+        commands_in_batch++;
+
+        if (this->setpoint_cache_enabled && is_cached_setpoint) {
+
+            CachedSetpoint &setpoint = this->setpointCache[slot];
+
+            std::string_view value = command.substr(ThalesRemoteCommands::cached_setpoints[slot].size() + 1);
+
+            // While a write is in flight, the value Remote Script will end up with is not known yet.
+            if (setpoint.writes_in_flight == 0 && setpoint.acknowledged_value == value) {
+
+                suppressed_in_batch++;
+                continue;
+            }
+
+            setpoint.writes_in_flight++;
+            writes.values.emplace_back(slot, std::string(value));
+        }
+
+        if (remainingCommands.empty() == false) {
+
+            remainingCommands += ":";
+        }
+
+        remainingCommands += command;
+    }
+
+    this->suppressed_setpoints += suppressed_in_batch;
+
+    if (commands_in_batch > 0 && suppressed_in_batch == commands_in_batch) {
+
+        this->saved_round_trips++;
+    }
+
+    return remainingCommands;
+}
+
+void ThalesRemoteScriptWrapper::forgetSetpoints() {
+
+    this->cache_epoch++;
+
+    for (CachedSetpoint &setpoint : this->setpointCache) {
+
+        setpoint.acknowledged_value.clear();
+    }
+}
+
+bool ThalesRemoteScriptWrapper::isAcknowledged(std::string_view reply) {
+
+    if (reply.empty()) {
+
+        return false;
+    }
+
+    // Remote Script reports rejected commands with "error" or "ERROR" in the reply.
+    for (size_t position = 0; position + 5 <= reply.size(); ++position) {
+
+        bool matches = true;
+
+        for (size_t i = 0; i < 5 && matches; ++i) {
+            matches = (std::tolower(static_cast<unsigned char>(reply[position + i])) == "error"[i]);
+        }
+
+        if (matches) {
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ThalesRemoteScriptWrapper::acknowledgeSetpoints(const SetpointWrites &writes, bool acknowledged) {
+
+    std::lock_guard<std::mutex> lock(this->setpointCacheGuard);
+
+    for (const std::pair<size_t, std::string> &write : writes.values) {
+
+        CachedSetpoint &setpoint = this->setpointCache[write.first];
+
+        setpoint.writes_in_flight--;
+
+        if (writes.cache_epoch != this->cache_epoch) {
+
+            continue;
+        }
+
+        if (acknowledged) {
+
+            setpoint.acknowledged_value = write.second;
+
+        } else {
+
+            setpoint.acknowledged_value.clear();
+        }
+    }
+}
+
+double ThalesRemoteScriptWrapper::parseValue(std::string_view reply, std::string_view key) {
+
+    std::string_view text = findValue(reply, key);
+
+    double value;
+
+    if (parseNumber(text.data(), text.data() + text.size(), value) == nullptr) {
+
+        return std::nan("1");
+    }
+
+    return value;
+}
+
+std::complex<double> ThalesRemoteScriptWrapper::parseImpedance(std::string_view reply) {
+
+    return parse<ThalesRemoteCommands::Impedance>(reply);
+}
+
+std::complex<double> ThalesRemoteScriptWrapper::parseComplexValue(std::string_view reply, std::string_view key) {
+
+    const std::complex<double> invalid(std::nan("1"), std::nan("1"));
+
+    std::string_view text = findValue(reply, key);
+
+    const char *end = text.data() + text.size();
+
+    double real;
+    double imaginary;
+
+    const char *position = parseNumber(text.data(), end, real);
+
+    if (position == nullptr) {
+
+        return invalid;
+    }
+
+    // Skip whatever follows the real part up to the separator, like a unit.
+    while (position != end && *position != ',') {
+        position++;
+    }
+
+    if (position == end || parseNumber(position + 1, end, imaginary) == nullptr) {
+
+        return invalid;
+    }
+
+    return std::complex<double>(real, imaginary);
+}
+
+std::string_view ThalesRemoteScriptWrapper::formatValue(char *buffer, size_t size, double value) {
+
+    std::to_chars_result result = std::to_chars(buffer, buffer + size, value);
+
+    if (result.ec != std::errc()) {
+
+        return std::string_view();
+    }
+
+    return std::string_view(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+std::string_view ThalesRemoteScriptWrapper::formatValue(char *buffer, size_t size, int value) {
+
+    std::to_chars_result result = std::to_chars(buffer, buffer + size, value);
+
+    if (result.ec != std::errc()) {
+
+        return std::string_view();
+    }
+
+    return std::string_view(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+const char *ThalesRemoteScriptWrapper::parseNumber(const char *begin, const char *end, double &value) {
+
+    // The same characters the stream extraction skipped, including line breaks.
+    while (begin != end && std::isspace(static_cast<unsigned char>(*begin))) {
+        begin++;
+    }
+
+    if (begin != end && *begin == '+') {
+        begin++;
+    }
+
+    std::from_chars_result result = std::from_chars(begin, end, value);
+
+    if (result.ec != std::errc()) {
+
+        return nullptr;
+    }
+
+    return result.ptr;
+}
+
+std::string_view ThalesRemoteScriptWrapper::findValue(std::string_view reply, std::string_view key) {
+
+    size_t position = 0;
+
+    while ((position = reply.find(key, position)) != std::string_view::npos) {
+
+        position += key.size();
+
+        if (position < reply.size() && reply[position] == '=') {
+
+            std::string_view value = reply.substr(position + 1);
+
+            return value.substr(0, value.find(':'));
+        }
+    }
+
+    return std::string_view();
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setCurrent(double current) {
+
+    return this->set<ThalesRemoteCommands::CurrentSetpoint>(current);
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setPotential(double potential) {
+
+    return this->set<ThalesRemoteCommands::PotentialSetpoint>(potential);
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::enablePotentiostat(bool enabled) {
+
+    return this->set<ThalesRemoteCommands::Potentiostat>(enabled);
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setPotentiostatMode(PotentiostatMode potentiostatMode) {
 
     switch(potentiostatMode) {
 
     case POTMODE_POTENTIOSTATIC:
 
-        command = "Gal=0:GAL=0";
-        break;
+        return this->set<ThalesRemoteCommands::Galvanostatic>(false).set<ThalesRemoteCommands::GalvanostaticMode>(0);
 
     case POTMODE_GALVANOSTATIC:
 
-        command = "Gal=-1:GAL=1";
-        break;
+        return this->set<ThalesRemoteCommands::Galvanostatic>(true).set<ThalesRemoteCommands::GalvanostaticMode>(1);
 
     case POTMODE_PSEUDOGALVANOSTATIC:
 
-        command = "Gal=0:GAL=-1";
-        break;
+        return this->set<ThalesRemoteCommands::Galvanostatic>(false).set<ThalesRemoteCommands::GalvanostaticMode>(-1);
 
     default:
-        return;
         break;
     }
 
-    this->executeRemoteCommand(command);
+    return *this;
 }
 
-void ThalesRemoteScriptWrapper::setFrequency(double frequency) {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setFrequency(double frequency) {
 
-    this->setValue("Frq", frequency);
+    return this->set<ThalesRemoteCommands::Frequency>(frequency);
 }
 
-void ThalesRemoteScriptWrapper::setAmplitude(double amplitude) {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setAmplitude(double amplitude) {
 
-    this->setValue("Ampl", amplitude * 1e3);
+    return this->set<ThalesRemoteCommands::Amplitude>(amplitude);
 }
 
-void ThalesRemoteScriptWrapper::setValue(std::string name, double value) {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setNumberOfPeriods(int number_of_periods) {
 
-    this->executeRemoteCommand(name + "=" + std::to_string(value));
+    // little bits of stability, the range of NumberOfPeriods is 1 to 100
+    return this->set<ThalesRemoteCommands::NumberOfPeriods>(number_of_periods);
 }
 
-void ThalesRemoteScriptWrapper::setValue(std::string name, int value) {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setValue(std::string_view name, double value) {
+
+    char number[max_formatted_value_length];
 
-    this->executeRemoteCommand(name + "=" + std::to_string(value));
+    return this->appendSetpoint(name, formatValue(number, sizeof(number), value));
 }
 
-void ThalesRemoteScriptWrapper::setNumberOfPeriods(int number_of_periods) {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::setValue(std::string_view name, int value) {
 
-    // little bits of stability
+    char number[max_formatted_value_length];
 
-    if (number_of_periods > 100) {
-        number_of_periods = 100;
-    }
+    return this->appendSetpoint(name, formatValue(number, sizeof(number), value));
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::appendSetpoint(std::string_view name, std::string_view value) {
+
+    if (this->commands.empty() == false) {
 
-    if (number_of_periods < 1) {
-        number_of_periods = 1;
+        this->commands += ":";
     }
 
-    this->executeRemoteCommand("Nw=" + std::to_string(number_of_periods));
+    this->recordSetpoint(ThalesRemoteCommands::cacheSlot(name));
+
+    this->commands += name;
+    this->commands += "=";
+    this->commands += value;
+
+    return *this;
 }
 
-std::complex<double> ThalesRemoteScriptWrapper::getImpedance() {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::queryCurrent() {
+
+    return this->query<ThalesRemoteCommands::Current>();
+}
 
-    std::complex<double> result(std::nan("1"), std::nan("1"));
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::queryPotential() {
 
-    std::string reply = this->executeRemoteCommand("IMPEDANCE");
+    return this->query<ThalesRemoteCommands::Potential>();
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::queryImpedance() {
+
+    return this->query<ThalesRemoteCommands::Impedance>();
+}
+
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::addCommand(std::string_view command) {
 
+    if (this->commands.empty() == false) {
 
-    std::regex replyStringPattern("impedance=\\s*(.*?),(.*?):");
-    std::smatch match;
+        this->commands += ":";
+    }
+
+    // A raw command may hold several commands, the setpoints among them are found by name.
+    while (true) {
+
+        size_t separator = command.find(':');
+        std::string_view single = command.substr(0, separator);
+        std::string_view name = single.substr(0, single.find('='));
 
-    std::regex_search(reply, match, replyStringPattern);
+        if (name.size() < single.size()) {
+            this->recordSetpoint(ThalesRemoteCommands::cacheSlot(name));
+        }
 
-    if (match.size() > 2) {
+        this->commands += single;
 
-        result = std::complex<double>(this->stringToDobule(match.str(1)), this->stringToDobule(match.str(2)));
+        if (separator == std::string_view::npos) {
+            break;
+        }
+
+        this->commands += ":";
+        command.remove_prefix(separator + 1);
     }
 
-    return result;
+    return *this;
 }
 
-std::complex<double> ThalesRemoteScriptWrapper::getImpedance(double frequency) {
+ThalesRemoteScriptWrapper::CommandBatch &ThalesRemoteScriptWrapper::CommandBatch::addSetpoint(std::string_view command, size_t slot) {
 
-    this->setFrequency(frequency);
+    if (command.empty()) {
 
-    return this->getImpedance();
+        return *this;
+    }
+
+    if (this->commands.empty() == false) {
+
+        this->commands += ":";
+    }
+
+    this->recordSetpoint(slot);
+    this->commands += command;
+
+    return *this;
 }
 
-std::complex<double> ThalesRemoteScriptWrapper::getImpedance(double frequency, double amplitude, int number_of_periods) {
+void ThalesRemoteScriptWrapper::CommandBatch::recordSetpoint(size_t slot) {
+
+    if (slot < ThalesRemoteCommands::cached_setpoint_count) {
+
+        this->setpoints.push_back({slot, this->commands.size()});
+    }
+}
 
-    this->setFrequency(frequency);
-    this->setAmplitude(amplitude);
-    this->setNumberOfPeriods(number_of_periods);
+const std::string &ThalesRemoteScriptWrapper::CommandBatch::getCommands() const {
 
-    return this->getImpedance();
+    return this->commands;
 }
 
-double ThalesRemoteScriptWrapper::requestValueAndParseUsingRegexp(std::string command, std::regex pattern) {
+bool ThalesRemoteScriptWrapper::CommandBatch::empty() const {
+
+    return this->commands.empty();
+}
 
-    double result = std::nan("1");
+void ThalesRemoteScriptWrapper::CommandBatch::clear() {
+
+    this->commands.clear();
+    this->setpoints.clear();
+}
 
-    std::string reply = this->executeRemoteCommand(command);
+ThalesRemoteScriptWrapper::BatchReply::BatchReply(std::string reply) :
+    reply(std::move(reply))
+{
 
-    std::regex replyStringPattern(pattern);
-    std::smatch match;
+}
 
-    std::regex_search(reply, match, replyStringPattern);
+double ThalesRemoteScriptWrapper::BatchReply::getCurrent() const {
 
-    if (match.size() > 1) {
+    return this->get<ThalesRemoteCommands::Current>();
+}
 
-        result = this->stringToDobule(match.str(1));
-    }
+double ThalesRemoteScriptWrapper::BatchReply::getPotential() const {
 
-    return result;
+    return this->get<ThalesRemoteCommands::Potential>();
 }
 
-double ThalesRemoteScriptWrapper::stringToDobule(std::string string) {
+std::complex<double> ThalesRemoteScriptWrapper::BatchReply::getImpedance() const {
 
-    std::stringstream stream(string);
-    double number;
+    return this->get<ThalesRemoteCommands::Impedance>();
+}
 
-    stream >> number;
+const std::string &ThalesRemoteScriptWrapper::BatchReply::getReply() const {
 
-    return number;
+    return this->reply;
 }
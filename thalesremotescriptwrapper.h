@@ -27,10 +27,14 @@
 #ifndef THALESREMOTESCRIPTWRAPPER_H
 #define THALESREMOTESCRIPTWRAPPER_H
 
-#include <regex>
 #include <complex>
+#include <charconv>
+#include <cmath>
+#include <array>
+#include <vector>
 
 #include "thalesremoteconnection.h"
+#include "thalesremotecommands.h"
 
 class ThalesRemoteScriptWrapper
 {
@@ -42,10 +46,138 @@ public:
         POTMODE_PSEUDOGALVANOSTATIC
     };
 
+    /** Collects several Remote Script commands which are sent as one compound telegram.
+     *
+     * Remote Script executes colon separated commands one after the other and
+     * answers with the results of all queries in one reply, so setting up and
+     * measuring a point costs one round trip instead of one per command.
+     *
+     * \code
+     * ThalesRemoteScriptWrapper::CommandBatch batch;
+     * batch.setFrequency(1000).setAmplitude(10e-3).queryImpedance();
+     * std::complex<double> impedance = remoteScript.executeBatch(batch).getImpedance();
+     * \endcode
+     */
+    class CommandBatch
+    {
+    public:
+
+        CommandBatch &setCurrent(double current);
+        CommandBatch &setPotential(double potential);
+        CommandBatch &enablePotentiostat(bool enabled = true);
+        CommandBatch &setPotentiostatMode(PotentiostatMode potentiostatMode);
+        CommandBatch &setFrequency(double frequency);
+        CommandBatch &setAmplitude(double amplitude);
+        CommandBatch &setNumberOfPeriods(int number_of_periods);
+
+        /** Appends "name=value" with the value formatted by formatValue(). */
+        CommandBatch &setValue(std::string_view name, double value);
+        CommandBatch &setValue(std::string_view name, int value);
+
+        CommandBatch &queryCurrent();
+        CommandBatch &queryPotential();
+        CommandBatch &queryImpedance();
+
+        /** Appends a setpoint of the command table, e.g. set<ThalesRemoteCommands::Frequency>(1000).
+         *
+         * \sa formatSetpoint()
+         */
+        template<typename Setpoint>
+        CommandBatch &set(typename Setpoint::value_type value) {
+
+            constexpr size_t slot = ThalesRemoteCommands::cacheSlot<Setpoint>();
+
+            char command[Setpoint::name.size() + 1 + max_formatted_value_length];
+
+            return this->addSetpoint(formatSetpoint<Setpoint>(command, sizeof(command), value), slot);
+        }
+
+        /** Appends a query of the command table, e.g. query<ThalesRemoteCommands::Impedance>(). */
+        template<typename Query>
+        CommandBatch &query() {
+
+            static_assert(ThalesRemoteCommands::is_query<Query>, "not a Remote Script query");
+
+            return this->addCommand(Query::query);
+        }
+
+        /** Appends a raw command, e.g. "Pset=0" or "IMPEDANCE".
+         *
+         * The cached setpoints in it are looked up by their name, set() knows
+         * the cache slot at compile time.
+         */
+        CommandBatch &addCommand(std::string_view command);
+
+        /** The commands separated by colons like they are sent to Remote Script. */
+        const std::string &getCommands() const;
+
+        bool empty() const;
+        void clear();
+
+    protected:
+
+        friend class ThalesRemoteScriptWrapper;
+
+        /** Appends "name=value" without temporary strings. */
+        CommandBatch &appendSetpoint(std::string_view name, std::string_view value);
+
+        /** Appends a formatted setpoint which goes into the given cache slot. */
+        CommandBatch &addSetpoint(std::string_view command, size_t slot);
+
+        /** Remembers the slot of the command which is appended next, if it is a cached setpoint. */
+        void recordSetpoint(size_t slot);
+
+        /** A cached setpoint in the commands. */
+        struct SetpointPosition {
+            size_t slot;
+            size_t begin;
+        };
+
+        std::string commands;
+
+        /** The cached setpoints in the order of the commands. */
+        std::vector<SetpointPosition> setpoints;
+    };
+
+    /** The reply to a CommandBatch.
+     *
+     * The getters parse the results of the corresponding queries from the
+     * reply and return NaN if the batch did not contain the query.
+     */
+    class BatchReply
+    {
+    public:
+
+        BatchReply(std::string reply);
+
+        double getCurrent() const;
+        double getPotential() const;
+        std::complex<double> getImpedance() const;
+
+        /** The result of a query of the command table, e.g. get<ThalesRemoteCommands::Impedance>(). */
+        template<typename Query>
+        typename Query::value_type get() const {
+
+            return parse<Query>(this->reply);
+        }
+
+        /** The reply as sent by Remote Script. */
+        const std::string &getReply() const;
+
+    protected:
+
+        std::string reply;
+    };
+
+    typedef std::function<void(BatchReply &&reply)> BatchCallback;
+
     /** Constructor. Needs a connected ThalesRemoteConnection */
     ThalesRemoteScriptWrapper(ThalesRemoteConnection * const remoteConnection);
 
     /** Directly execute a query to Remote Script.
+     *
+     * The wrapper can't tell what the command changes, so the setpoint cache
+     * is invalidated.
      *
      * \param [in] command The query string, e.g. "IMPEDANCE" or "Pset=0"
      *
@@ -53,6 +185,61 @@ public:
      */
     std::string executeRemoteCommand(std::string command);
 
+    /** Sends all commands of the batch in one telegram and waits for the reply.
+     *
+     * Setpoints which Remote Script already acknowledged with the same value
+     * are left out. If nothing is left, no telegram is sent at all and the
+     * reply is empty.
+     *
+     * \param [in] batch the commands to execute.
+     *
+     * \returns the reply which holds the results of the queries in the batch.
+     * \sa setSetpointCacheEnabled()
+     */
+    BatchReply executeBatch(const CommandBatch &batch);
+
+    /** Sends a command to Remote Script without waiting for the reply.
+     *
+     * Several commands can be in flight at the same time, Remote Script
+     * executes them in the order they were submitted. How many replies may
+     * be outstanding is set with ThalesRemoteConnection::setPipelineDepth().
+     *
+     * \param [in] command The query string, e.g. "IMPEDANCE" or "Pset=0"
+     *
+     * \returns a future which gets the reply sent by Remote Script.
+     * \sa executeRemoteCommand()
+     */
+    std::future<std::string> submitRemoteCommand(std::string command);
+
+    /** Pipelined version of executeBatch(). Parse the reply with BatchReply.
+     *
+     * \sa submitRemoteCommand()
+     */
+    std::future<std::string> submitBatch(const CommandBatch &batch);
+
+    /** Sends the batch and returns immediately, the callback gets the reply.
+     *
+     * The callback runs on the thread receiving the telegrams. It must return
+     * quickly and must not wait for other replies of this connection, e.g. by
+     * calling the synchronous methods. If the connection is lost before the
+     * reply arrives, the callback gets an empty reply and the getters of
+     * BatchReply return NaN.
+     *
+     * The call only blocks if the pipeline of the connection is full. If the
+     * setpoint cache leaves nothing to send, the callback is called right away
+     * with an empty reply. The wrapper has to outlive its pending requests.
+     *
+     * \param [in] batch the commands to execute.
+     * \param [in] callback called with the reply.
+     */
+    void executeBatchAsync(const CommandBatch &batch, BatchCallback callback);
+
+    /** Asynchronous version of executeBatch().
+     *
+     * \returns a future which gets the reply.
+     */
+    std::future<BatchReply> executeBatchAsync(const CommandBatch &batch);
+
     /** Prompts Thales to start the Remote Script
      *
      * Will switch a running Thales from anywhere like the main menu after
@@ -69,6 +256,14 @@ public:
     double getCurrent();
     double getPotential();
 
+    /** Asynchronous versions of getCurrent() and getPotential().
+     *
+     * The reply is parsed on the receiving thread, the future gets the value
+     * or NaN if something went wrong.
+     */
+    std::future<double> getCurrentAsync();
+    std::future<double> getPotentialAsync();
+
     void setCurrent(double current);
     void setPotential(double potential);
 
@@ -86,6 +281,20 @@ public:
     void setValue(std::string name, double value);
     void setValue(std::string name, int value);
 
+    /** Sets a setpoint of the command table, e.g. set<ThalesRemoteCommands::Frequency>(1000). */
+    template<typename Setpoint>
+    void set(typename Setpoint::value_type value) {
+
+        this->executeBatch(CommandBatch().set<Setpoint>(value));
+    }
+
+    /** Runs a query of the command table, e.g. get<ThalesRemoteCommands::Current>(). */
+    template<typename Query>
+    typename Query::value_type get() {
+
+        return this->executeBatch(CommandBatch().query<Query>()).template get<Query>();
+    }
+
     /** Sets the number of periods to average for one impedance measurement.
      *
      * \param [in] number_of_periods the number of periods / waves to average.
@@ -107,6 +316,8 @@ public:
     std::complex<double> getImpedance(double frequency);
 
     /** Measure the impedace with all possible parameters
+     *
+     * The parameters and the measurement are sent in a single telegram.
      *
      * \param [in] frequency the frequency to measure the impedance at.
      * \param [in] amplitude the amplitude to measure the impedance with. In Volt if potentiostatic mode or Ampere for galvanostatic mode.
@@ -116,20 +327,223 @@ public:
      */
     std::complex<double> getImpedance(double frequency, double amplitude, int number_of_periods = 1);
 
+    /** Asynchronous versions of getImpedance().
+     *
+     * Low frequencies take seconds to measure, meanwhile the calling thread
+     * can go on. The future gets the impedance or NaN if something went wrong.
+     */
+    std::future< std::complex<double> > getImpedanceAsync();
+    std::future< std::complex<double> > getImpedanceAsync(double frequency);
+    std::future< std::complex<double> > getImpedanceAsync(double frequency, double amplitude, int number_of_periods = 1);
+
+    /** Switches the setpoint cache on or off. It is on by default.
+     *
+     * The wrapper remembers the last value Remote Script acknowledged for
+     * Pset, Cset, Frq, Ampl, Nw, Gal, GAL and Pot and does not send them
+     * again unchanged. The cache is forgotten after a reconnect, after
+     * forceThalesIntoRemoteScript() and after raw commands.
+     *
+     * \warning Switch it off if the setpoints are also changed by other means, e.g. on the instrument.
+     */
+    void setSetpointCacheEnabled(bool enabled);
+
+    /** Forgets all cached setpoints, so they are sent again next time. */
+    void invalidateSetpointCache();
+
+    /** The number of telegrams which were not sent because all their setpoints were cached. */
+    unsigned long getSavedRoundTrips();
+
+    /** The number of setpoint commands which were left out of telegrams. */
+    unsigned long getSuppressedSetpoints();
+
+    /** Searches the reply for "key=" and converts the number after it.
+     *
+     * Remote Script answers queries with "key= value unit", e.g.
+     * "1:current= 1.234560e-05A:". The parser works on the reply in place,
+     * it does not allocate and does not throw.
+     *
+     * \param [in] reply the reply sent by Remote Script.
+     * \param [in] key the name of the value, e.g. "current".
+     *
+     * \return the value or NaN if the reply does not contain it.
+     */
+    static double parseValue(std::string_view reply, std::string_view key);
+
+    /** Searches the reply for "impedance= real,imaginary" and converts it.
+     *
+     * \return the impedance or NaN if the reply does not contain an impedance.
+     * \sa parseValue()
+     */
+    static std::complex<double> parseImpedance(std::string_view reply);
+
+    /** Room for the longest text formatValue() writes. */
+    static const size_t max_formatted_value_length = 32;
+
+    /** Writes the shortest text which converts back to exactly the value.
+     *
+     * Numbers which are very small or large are written with an exponent,
+     * e.g. "1e-09" for 1 nA or "2.5e+06" for 2.5 MHz, which Remote Script
+     * accepts. A fixed number of decimals would round small currents and
+     * frequencies to 0. Nothing is allocated.
+     *
+     * \param [out] buffer the text is written here.
+     * \param [in] size the size of the buffer, max_formatted_value_length is enough for every value.
+     * \param [in] value the value.
+     *
+     * \return the text in the buffer, empty if the buffer is too small.
+     */
+    static std::string_view formatValue(char *buffer, size_t size, double value);
+    static std::string_view formatValue(char *buffer, size_t size, int value);
+
+    /** Writes "name=value" of a setpoint of the command table.
+     *
+     * The value is clamped into the range of the setpoint and converted into
+     * the unit Remote Script expects, e.g. the amplitude from V into mV.
+     *
+     * \param [out] buffer the command is written here.
+     * \param [in] size the size of the buffer, the length of the name plus 1 + max_formatted_value_length is enough.
+     * \param [in] value the value in the unit of the wrapper.
+     *
+     * \return the command in the buffer, empty if the buffer is too small.
+     */
+    template<typename Setpoint>
+    static std::string_view formatSetpoint(char *buffer, size_t size, typename Setpoint::value_type value) {
+
+        constexpr std::string_view assignment = ThalesRemoteCommands::assignment<Setpoint>();
+
+        if (size < assignment.size()) {
+
+            return std::string_view();
+        }
+
+        std::copy(assignment.begin(), assignment.end(), buffer);
+
+        std::string_view number = formatValue(buffer + assignment.size(), size - assignment.size(), ThalesRemoteCommands::toRemoteValue<Setpoint>(value));
+
+        if (number.empty()) {
+
+            return std::string_view();
+        }
+
+        return std::string_view(buffer, assignment.size() + number.size());
+    }
+
+    /** Converts the result of a query of the command table from the reply.
+     *
+     * \return the value or NaN if the reply does not contain it.
+     * \sa parseValue()
+     */
+    template<typename Query>
+    static typename Query::value_type parse(std::string_view reply) {
+
+        static_assert(ThalesRemoteCommands::is_query<Query>, "not a Remote Script query");
+
+        if constexpr (std::is_same<typename Query::value_type, std::complex<double> >::value) {
+
+            return parseComplexValue(reply, Query::reply_key);
+
+        } else {
+
+            return parseValue(reply, Query::reply_key);
+        }
+    }
+
 protected:
 
-    double requestValueAndParseUsingRegexp(std::string command, std::regex pattern);
+    friend class ImpedanceSweep;
+    friend class FixedRateAcquisition;
+
+    /** Executes the batch asynchronously and sets the future to what the getter parses from the reply. */
+    template<typename T>
+    std::future<T> requestAsync(const CommandBatch &batch, T (BatchReply::*getter)() const) {
+
+        std::shared_ptr< std::promise<T> > promise = std::make_shared< std::promise<T> >();
+        std::future<T> future = promise->get_future();
 
-    /** Converts a string to double.
+        this->executeBatchAsync(batch, [promise, getter](BatchReply &&reply) {
+            promise->set_value((reply.*getter)());
+        });
+
+        return future;
+    }
+
+    /** Converts the number at the beginning of the text.
+     *
+     * Like the stream extraction this replaced, leading whitespace and a
+     * leading plus sign are skipped, which std::from_chars does not accept,
+     * and the conversion stops at the first character which does not belong
+     * to the number, e.g. the unit.
      *
-     * This needed to be added because the numberical strings delivered
-     * by Thales could not be parsed by std::stod in some cases.
+     * \param [in] begin the first character of the text.
+     * \param [in] end the end of the text.
+     * \param [out] value the converted number.
+     *
+     * \return the position after the number or nullptr if there is no number.
+     */
+    static const char *parseNumber(const char *begin, const char *end, double &value);
+
+    /** Converts "key= real,imaginary" like parseImpedance(). */
+    static std::complex<double> parseComplexValue(std::string_view reply, std::string_view key);
+
+    /** Returns the text after "key=" up to the next colon or an empty view if the key is missing. */
+    static std::string_view findValue(std::string_view reply, std::string_view key);
+
+    /** Sends the command without touching the setpoint cache and records its latency in the metrics of the connection. */
+    std::string sendRemoteCommand(const std::string &command);
+
+    /** The name the latency of a command line is recorded under.
      *
-     * \return the value which was previously coded as string.
+     * This is the name of the last command, which is the query if there is one,
+     * e.g. "IMPEDANCE" for "Frq=1000:Ampl=0.01:IMPEDANCE" or "Pset" for "Pset=0".
      */
-    double stringToDobule(std::string string);
+    static std::string_view getCommandName(std::string_view commands);
+
+    /** The setpoints of a telegram which are waiting for their acknowledgement, by cache slot. */
+    struct SetpointWrites {
+        unsigned long cache_epoch;
+        std::vector< std::pair<size_t, std::string> > values;
+    };
+
+    /** Removes the setpoints Remote Script already has from the commands of the batch.
+     *
+     * \param [in] batch the commands and the cache slots of their setpoints.
+     * \param [out] writes the cached setpoints which are still sent.
+     *
+     * \returns the remaining commands.
+     */
+    std::string removeKnownSetpoints(const CommandBatch &batch, SetpointWrites &writes);
+
+    /** Clears the acknowledged values. setpointCacheGuard has to be locked. */
+    void forgetSetpoints();
+
+    /** Updates the cache once the reply to the setpoints arrived or the request failed. */
+    void acknowledgeSetpoints(const SetpointWrites &writes, bool acknowledged);
+
+    /** Checks if Remote Script accepted the commands.
+     *
+     * \returns false if the reply is empty, e.g. because the connection failed, or reports an error.
+     */
+    static bool isAcknowledged(std::string_view reply);
 
     ThalesRemoteConnection * const remoteConnection;
+
+    struct CachedSetpoint {
+        std::string acknowledged_value;
+        int writes_in_flight = 0;
+    };
+
+    std::mutex setpointCacheGuard;
+
+    /** One slot per setpoint in ThalesRemoteCommands::cached_setpoints. */
+    std::array<CachedSetpoint, ThalesRemoteCommands::cached_setpoint_count> setpointCache;
+    bool setpoint_cache_enabled;
+
+    /** Changes on invalidation, so acknowledgements of older requests are ignored. */
+    unsigned long cache_epoch;
+    unsigned long cache_connection_generation;
+
+    unsigned long saved_round_trips;
+    unsigned long suppressed_setpoints;
 };
 
 #endif // THALESREMOTESCRIPTWRAPPER_H